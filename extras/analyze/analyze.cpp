@@ -0,0 +1,120 @@
+/**
+ * @file analyze.cpp
+ * @brief Host tool that prints worst-case run() counts and times between the Wait states of a definition.
+ *
+ * Usage: analyze [--json] definition.json [profile.json ...]
+ *
+ * Each profile is the object StepFunction::writeProfile() wrote on a
+ * device, e.g. captured from Serial. The tool exits with status 1 if a cycle
+ * without a Wait state makes a segment unbounded, so it can gate a build.
+ *
+ * Build it on the host from this file, the library's src/*.cpp and
+ * ArduinoJson, with an Arduino.h that provides String, Print, Stream,
+ * Serial, millis() and micros().
+ */
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include "DefinitionAnalysis.h"
+
+/**
+ * @brief Reads a whole file, or returns false.
+ */
+static bool readFile(const char *path, std::string &text) {
+    FILE *file = fopen(path, "rb");
+    if (!file) {
+        fprintf(stderr, "Cannot open %s\n", path);
+        return false;
+    }
+    char buffer[4096];
+    size_t length;
+    while ((length = fread(buffer, 1, sizeof(buffer), file)) > 0) {
+        text.append(buffer, length);
+    }
+    fclose(file);
+    return true;
+}
+
+/**
+ * @brief Names the end of a segment: a Wait state, or the start or end of the execution.
+ */
+static const char *endpoint(JsonVariantConst name, const char *otherwise) {
+    return name.isNull() ? otherwise : name.as<const char *>();
+}
+
+int main(int argc, char **argv) {
+    bool json = argc > 1 && strcmp(argv[1], "--json") == 0;
+    int first = json ? 2 : 1;
+    if (argc <= first) {
+        fprintf(stderr, "Usage: %s [--json] definition.json [profile.json ...]\n", argv[0]);
+        return 2;
+    }
+
+    std::string config;
+    StepDefinition definition;
+    if (!readFile(argv[first], config) || !definition.parse(config.c_str())) {
+        fprintf(stderr, "%s is not a valid definition\n", argv[first]);
+        return 2;
+    }
+
+    DefinitionAnalysis analysis(definition);
+    for (int i = first + 1; i < argc; i++) {
+        std::string text;
+        JsonDocument profile;
+        if (!readFile(argv[i], text) || deserializeJson(profile, text)) {
+            fprintf(stderr, "%s is not a valid profile\n", argv[i]);
+            return 2;
+        }
+        analysis.addProfile(profile.as<JsonObjectConst>());
+    }
+
+    JsonDocument result;
+    bool bounded = analysis.analyze(result);
+    if (json) {
+        std::string out;
+        serializeJsonPretty(result, out);
+        printf("%s\n", out.c_str());
+        return bounded ? 0 : 1;
+    }
+
+    printf("%-24s %-24s %8s %12s\n", "From", "To", "Runs", "Micros");
+    for (JsonObjectConst segment: result["Segments"].as<JsonArrayConst>()) {
+        const char *from = endpoint(segment["From"], "(start)");
+        if (segment["Unbounded"].as<bool>()) {
+            printf("%-24s %-24s %8s %12s\n", from, "(cycle)", "-", "-");
+            continue;
+        }
+        printf("%-24s %-24s %8lu %12lu\n", from, endpoint(segment["To"], "(end)"),
+               segment["Runs"].as<unsigned long>(), segment["Micros"].as<unsigned long>());
+    }
+
+    JsonObjectConst worst = result["Worst"];
+    if (!worst["Path"].isNull()) {
+        printf("\nWorst case: %lu runs, %lu us, from %s to %s\n  ", worst["Runs"].as<unsigned long>(),
+               worst["Micros"].as<unsigned long>(), endpoint(worst["From"], "(start)"), endpoint(worst["To"], "(end)"));
+        const char *separator = "";
+        for (JsonVariantConst state: worst["Path"].as<JsonArrayConst>()) {
+            printf("%s%s", separator, state.as<const char *>());
+            separator = " -> ";
+        }
+        printf("\nMost runs between Waits: %lu\n", worst["MaxRuns"].as<unsigned long>());
+    }
+
+    for (JsonArrayConst cycle: result["Cycles"].as<JsonArrayConst>()) {
+        printf("\nCycle without a Wait state:");
+        for (JsonVariantConst state: cycle) {
+            printf(" %s", state.as<const char *>());
+        }
+        printf("\n");
+    }
+
+    JsonArrayConst unmeasured = result["Unmeasured"];
+    if (unmeasured.size() > 0) {
+        printf("\nEstimated, never profiled:");
+        for (JsonVariantConst state: unmeasured) {
+            printf(" %s", state.as<const char *>());
+        }
+        printf("\n");
+    }
+    return bounded ? 0 : 1;
+}
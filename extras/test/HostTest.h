@@ -0,0 +1,28 @@
+#ifndef HOST_TEST_H
+#define HOST_TEST_H
+
+#include <stdio.h>
+
+/**
+ * @file HostTest.h
+ * @brief The check macro shared by the host tests in extras/test.
+ *
+ * Each test is a standalone program: it prints every failed check with its
+ * line and returns the number of failures from main(), so any runner that
+ * treats a non-zero exit status as a failure can gate a build on it.
+ */
+
+static int failures = 0; /**< Checks failed so far. */
+
+/**
+ * @brief Records a failure, with the source line, if a condition is false.
+ */
+#define CHECK(condition) \
+    do { \
+        if (!(condition)) { \
+            fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #condition); \
+            failures++; \
+        } \
+    } while (0)
+
+#endif //HOST_TEST_H
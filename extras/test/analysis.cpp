@@ -0,0 +1,125 @@
+/**
+ * @file analysis.cpp
+ * @brief Host test: DefinitionAnalysis bounds the segments between Wait states and finds cycles without one.
+ *
+ * Usage: analysis
+ *
+ * Build it on the host from this file, the library's src/*.cpp and
+ * ArduinoJson, with an Arduino.h that provides String, Print, Stream,
+ * Serial, millis() and micros().
+ */
+#include <stdio.h>
+#include <string.h>
+#include "DefinitionAnalysis.h"
+#include "HostTest.h"
+
+static const char *definition = R"({"StartAt":"Read","States":{
+    "Read":{"Type":"Task","Resource":"fast","Next":"Decide"},
+    "Decide":{"Type":"Choice","Choices":[{"Condition":"{% $.n < 3 %}","Next":"Slow"}],"Default":"Pause"},
+    "Slow":{"Type":"Task","Resource":"slow","Next":"Pause"},
+    "Other":{"Type":"Task","Resource":"slow","Next":"Pause"},
+    "Pause":{"Type":"Wait","Millis":10,"Next":"Again"},
+    "Again":{"Type":"Task","Resource":"slow","Next":"Done"},
+    "Done":{"Type":"Pass","End":true}}})";
+
+/**
+ * @brief What StepFunction::writeProfile() wrote after one execution went Read, Decide, Slow.
+ *
+ * The engine overhead is 20 µs for Read and 30 µs for Slow.
+ */
+static const char *profile = R"({"Read":{"Resource":"fast","Runs":1,"MaxMicros":120,"HandlerMaxMicros":100},)"
+                             R"("Slow":{"Resource":"slow","Runs":1,"MaxMicros":530,"HandlerMaxMicros":500}})";
+
+static bool named(JsonVariantConst name, const char *expected) {
+    return name.is<const char *>() && strcmp(name.as<const char *>(), expected) == 0;
+}
+
+/**
+ * @brief Checks the bounds of the definition above, parsed or indexed.
+ */
+static void bounds(StepDefinition &parsed) {
+    JsonDocument measured;
+    deserializeJson(measured, profile);
+    DefinitionAnalysis analysis(parsed);
+    analysis.addProfile(measured.as<JsonObjectConst>());
+    JsonDocument result;
+    CHECK(analysis.analyze(result));
+    CHECK(result["Cycles"].size() == 0);
+
+    // Unmeasured states cost their Resource's handler plus the largest overhead, 30 µs
+    JsonArrayConst segments = result["Segments"];
+    CHECK(segments.size() == 2);
+    for (JsonObjectConst segment: segments) {
+        if (segment["From"].isNull()) {
+            // Read 120, Decide 30, Slow 530, Pause 30
+            CHECK(named(segment["To"], "Pause"));
+            CHECK(segment["Runs"].as<int>() == 4 && segment["Micros"].as<int>() == 710);
+        } else {
+            // Again 500 + 30, Done 30
+            CHECK(named(segment["From"], "Pause") && segment["To"].isNull());
+            CHECK(segment["Runs"].as<int>() == 2 && segment["Micros"].as<int>() == 560);
+        }
+    }
+
+    JsonObjectConst worst = result["Worst"];
+    CHECK(worst["From"].isNull() && named(worst["To"], "Pause"));
+    CHECK(worst["Micros"].as<int>() == 710 && worst["MaxRuns"].as<int>() == 4);
+    CHECK(worst["Path"].size() == 4 && named(worst["Path"][2], "Slow"));
+
+    // Other is unreachable, so it is not reported
+    JsonArrayConst unmeasured = result["Unmeasured"];
+    CHECK(unmeasured.size() == 4);
+    for (JsonVariantConst state: unmeasured) {
+        CHECK(!named(state, "Other") && !named(state, "Read") && !named(state, "Slow"));
+    }
+}
+
+int main(int, char **argv) {
+    StepDefinition parsed;
+    CHECK(parsed.parse(definition));
+    bounds(parsed);
+    StepDefinition indexed;
+    CHECK(indexed.index(definition));
+    bounds(indexed);
+
+    // Without a profile only the run() counts are bounded
+    DefinitionAnalysis unprofiled(parsed);
+    JsonDocument counts;
+    CHECK(unprofiled.analyze(counts));
+    CHECK(counts["Worst"]["MaxRuns"].as<int>() == 4 && counts["Worst"]["Micros"].as<int>() == 0);
+    CHECK(counts["Unmeasured"].isNull());
+
+    // A loop that never reaches a Wait state leaves the segments into it unbounded
+    StepDefinition loop;
+    CHECK(loop.parse(R"({"StartAt":"A","States":{
+        "A":{"Type":"Pass","Next":"B"},
+        "B":{"Type":"Choice","Choices":[{"Condition":"{% $.x %}","Next":"A"}],"Default":"W"},
+        "W":{"Type":"Wait","Millis":5,"Next":"C"},
+        "C":{"Type":"Task","Resource":"t","Next":"D"},
+        "D":{"Type":"Pass","Next":"W"}}})"));
+    DefinitionAnalysis loopAnalysis(loop);
+    JsonDocument loopResult;
+    CHECK(!loopAnalysis.analyze(loopResult));
+    CHECK(loopResult["Cycles"].size() == 1 && loopResult["Cycles"][0].size() == 2);
+    bool unbounded = false;
+    for (JsonObjectConst segment: loopResult["Segments"].as<JsonArrayConst>()) {
+        if (segment["From"].isNull()) {
+            unbounded = segment["Unbounded"].as<bool>();
+        }
+    }
+    CHECK(unbounded);
+    // The bounded segment from W back to W is still the worst one
+    CHECK(named(loopResult["Worst"]["From"], "W") && named(loopResult["Worst"]["To"], "W"));
+    CHECK(loopResult["Worst"]["Runs"].as<int>() == 3);
+
+    StepDefinition self;
+    CHECK(self.parse(R"({"StartAt":"S","States":{"S":{"Type":"Choice","Choices":[)"
+                     R"({"Condition":"{% true %}","Next":"S"}],"Default":"E"},"E":{"Type":"Pass","End":true}}})"));
+    DefinitionAnalysis selfAnalysis(self);
+    JsonDocument selfResult;
+    CHECK(!selfAnalysis.analyze(selfResult));
+    CHECK(selfResult["Cycles"].size() == 1 && named(selfResult["Cycles"][0][0], "S"));
+
+    printf("%s: %d failed\n", argv[0], failures);
+    return failures;
+}
@@ -0,0 +1,140 @@
+/**
+ * @file checkpoint.cpp
+ * @brief Host test: a CheckpointStore keeps its previous checkpoint through power cuts and corruption.
+ *
+ * Usage: checkpoint [flash.bin]
+ *
+ * Build it on the host from this file, the library's src/*.cpp and
+ * ArduinoJson, with an Arduino.h that provides String, Print, Stream,
+ * Serial, millis() and micros(). The emulated flash file is removed at the end.
+ */
+#include <stdio.h>
+#include "CheckpointStore.h"
+#include "StepFunction.h"
+#include "HostTest.h"
+
+#define SECTOR_SIZE 256
+#define SECTOR_COUNT 4
+
+static const char *definition = R"({"StartAt":"Done","States":{"Done":{"Type":"Succeed"}}})";
+
+static void handler(const String &, Variables &) {
+}
+
+/**
+ * @brief Writes a snapshot whose "generation" variable identifies it; the label makes it span several flushes.
+ */
+static bool save(StepFunction &execution, Print &destination, int generation) {
+    JsonDocument value;
+    value.set(generation);
+    execution.setVariable("generation", value.as<JsonVariantConst>());
+    String label;
+    for (int i = 0; i < 12; i++) {
+        label += String(generation * 131 + i * 7919);
+        label += ',';
+    }
+    value.set(label.c_str());
+    execution.setVariable("label", value.as<JsonVariantConst>());
+    return execution.saveStateBinary(destination) > 0;
+}
+
+/**
+ * @brief Returns the generation of the newest checkpoint, or -1 if it cannot be restored.
+ */
+static int restore(CheckpointStore &store) {
+    StepFunction execution(handler);
+    execution.setup(definition);
+    if (!execution.restoreState(store.reader())) {
+        return -1;
+    }
+    JsonVariantConst generation = execution.output()["generation"];
+    return generation.is<int>() ? generation.as<int>() : -1;
+}
+
+/**
+ * @brief Cuts power after every possible number of programmed bytes of one checkpoint.
+ *
+ * Every cut leaves the payload or the header incomplete, so commit() must
+ * fail and the next boot must find the previous checkpoint; only the run
+ * with enough bytes for the whole checkpoint may advance it.
+ */
+static void powerCuts(const char *path) {
+    remove(path);
+    StepFunction execution(handler);
+    execution.setup(definition);
+    {
+        FileFlashDevice flash(path, SECTOR_SIZE, SECTOR_COUNT);
+        CheckpointStore store(flash);
+        CHECK(!store.begin());
+        CHECK(save(execution, store.open(), 1));
+        CHECK(store.commit());
+    }
+
+    int committed = 1;
+    for (size_t budget = 0; budget <= SECTOR_SIZE; budget++) {
+        // A new device and store per attempt, as after a reboot
+        FileFlashDevice flash(path, SECTOR_SIZE, SECTOR_COUNT);
+        CheckpointStore store(flash);
+        CHECK(store.begin());
+        CHECK(store.sequence() == static_cast<uint32_t>(committed));
+        CHECK(restore(store) == committed);
+
+        Print &payload = store.open();
+        flash.cutPowerAfter(budget);
+        save(execution, payload, committed + 1);
+        if (store.commit()) {
+            committed++;
+            break;
+        }
+    }
+    CHECK(committed == 2);
+
+    FileFlashDevice flash(path, SECTOR_SIZE, SECTOR_COUNT);
+    CheckpointStore store(flash);
+    CHECK(store.begin());
+    CHECK(store.sequence() == 2);
+    CHECK(restore(store) == 2);
+}
+
+/**
+ * @brief A payload byte changed after the commit fails the CRC, and begin() falls back to the checkpoint before.
+ */
+static void corruption(const char *path) {
+    remove(path);
+    StepFunction execution(handler);
+    execution.setup(definition);
+    FileFlashDevice flash(path, SECTOR_SIZE, SECTOR_COUNT);
+    CheckpointStore store(flash);
+    for (int generation = 1; generation <= 5; generation++) {
+        CHECK(save(execution, store.open(), generation));
+        CHECK(store.commit());
+    }
+    CHECK(store.begin());
+    CHECK(store.sequence() == 5);
+
+    // Clearing bits is all a NOR write can do, so this damages the newest payload in place
+    uint8_t zeros[16] = {};
+    size_t newest = (store.sequence() - 1) % store.slots();
+    CHECK(flash.write(newest, 40, zeros, sizeof(zeros)));
+    CHECK(store.begin());
+    CHECK(store.sequence() == 4);
+    CHECK(restore(store) == 4);
+
+    // An overflowing checkpoint is refused and leaves the fallback in place
+    Print &payload = store.open();
+    for (size_t i = 0; i <= store.capacity(); i++) {
+        payload.write('x');
+    }
+    CHECK(!store.commit());
+    CHECK(store.begin());
+    CHECK(store.sequence() == 4);
+}
+
+int main(int argc, char **argv) {
+    const char *path = argc > 1 ? argv[1] : "checkpoint-test.bin";
+    powerCuts(path);
+    corruption(path);
+    remove(path);
+    printf("%s: %d failed\n", argv[0], failures);
+    return failures;
+}
@@ -0,0 +1,116 @@
+/**
+ * @file cron.cpp
+ * @brief Host test: CronExpression fires on exactly the minutes its fields expand to.
+ *
+ * Usage: cron
+ *
+ * Build it on the host from this file and the library's CronExpression.cpp;
+ * it needs no Arduino.h.
+ */
+#include <stdio.h>
+#include <time.h>
+#include "CronExpression.h"
+#include "HostTest.h"
+
+#define START 1700000000UL /**< 2023-11-14 22:13:20 UTC, a Tuesday. */
+
+typedef bool (*Matcher)(const struct tm &time);
+
+/**
+ * @brief Compares the next fires of an expression with a minute-by-minute scan of a reference matcher.
+ */
+static void expect(const char *expression, Matcher matches, int fires = 50) {
+    CronExpression cron;
+    if (!cron.compile(expression)) {
+        fprintf(stderr, "\"%s\" does not compile\n", expression);
+        failures++;
+        return;
+    }
+    uint32_t after = START;
+    for (int i = 0; i < fires; i++) {
+        uint32_t expected = (after / 60 + 1) * 60;
+        for (;; expected += 60) {
+            time_t seconds = expected;
+            struct tm time;
+            gmtime_r(&seconds, &time);
+            if (matches(time)) {
+                break;
+            }
+        }
+        uint32_t fire = cron.next(after);
+        if (fire != expected) {
+            fprintf(stderr, "\"%s\" after %lu: fired at %lu, expected %lu\n", expression,
+                    static_cast<unsigned long>(after), static_cast<unsigned long>(fire),
+                    static_cast<unsigned long>(expected));
+            failures++;
+            return;
+        }
+        after = fire;
+    }
+}
+
+int main(int, char **argv) {
+    expect("* * * * *", [](const struct tm &) { return true; });
+    expect("0 * * * *", [](const struct tm &t) { return t.tm_min == 0; });
+    expect("30 4 * * *", [](const struct tm &t) { return t.tm_min == 30 && t.tm_hour == 4; });
+
+    // Lists, ranges and steps
+    expect("1,2,10-12 * * * *", [](const struct tm &t) {
+        return t.tm_min == 1 || t.tm_min == 2 || (t.tm_min >= 10 && t.tm_min <= 12);
+    });
+    expect("*/20 */6 * * *", [](const struct tm &t) { return t.tm_min % 20 == 0 && t.tm_hour % 6 == 0; });
+    expect("0-59/15 8-18 * * 1-5", [](const struct tm &t) {
+        return t.tm_min % 15 == 0 && t.tm_hour >= 8 && t.tm_hour <= 18 && t.tm_wday >= 1 && t.tm_wday <= 5;
+    }, 200);
+    expect("10-30/7,45 * * * *", [](const struct tm &t) {
+        return (t.tm_min >= 10 && t.tm_min <= 30 && (t.tm_min - 10) % 7 == 0) || t.tm_min == 45;
+    });
+
+    // A step after a single value runs to the end of the field
+    expect("5/15 * * * *", [](const struct tm &t) { return t.tm_min % 15 == 5; });
+    expect("0 20/2 * * *", [](const struct tm &t) { return t.tm_min == 0 && (t.tm_hour == 20 || t.tm_hour == 22); });
+
+    // Sunday is both 0 and 7
+    expect("0 0 * * 0", [](const struct tm &t) { return t.tm_min == 0 && t.tm_hour == 0 && t.tm_wday == 0; });
+    expect("0 0 * * 7", [](const struct tm &t) { return t.tm_min == 0 && t.tm_hour == 0 && t.tm_wday == 0; });
+    expect("0 0 * * 5-7", [](const struct tm &t) {
+        return t.tm_min == 0 && t.tm_hour == 0 && (t.tm_wday == 0 || t.tm_wday >= 5);
+    });
+
+    // Both day fields restricted: either matches; a day field starting with a star does not count
+    expect("0 12 13 * 5", [](const struct tm &t) {
+        return t.tm_min == 0 && t.tm_hour == 12 && (t.tm_mday == 13 || t.tm_wday == 5);
+    });
+    expect("0 12 */2 * 1", [](const struct tm &t) {
+        return t.tm_min == 0 && t.tm_hour == 12 && t.tm_mday % 2 == 1 && t.tm_wday == 1;
+    });
+    expect("0 12 1-7 * */3", [](const struct tm &t) {
+        return t.tm_min == 0 && t.tm_hour == 12 && t.tm_mday <= 7 && t.tm_wday % 3 == 0;
+    });
+
+    // Months, and a day that only some months have
+    expect("0 0 1 1,7 *", [](const struct tm &t) {
+        return t.tm_min == 0 && t.tm_hour == 0 && t.tm_mday == 1 && (t.tm_mon == 0 || t.tm_mon == 6);
+    }, 6);
+    expect("0 0 29 2 *", [](const struct tm &t) {
+        return t.tm_min == 0 && t.tm_hour == 0 && t.tm_mday == 29 && t.tm_mon == 1;
+    }, 1);
+
+    const char *malformed[] = {"61 * * * *", "* 24 * * *", "* * 0 * *", "* * * 13 *", "* * * * 8", "* * *",
+                               "* * * * * *", "*/0 * * * *", "5-2 * * * *", "1- * * * *", "a * * * *", "1,* * * *"};
+    for (const char *expression: malformed) {
+        CronExpression cron;
+        if (cron.compile(expression)) {
+            fprintf(stderr, "\"%s\" compiles\n", expression);
+            failures++;
+        }
+    }
+
+    // A date that never comes
+    CronExpression never;
+    CHECK(never.compile("0 0 31 2 *"));
+    CHECK(never.next(START) == 0);
+
+    printf("%s: %d failed\n", argv[0], failures);
+    return failures;
+}
@@ -0,0 +1,180 @@
+/**
+ * @file definition.cpp
+ * @brief Host test: indexed and paged definitions run exactly like a parsed one.
+ *
+ * Usage: definition [definition.json]
+ *
+ * Build it on the host from this file, the library's src/*.cpp and
+ * ArduinoJson, with an Arduino.h that provides String, Print, Stream,
+ * Serial, millis() and micros(). The paged definition is read from a file,
+ * which is removed at the end.
+ */
+#include <stdio.h>
+#include <string>
+#include "StepFunction.h"
+#include "HostTest.h"
+
+#define STATES 120
+#define LAPS 3
+
+static unsigned long now = 0; /**< Clock of every execution, advanced past each Wait state. */
+
+static unsigned long testClock(void *) {
+    return now;
+}
+
+static unsigned long tasks = 0;
+
+static void handler(const String &, Variables &) {
+    tasks++;
+}
+
+/**
+ * @brief Builds a definition that loops LAPS times over Task, Pass, Wait and Choice states.
+ */
+static std::string generate() {
+    std::string text = "{\"Version\":\"3\",\"StartAt\":\"S0\",\"States\":{";
+    char state[256];
+    for (int i = 0; i < STATES; i++) {
+        switch (i % 5) {
+            case 0:
+                snprintf(state, sizeof(state),
+                         "\"S%d\":{\"Type\":\"Choice\",\"Choices\":[{\"Variable\":\"mode\",\"StringEquals\":\"a\","
+                         "\"Next\":\"S%d\"}],\"Default\":\"S%d\"},",
+                         i, i + 1, i + 2);
+                break;
+            case 1:
+                snprintf(state, sizeof(state), "\"S%d\":{\"Type\":\"Task\",\"Resource\":\"r%d\",\"Next\":\"S%d\"},",
+                         i, i, i + 1);
+                break;
+            case 2:
+                snprintf(state, sizeof(state),
+                         "\"S%d\":{\"Type\":\"Pass\",\"Assign\":{\"x\":\"{%% $x + 1 %%}\"},\"Next\":\"S%d\"},", i,
+                         i + 1);
+                break;
+            case 3:
+                snprintf(state, sizeof(state), "\"S%d\":{\"Type\":\"Wait\",\"Millis\":5,\"Next\":\"S%d\"},", i,
+                         i + 1);
+                break;
+            default:
+                snprintf(state, sizeof(state), "\"S%d\":{\"Type\":\"Pass\",\"Assign\":{\"mode\":\"%s\"},"
+                         "\"Next\":\"S%d\"},", i, i % 2 ? "a" : "b", i + 1);
+                break;
+        }
+        text += state;
+    }
+    snprintf(state, sizeof(state),
+             "\"S%d\":{\"Type\":\"Choice\",\"Choices\":[{\"Condition\":\"{%% $x < %d %%}\",\"Next\":\"S0\"}],"
+             "\"Default\":\"End\"},\"End\":{\"Type\":\"Pass\",\"End\":true}}}",
+             STATES, STATES / 5 * LAPS);
+    text += state;
+    return text;
+}
+
+/**
+ * @brief Starts an execution of a definition with x at 0.
+ */
+static void start(StepFunction &execution, StepDefinition &definition) {
+    execution.setup(definition);
+    execution.setClock(testClock);
+    JsonDocument input;
+    input["x"] = 0;
+    input["mode"] = "a";
+    execution.start(input.as<JsonVariantConst>());
+}
+
+/**
+ * @brief Runs the executions in lockstep; every step must return the same status and leave the same snapshot.
+ *
+ * Each snapshot is also restored into an execution of the next definition,
+ * so a state saved by one mode resumes in the others.
+ */
+static void lockstep(StepDefinition **definitions, size_t count) {
+    StepFunction **executions = new StepFunction *[count];
+    for (size_t i = 0; i < count; i++) {
+        executions[i] = new StepFunction(handler);
+        start(*executions[i], *definitions[i]);
+    }
+
+    int steps = 0;
+    for (int status = NEXT_STEP; status != END_OF_PROCESS && status != INVALID_STATE; steps++) {
+        status = executions[0]->run();
+        String expected = executions[0]->saveState();
+        for (size_t i = 1; i < count; i++) {
+            CHECK(executions[i]->run() == status);
+            CHECK(executions[i]->saveState() == expected);
+        }
+        for (size_t i = 0; i < count; i++) {
+            StepFunction resumed(handler);
+            resumed.setup(*definitions[(i + 1) % count]);
+            resumed.setClock(testClock);
+            CHECK(resumed.restoreState(executions[i]->saveState()));
+            CHECK(resumed.saveState() == expected);
+        }
+        if (status == WAIT_DELAY) {
+            now += 5;
+        }
+        if (steps > STATES * (LAPS + 1) * 2) {
+            CHECK(!"the definition did not end");
+            break;
+        }
+    }
+    CHECK(executions[0]->output()["x"].as<int>() == STATES / 5 * LAPS);
+
+    for (size_t i = 0; i < count; i++) {
+        delete executions[i];
+    }
+    delete[] executions;
+}
+
+int main(int argc, char **argv) {
+    const char *path = argc > 1 ? argv[1] : "definition-test.json";
+    std::string text = generate();
+    FILE *file = fopen(path, "wb");
+    CHECK(file && fwrite(text.data(), 1, text.size(), file) == text.size());
+    if (file) {
+        fclose(file);
+    }
+
+    StepDefinition parsed;
+    StepDefinition indexed;
+    StepDefinition paged;
+    FileDefinitionSource source(path);
+    CHECK(parsed.parse(text.c_str()));
+    CHECK(indexed.index(text.c_str()));
+    // A cache far smaller than a lap, so states are evicted and compiled again
+    CHECK(paged.index(source, 4, 2));
+    CHECK(paged.isPaged());
+
+    CHECK(indexed.compiled() == 0);
+    CHECK(indexed.size() == parsed.size() && paged.size() == parsed.size());
+    CHECK(indexed.hash() == parsed.hash() && paged.hash() == parsed.hash());
+    CHECK(strcmp(indexed.version(), "3") == 0 && strcmp(paged.startAt(), "S0") == 0);
+
+    StepDefinition *definitions[] = {&parsed, &indexed, &paged};
+    lockstep(definitions, 3);
+    CHECK(paged.cacheStats().evictions > 0);
+    // Only Choices after a state that set mode to "a" lead to their Task: every other one
+    CHECK(tasks == 3UL * STATES / 10 * LAPS);
+
+    // A state that does not compile fails parse(), but an indexed definition only on its first visit
+    std::string broken = "{\"StartAt\":\"A\",\"States\":{\"A\":{\"Type\":\"Pass\",\"Next\":\"B\"},"
+                         "\"B\":{\"Type\":\"Pass\",\"Assign\":{\"y\":\"{% 1 + %}\"}}}}";
+    StepDefinition lazy;
+    CHECK(!parsed.parse(broken.c_str()));
+    CHECK(lazy.index(broken.c_str()));
+    CHECK(lazy.find("A") != nullptr);
+    CHECK(lazy.find("B") == nullptr);
+    StepFunction execution(handler);
+    execution.setup(lazy);
+    execution.start(JsonVariantConst());
+    CHECK(execution.run() == NEXT_STEP);
+    CHECK(execution.run() == INVALID_STATE);
+
+    CHECK(!indexed.index("{\"States\":{\"A\":{"));
+    CHECK(!indexed.index("[1]"));
+
+    remove(path);
+    printf("%s: %d failed\n", argv[0], failures);
+    return failures;
+}
@@ -0,0 +1,135 @@
+/**
+ * @file lz.cpp
+ * @brief Host test: LzDecoder gives back exactly what LzEncoder was given.
+ *
+ * Usage: lz
+ *
+ * Build it on the host from this file, the library's src/*.cpp and
+ * ArduinoJson, with an Arduino.h that provides String, Print, Stream,
+ * Serial, millis() and micros().
+ */
+#include <stdio.h>
+#include <string>
+#include "LzStream.h"
+#include "HostTest.h"
+
+/**
+ * @brief A Stream over bytes in memory; writes append, reads consume from the front.
+ */
+class MemoryStream : public Stream {
+public:
+    std::string bytes;
+    size_t position = 0;
+
+    size_t write(uint8_t value) override {
+        bytes += static_cast<char>(value);
+        return 1;
+    }
+
+    using Print::write;
+
+    int available() override {
+        return static_cast<int>(bytes.size() - position);
+    }
+
+    int read() override {
+        return position < bytes.size() ? static_cast<uint8_t>(bytes[position++]) : -1;
+    }
+
+    int peek() override {
+        return position < bytes.size() ? static_cast<uint8_t>(bytes[position]) : -1;
+    }
+};
+
+static std::string compress(const std::string &input) {
+    MemoryStream compressed;
+    LzEncoder encoder(compressed);
+    for (char value: input) {
+        encoder.write(static_cast<uint8_t>(value));
+    }
+    CHECK(encoder.finish() == compressed.bytes.size());
+    return compressed.bytes;
+}
+
+static std::string decompress(const std::string &bytes) {
+    MemoryStream compressed;
+    compressed.bytes = bytes;
+    LzDecoder decoder(compressed);
+    CHECK(decoder.valid());
+    std::string output;
+    for (int value; (value = decoder.read()) >= 0;) {
+        output += static_cast<char>(value);
+    }
+    return output;
+}
+
+/**
+ * @brief Checks one round trip, and that every truncation of the compressed bytes decodes to a prefix.
+ */
+static void roundTrip(const char *name, const std::string &input) {
+    std::string compressed = compress(input);
+    std::string output = decompress(compressed);
+    if (output != input) {
+        fprintf(stderr, "%s: %zu bytes in, %zu bytes back\n", name, input.size(), output.size());
+    }
+    CHECK(output == input);
+
+    for (size_t length = 4; length < compressed.size(); length += 1 + compressed.size() / 64) {
+        std::string prefix = decompress(compressed.substr(0, length));
+        CHECK(prefix.size() <= input.size() && input.compare(0, prefix.size(), prefix) == 0);
+    }
+}
+
+int main(int, char **argv) {
+    roundTrip("empty", "");
+    roundTrip("one byte", "x");
+    roundTrip("run", std::string(1000, 'a'));
+    roundTrip("bytes 0-255", [] {
+        std::string all;
+        for (int i = 0; i < 256; i++) {
+            all += static_cast<char>(i);
+        }
+        return all + all + all;
+    }());
+
+    // Repeats just inside and just outside the window, and matches longer than the lookahead
+    for (size_t period: {static_cast<size_t>(LZ_WINDOW_SIZE - 1), static_cast<size_t>(LZ_WINDOW_SIZE),
+                         static_cast<size_t>(LZ_WINDOW_SIZE + 1), static_cast<size_t>(LZ_LOOKAHEAD_SIZE + 3)}) {
+        std::string periodic;
+        uint32_t seed = 7;
+        for (size_t i = 0; i < period; i++) {
+            seed = seed * 1103515245 + 12345;
+            periodic += static_cast<char>(seed >> 24);
+        }
+        while (periodic.size() < 4 * LZ_WINDOW_SIZE) {
+            periodic += periodic.substr(0, period);
+        }
+        roundTrip("periodic", periodic);
+    }
+
+    std::string random;
+    uint32_t seed = 1;
+    for (int i = 0; i < 4096; i++) {
+        seed = seed * 1664525 + 1013904223;
+        random += static_cast<char>(seed >> 24);
+    }
+    roundTrip("random", random);
+
+    std::string snapshot;
+    for (int i = 0; i < 40; i++) {
+        snapshot += "{\"GlobalState\":{\"temperature\":" + std::to_string(20 + i % 7) +
+                    ",\"mode\":\"auto\"},\"CurrentState\":\"Poll\"}";
+    }
+    CHECK(compress(snapshot).size() < snapshot.size() / 4);
+    roundTrip("snapshot", snapshot);
+
+    // Plain snapshots are told apart by their first byte
+    MemoryStream plain;
+    plain.bytes = "{\"GlobalState\":{}}";
+    LzDecoder decoder(plain);
+    CHECK(!decoder.valid());
+    CHECK(decoder.read() < 0);
+
+    printf("%s: %d failed\n", argv[0], failures);
+    return failures;
+}
@@ -0,0 +1,106 @@
+/**
+ * @file migrate.cpp
+ * @brief Host test: the renames of a migration move every value once, or are refused.
+ *
+ * Usage: migrate
+ *
+ * Build it on the host from this file, the library's src/*.cpp and
+ * ArduinoJson, with an Arduino.h that provides String, Print, Stream,
+ * Serial, millis() and micros().
+ */
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include "StepFunction.h"
+#include "HostTest.h"
+
+static const char *snapshot = R"({"Definition":1,"Version":"1","CurrentState":"A","Timers":{"A":{"At":1},"B":{"At":2}},)"
+                              R"("Aggregates":{},"GlobalState":{"x":1,"y":2,"z":3}})";
+
+static void handler(const String &, Variables &) {
+}
+
+/**
+ * @brief Migrates the snapshot above with one migration from version 1.
+ */
+static bool migrate(const char *migration, JsonDocument &migrated) {
+    std::string text = std::string(R"({"Version":"2","StartAt":"A","Migrations":[{"From":"1",)") + migration +
+                       R"(}],"States":{"A":{"Type":"Pass","Next":"B"},"B":{"Type":"Pass","Next":"C"},)"
+                       R"("C":{"Type":"Pass","End":true}}})";
+    StepDefinition definition;
+    CHECK(definition.parse(text.c_str()));
+    migrated.clear();
+    deserializeJson(migrated, snapshot);
+    return definition.migrate(migrated);
+}
+
+static bool isState(JsonVariantConst name, const char *expected) {
+    return name.is<const char *>() && strcmp(name.as<const char *>(), expected) == 0;
+}
+
+int main(int, char **argv) {
+    JsonDocument migrated;
+
+    // A swap exchanges the values instead of overwriting one with the other
+    CHECK(migrate(R"("States":{"A":"B","B":"A"},"Variables":{"x":"y","y":"x"})", migrated));
+    CHECK(isState(migrated["CurrentState"], "B"));
+    CHECK(migrated["Timers"]["A"]["At"].as<int>() == 2 && migrated["Timers"]["B"]["At"].as<int>() == 1);
+    CHECK(migrated["GlobalState"]["x"].as<int>() == 2 && migrated["GlobalState"]["y"].as<int>() == 1);
+    CHECK(migrated["GlobalState"]["z"].as<int>() == 3);
+
+    // A chain moves each value one step
+    CHECK(migrate(R"("States":{"A":"B","B":"C"},"Variables":{"x":"y","y":"w"})", migrated));
+    CHECK(isState(migrated["CurrentState"], "B"));
+    CHECK(migrated["Timers"]["B"]["At"].as<int>() == 1 && migrated["Timers"]["C"]["At"].as<int>() == 2);
+    CHECK(migrated["Timers"]["A"].isNull());
+    CHECK(migrated["GlobalState"]["y"].as<int>() == 1 && migrated["GlobalState"]["w"].as<int>() == 2);
+    CHECK(migrated["GlobalState"]["x"].isNull());
+
+    // Renaming a key onto itself, or a key the snapshot lacks, changes nothing
+    CHECK(migrate(R"("Variables":{"x":"x","missing":"q"})", migrated));
+    CHECK(migrated["GlobalState"]["x"].as<int>() == 1 && migrated["GlobalState"]["q"].isNull());
+    CHECK(migrated["GlobalState"].size() == 3);
+
+    // Two values under one name are refused, and the current state keeps its name
+    CHECK(!migrate(R"("Variables":{"x":"q","y":"q"})", migrated));
+    CHECK(!migrate(R"("Variables":{"x":"z"})", migrated));
+    CHECK(!migrate(R"("States":{"A":"B"},"Variables":{"x":"z"})", migrated));
+    CHECK(isState(migrated["CurrentState"], "A"));
+    CHECK(migrate(R"("Variables":{"x":"z","z":"k"})", migrated));
+    CHECK(migrated["GlobalState"]["z"].as<int>() == 1 && migrated["GlobalState"]["k"].as<int>() == 3);
+
+    // A migrated state that does not exist in the new definition is refused
+    CHECK(!migrate(R"("States":{"A":"Gone"})", migrated));
+
+    // End to end: a snapshot of version 1 resumes under version 2, and not under a version without the migration
+    StepDefinition first;
+    CHECK(first.parse(R"({"Version":"1","StartAt":"Heat","States":{"Heat":{"Type":"Pass","Next":"Read"},)"
+                      R"("Read":{"Type":"Pass","End":true}}})"));
+    StepFunction old(handler);
+    old.setup(first);
+    JsonDocument input;
+    input["temp"] = 21;
+    CHECK(old.start(input.as<JsonVariantConst>()));
+    String saved = old.saveState();
+
+    StepDefinition second;
+    CHECK(second.parse(R"({"Version":"2","Migrations":[{"From":"1","States":{"Heat":"Heating"},)"
+                       R"("Variables":{"temp":"celsius"}}],"StartAt":"Heating","States":{)"
+                       R"("Heating":{"Type":"Pass","Next":"Read"},"Read":{"Type":"Pass","End":true}}})"));
+    StepFunction resumed(handler);
+    resumed.setup(second);
+    CHECK(resumed.restoreState(saved));
+    CHECK(resumed.output()["celsius"].as<int>() == 21 && resumed.output()["temp"].isNull());
+    JsonDocument cursor;
+    deserializeJson(cursor, resumed.saveState().c_str());
+    CHECK(isState(cursor["CurrentState"], "Heating"));
+
+    StepDefinition third;
+    CHECK(third.parse(R"({"Version":"3","StartAt":"Heat","States":{"Heat":{"Type":"Pass","End":true}}})"));
+    StepFunction refused(handler);
+    refused.setup(third);
+    CHECK(!refused.restoreState(saved));
+
+    printf("%s: %d failed\n", argv[0], failures);
+    return failures;
+}
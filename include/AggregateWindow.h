@@ -0,0 +1,112 @@
+#ifndef AGGREGATE_WINDOW_H
+#define AGGREGATE_WINDOW_H
+
+#include <ArduinoJson.h>
+
+#define AGGREGATE_MAX_PERCENTILES 4
+
+/**
+ * @brief The compiled configuration of an Aggregate state.
+ *
+ * @code
+ * "Stats": {
+ *   "Type": "Aggregate",
+ *   "Variable": "$.sensors.temp",
+ *   "Window": { "Millis": 60000, "Capacity": 64 },
+ *   "Percentiles": [50, 95],
+ *   "ResultPath": "$.tempStats",
+ *   "Next": "Check"
+ * }
+ * @endcode
+ */
+struct AggregateDefinition {
+    size_t capacity = 0; /**< Ring buffer size: "Window.Count", or "Window.Capacity" for time windows. */
+    unsigned long millis = 0; /**< "Window.Millis" for time windows; 0 for count windows. */
+    uint8_t percentiles[AGGREGATE_MAX_PERCENTILES]; /**< Requested percentiles, 0-100. */
+    size_t percentileCount = 0;
+    char result[32]; /**< Top-level variable receiving the statistics. */
+
+    /**
+     * @brief Reads the Window, Percentiles and ResultPath members.
+     *
+     * @return False if the window is missing or the members are out of range.
+     */
+    bool compile(JsonObjectConst definition);
+};
+
+/**
+ * @class AggregateWindow
+ * @brief A fixed ring buffer of samples and the statistics over it.
+ *
+ * Each execution owns one window per Aggregate state. Adding a sample is
+ * O(1); summarize() recomputes min, max, mean and variance in two passes
+ * over the buffer, using SSE or NEON when the target has them.
+ */
+class AggregateWindow {
+public:
+    /**
+     * @brief Summary statistics of the samples in the window.
+     */
+    struct Statistics {
+        size_t count = 0;
+        float min = 0;
+        float max = 0;
+        float mean = 0;
+        float variance = 0; /**< Population variance. */
+    };
+
+    explicit AggregateWindow(const AggregateDefinition &definition);
+
+    ~AggregateWindow();
+
+    AggregateWindow(const AggregateWindow &) = delete;
+
+    AggregateWindow &operator=(const AggregateWindow &) = delete;
+
+    /**
+     * @brief Appends a sample, overwriting the oldest one when the buffer is full.
+     */
+    void add(float value, unsigned long now);
+
+    /**
+     * @brief Drops samples older than the time window; a no-op for count windows.
+     */
+    void expire(unsigned long now);
+
+    /**
+     * @brief Computes the summary statistics of the current samples.
+     */
+    void summarize(Statistics &statistics) const;
+
+    /**
+     * @brief Returns the nearest-rank percentile of the current samples.
+     *
+     * @param percent The percentile, 0-100.
+     */
+    float percentile(uint8_t percent) const;
+
+    /**
+     * @brief Replaces the samples with those of another window of the same definition.
+     */
+    void copyFrom(const AggregateWindow &other);
+
+    /**
+     * @brief Writes the samples (and their timestamps for time windows) into a JSON object.
+     */
+    void save(JsonObject target) const;
+
+    /**
+     * @brief Reloads samples written by save().
+     */
+    void restore(JsonObjectConst source);
+
+private:
+    const AggregateDefinition &definition;
+    float *values; /**< Ring buffer of samples. */
+    unsigned long *times; /**< Timestamps of the samples, for time windows only. */
+    float *scratch; /**< Working copy for percentile selection. */
+    size_t head = 0; /**< Index of the oldest sample. */
+    size_t count = 0; /**< Number of samples held. */
+};
+
+#endif //AGGREGATE_WINDOW_H
@@ -0,0 +1,71 @@
+#ifndef ASSIGNMENT_H
+#define ASSIGNMENT_H
+
+#include <ArduinoJson.h>
+#include "Expression.h"
+
+/**
+ * @class Assignment
+ * @brief A compiled ASL `Assign` block.
+ *
+ * Each member of the block names a variable. String values written as
+ * `{% expression %}`, and the values of members whose name ends in `.$`,
+ * are compiled into an Expression; any other value is copied verbatim.
+ *
+ * @code
+ * "Assign": {
+ *   "target": "{% $setpoint * 2 %}",
+ *   "reading.$": "$.sensors.temp[0]",
+ *   "mode": "auto"
+ * }
+ * @endcode
+ */
+class Assignment {
+public:
+    Assignment();
+
+    ~Assignment();
+
+    Assignment(const Assignment &) = delete;
+
+    Assignment &operator=(const Assignment &) = delete;
+
+    /**
+     * @brief Compiles an Assign block.
+     *
+     * @param assign The Assign object from the state definition. Literal values
+     * are referenced, not copied, so the definition must outlive the Assignment.
+     * @return True if every expression compiled; otherwise, false.
+     */
+    bool compile(JsonObjectConst assign);
+
+    /**
+     * @brief Evaluates every target against the current variables, then stores the results.
+     *
+     * All expressions observe the values from before the block, as ASL requires.
+     *
+     * Writing an object or array discards the cached slots of a fixed-layout store.
+     *
+     * @param variables The variable store to read from and write to.
+     * @return False if an expression failed to evaluate; its variable is left unchanged.
+     */
+    bool apply(Variables &variables) const;
+
+private:
+    /**
+     * @brief One variable written by the block.
+     */
+    struct Target {
+        const char *name;
+        Expression *expression; /**< nullptr when literal holds the value. */
+        JsonVariantConst literal;
+    };
+
+    Target *targets = nullptr;
+    size_t targetCount = 0;
+    char *names = nullptr; /**< Backing storage for target names. */
+
+    void clear();
+};
+
+#endif //ASSIGNMENT_H
@@ -0,0 +1,203 @@
+#ifndef ASYNC_SNAPSHOT_STORE_H
+#define ASYNC_SNAPSHOT_STORE_H
+
+#include <Arduino.h>
+#include "SnapshotStore.h"
+
+#if defined(ESP32)
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#define ASYNC_SNAPSHOT_THREADS
+#elif !defined(ARDUINO)
+#include <atomic>
+#include <mutex>
+#include <thread>
+#define ASYNC_SNAPSHOT_THREADS
+#endif
+
+/**
+ * @brief Counters of an AsyncSnapshotStore.
+ */
+struct AsyncSnapshotStats {
+    unsigned long captured = 0; /**< Snapshots committed into a buffer. */
+    unsigned long written = 0; /**< Snapshots committed to the target store. */
+    unsigned long failed = 0; /**< Snapshots the target store rejected. */
+    unsigned long superseded = 0; /**< Queued snapshots dropped because a newer one was captured. */
+    unsigned long rejected = 0; /**< Captures that overflowed a buffer, or found every buffer busy. */
+};
+
+/**
+ * @class AsyncSnapshotStore
+ * @brief Decouples taking a snapshot from writing it to slow storage.
+ *
+ * Snapshots are captured into one of a few buffers allocated up front;
+ * serializing into RAM costs no I/O, so the loop is not held up by an SD card
+ * or a flash erase. The captured bytes are then copied to the target store
+ * a slice at a time, by poll() from the loop (or Scheduler::tick()), or by a
+ * background FreeRTOS task or host thread started with startBackground().
+ *
+ * Only the newest snapshot matters for recovery, so a capture made while
+ * older ones are still queued drops them. When every buffer is in use (one
+ * being written, the rest just captured), the capture reuses the oldest
+ * queued buffer; if the only buffer is being written, the capture is
+ * rejected and commit() returns false, which is the back-pressure signal.
+ *
+ * @code
+ * CheckpointStore flashStore(flash, 0, 8);
+ * AsyncSnapshotStore store(flashStore, 2048);
+ * stepFunction.setCheckpointing(store, policy);
+ * scheduler.setSnapshotWriter(&store);      // or store.startBackground()
+ * @endcode
+ */
+class AsyncSnapshotStore : public SnapshotStore {
+public:
+    /**
+     * @brief Called when a snapshot has been written to the target store, or failed to be.
+     *
+     * With startBackground() it runs on the background task.
+     */
+    typedef void (*CompletionCallback)(bool committed, void *context);
+
+    /**
+     * @param target The slow store; it must outlive this one.
+     * @param capacity The largest snapshot, in bytes.
+     * @param buffers Number of capture buffers; two let one capture proceed while another is written.
+     */
+    AsyncSnapshotStore(SnapshotStore &target, size_t capacity, size_t buffers = 2);
+
+    ~AsyncSnapshotStore() override;
+
+    AsyncSnapshotStore(const AsyncSnapshotStore &) = delete;
+
+    AsyncSnapshotStore &operator=(const AsyncSnapshotStore &) = delete;
+
+    /**
+     * @brief Starts capturing a snapshot into a free buffer.
+     */
+    Print &open() override;
+
+    /**
+     * @brief Queues the captured snapshot for writing; the target store commits it later.
+     *
+     * @return False if the capture was rejected or overflowed its buffer.
+     */
+    bool commit() override;
+
+    void abort() override;
+
+    /**
+     * @brief Copies up to budget bytes of the oldest queued snapshot to the target store.
+     *
+     * @return True if more work remains.
+     */
+    bool poll(size_t budget = 256);
+
+    /**
+     * @brief Writes every queued snapshot now, e.g. before deep sleep.
+     */
+    void drain();
+
+    /**
+     * @brief Returns the number of snapshots captured but not yet written.
+     */
+    size_t pending() const;
+
+    /**
+     * @brief Sets the function told about each write to the target store.
+     */
+    void onComplete(CompletionCallback callback, void *context = nullptr);
+
+    /**
+     * @brief Returns the capture and write counters.
+     */
+    const AsyncSnapshotStats &stats() const;
+
+    /**
+     * @brief Writes queued snapshots on a background FreeRTOS task (ESP32) or thread (host).
+     *
+     * Afterwards, do not call poll() or drain() from the loop.
+     *
+     * @param budget Bytes written per slice, between which the task yields.
+     * @return False where no background execution is available, or if it is already running.
+     */
+    bool startBackground(size_t budget = 512);
+
+    /**
+     * @brief Stops the background writer after its current slice.
+     */
+    void stopBackground();
+
+private:
+    enum BufferState : uint8_t {
+        BUFFER_FREE,
+        BUFFER_CAPTURING, /**< Owned by the capturing loop. */
+        BUFFER_QUEUED, /**< Captured, waiting for the writer. */
+        BUFFER_WRITING /**< Owned by the writer. */
+    };
+
+    /**
+     * @brief One capture buffer.
+     */
+    struct Buffer {
+        uint8_t *data;
+        size_t length; /**< Bytes captured. */
+        size_t offset; /**< Bytes already copied to the target. */
+        uint32_t order; /**< Capture order, to write the oldest first. */
+        BufferState state;
+    };
+
+    /**
+     * @brief The Print handed out by open().
+     */
+    class Capture : public Print {
+    public:
+        explicit Capture(AsyncSnapshotStore &store);
+
+        size_t write(uint8_t value) override;
+
+        size_t write(const uint8_t *data, size_t length) override;
+
+        using Print::write;
+
+    private:
+        AsyncSnapshotStore &store;
+    };
+
+    SnapshotStore &target;
+    size_t capacity;
+    size_t bufferCount;
+    uint8_t *storage; /**< bufferCount buffers of capacity bytes. */
+    Buffer *buffers;
+    Capture capture{*this};
+    Buffer *capturing = nullptr; /**< Buffer open() handed out, or nullptr if the capture was rejected. */
+    bool overflowed = false;
+    Print *output = nullptr; /**< Target Print of the buffer being written. */
+    uint32_t nextOrder = 0;
+    AsyncSnapshotStats counters;
+    CompletionCallback completion = nullptr;
+    void *completionContext = nullptr;
+    size_t backgroundBudget = 0;
+
+#if defined(ESP32)
+    mutable portMUX_TYPE lock = portMUX_INITIALIZER_UNLOCKED;
+    TaskHandle_t volatile worker = nullptr;
+    volatile bool running = false;
+
+    static void backgroundTask(void *store);
+#elif !defined(ARDUINO)
+    mutable std::mutex lock;
+    std::thread worker;
+    std::atomic<bool> running{false};
+#endif
+
+    /**
+     * @brief Guards buffer states, which the loop and the background writer both change.
+     */
+    void enter() const;
+
+    void leave() const;
+
+    void backgroundLoop();
+};
+
+#endif //ASYNC_SNAPSHOT_STORE_H
@@ -0,0 +1,129 @@
+#ifndef BLOB_POOL_H
+#define BLOB_POOL_H
+
+#include <Arduino.h>
+
+/**
+ * @brief A view of binary data held by a variable.
+ */
+struct Blob {
+    const uint8_t *data = nullptr; /**< First byte of the data. */
+    size_t length = 0; /**< Number of bytes. */
+    bool owned = false; /**< True if the bytes live in a BlobPool block; false if they are borrowed. */
+};
+
+/**
+ * @class BlobPool
+ * @brief Fixed storage for binary variables such as sensor frames and audio snippets.
+ *
+ * The pool is one allocation of blockCount blocks of blockSize bytes, made
+ * up front, so producing a blob never touches the heap. A blob is named by a
+ * handle; variables hold the handle, not the bytes, so passing a blob between
+ * Task handlers, states and forked executions copies nothing. Blobs are
+ * reference counted and their block returns to the pool when the last
+ * variable holding them is overwritten or cleared.
+ *
+ * A borrowed blob (see wrap()) describes bytes owned by the caller; it takes
+ * a descriptor but no block.
+ */
+class BlobPool {
+public:
+    /**
+     * @brief Allocates the pool.
+     *
+     * @param blockSize The largest blob the pool can own, in bytes.
+     * @param blockCount The number of blobs that can exist at once; at most 65535.
+     */
+    BlobPool(size_t blockSize, size_t blockCount);
+
+    ~BlobPool();
+
+    BlobPool(const BlobPool &) = delete;
+
+    BlobPool &operator=(const BlobPool &) = delete;
+
+    /**
+     * @brief Reserves a block for the caller to fill.
+     *
+     * @param length The size of the blob, at most blockSize().
+     * @param data Receives the writable bytes of the block.
+     * @return The handle, holding one reference for the caller; 0 if the pool is exhausted or length is too large.
+     */
+    uint32_t allocate(size_t length, uint8_t *&data);
+
+    /**
+     * @brief Copies bytes into a new owned blob.
+     *
+     * @return The handle, holding one reference for the caller; 0 on failure.
+     */
+    uint32_t copy(const uint8_t *data, size_t length);
+
+    /**
+     * @brief Describes caller-owned bytes as a borrowed blob, without copying them.
+     *
+     * The bytes must stay valid and unchanged for as long as any variable holds the handle.
+     *
+     * @return The handle, holding one reference for the caller; 0 if no descriptor is free.
+     */
+    uint32_t wrap(const uint8_t *data, size_t length);
+
+    /**
+     * @brief Looks up a blob.
+     *
+     * @return False if handle does not name a live blob.
+     */
+    bool get(uint32_t handle, Blob &blob) const;
+
+    /**
+     * @brief Adds a reference to a live blob.
+     *
+     * @return False if handle is stale, or the blob already holds 65535
+     * references; the caller must then not keep the handle.
+     */
+    bool retain(uint32_t handle);
+
+    /**
+     * @brief Drops a reference, freeing the blob with the last one; stale handles are ignored.
+     */
+    void release(uint32_t handle);
+
+    /**
+     * @brief Returns the number of blobs that can still be created.
+     */
+    size_t available() const;
+
+    /**
+     * @brief Returns the largest blob the pool can own.
+     */
+    size_t blockSize() const;
+
+private:
+    /**
+     * @brief One descriptor, and the block it owns when the blob is not borrowed.
+     */
+    struct Slot {
+        Blob blob;
+        uint16_t references; /**< 0 when the slot is free. */
+        uint16_t generation; /**< Bumped on every reuse, so old handles go stale. */
+    };
+
+    uint8_t *storage; /**< blockCount blocks of size bytes. */
+    Slot *slots;
+    size_t size; /**< Bytes per block. */
+    size_t count; /**< Number of slots and blocks. */
+    size_t used = 0; /**< Number of live blobs. */
+
+    /**
+     * @brief Claims a free slot and returns its index, or count if there is none.
+     */
+    size_t claim();
+
+    /**
+     * @brief Returns the slot named by handle, or nullptr if it is stale.
+     */
+    Slot *find(uint32_t handle) const;
+
+    uint32_t handleOf(size_t index) const;
+};
+
+#endif //BLOB_POOL_H
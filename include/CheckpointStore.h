@@ -0,0 +1,228 @@
+#ifndef CHECKPOINT_STORE_H
+#define CHECKPOINT_STORE_H
+
+#include <Arduino.h>
+#include "FlashDevice.h"
+#include "SnapshotStore.h"
+
+#ifndef CHECKPOINT_WRITE_BUFFER
+#define CHECKPOINT_WRITE_BUFFER 32 /**< Bytes gathered before each flash program operation. */
+#endif
+
+/**
+ * @class CheckpointStore
+ * @brief Wear-leveled, power-safe storage for execution snapshots on raw flash.
+ *
+ * The sectors given to the store are split into slots of sectorsPerSlot
+ * sectors. Each checkpoint goes to the slot after the newest one, so erases
+ * rotate evenly over every slot instead of wearing out one location.
+ *
+ * A slot starts with a header holding a sequence number, the payload
+ * length, the slot's erase count and a CRC-32 over all of them and the
+ * payload. The payload is programmed first and the header last, so a
+ * checkpoint cut short by a power loss has no valid header and the previous
+ * one is still found: commits are atomic A/B swaps, with every other slot
+ * as the B side.
+ *
+ * begin() reads one header per slot and verifies only the payload of the
+ * newest candidate, so finding the checkpoint at boot is O(slots).
+ *
+ * @code
+ * CheckpointStore store(flash, 0, 8);     // 8 sectors, one checkpoint each
+ * if (store.begin()) {
+ *     stepFunction.restoreState(store.reader());
+ * }
+ * ...
+ * LzEncoder encoder(store.open());
+ * stepFunction.saveStateBinary(encoder);
+ * encoder.finish();
+ * store.commit();
+ * @endcode
+ */
+class CheckpointStore : public SnapshotStore {
+public:
+    /**
+     * @brief A Print writing the payload of the checkpoint being built.
+     */
+    class Writer : public Print {
+    public:
+        explicit Writer(CheckpointStore &store);
+
+        size_t write(uint8_t value) override;
+
+        using Print::write;
+
+    private:
+        CheckpointStore &store;
+    };
+
+    /**
+     * @brief A Stream reading the payload of the newest checkpoint.
+     */
+    class Reader : public Stream {
+    public:
+        explicit Reader(CheckpointStore &store);
+
+        int available() override;
+
+        int read() override;
+
+        int peek() override;
+
+        size_t write(uint8_t value) override;
+
+        using Print::write;
+
+    private:
+        friend class CheckpointStore;
+
+        CheckpointStore &store;
+        size_t position = 0;
+    };
+
+    /**
+     * @brief Uses a range of sectors of a device.
+     *
+     * @param device The flash; it must outlive the store.
+     * @param firstSector The first sector of the range.
+     * @param sectorCount The number of sectors, enough for at least two slots; 0 uses every sector from firstSector on.
+     * @param sectorsPerSlot Sectors per checkpoint; the largest payload is this many sectors minus the header.
+     */
+    CheckpointStore(FlashDevice &device, size_t firstSector = 0, size_t sectorCount = 0, size_t sectorsPerSlot = 1);
+
+    ~CheckpointStore() override;
+
+    CheckpointStore(const CheckpointStore &) = delete;
+
+    CheckpointStore &operator=(const CheckpointStore &) = delete;
+
+    /**
+     * @brief Scans the slots for the newest valid checkpoint; call once at boot.
+     *
+     * @return True if a checkpoint was found.
+     */
+    bool begin();
+
+    /**
+     * @brief Starts a new checkpoint in the next slot, erasing it.
+     *
+     * The newest committed checkpoint stays intact and readable until commit().
+     *
+     * @return The Print receiving the payload; its writes fail if the store has fewer than two slots.
+     */
+    Print &open() override;
+
+    /**
+     * @brief Makes the checkpoint written since open() the newest one.
+     *
+     * @return False if nothing is open, the payload overflowed the slot, or the flash failed.
+     */
+    bool commit() override;
+
+    /**
+     * @brief Abandons the checkpoint written since open().
+     */
+    void abort() override;
+
+    /**
+     * @brief Returns a Stream over the newest checkpoint, rewound to its start.
+     */
+    Stream &reader();
+
+    /**
+     * @brief Returns true if a committed checkpoint exists.
+     */
+    bool hasCheckpoint() const;
+
+    /**
+     * @brief Returns the sequence number of the newest checkpoint.
+     */
+    uint32_t sequence() const;
+
+    /**
+     * @brief Returns the payload length of the newest checkpoint.
+     */
+    size_t size() const;
+
+    /**
+     * @brief Returns the largest payload a slot can hold.
+     */
+    size_t capacity() const;
+
+    /**
+     * @brief Returns the number of slots checkpoints rotate over.
+     */
+    size_t slots() const;
+
+    /**
+     * @brief Returns how many times the sectors of a slot have been erased, as recorded in its header.
+     */
+    uint32_t eraseCount(size_t slot) const;
+
+    /**
+     * @brief Returns the number of erases of the most worn slot.
+     */
+    uint32_t maxEraseCount() const;
+
+    /**
+     * @brief Estimates how many more checkpoints the flash can take.
+     *
+     * Assumes the erases keep rotating evenly, so every slot can reach the
+     * rated endurance. Erases of slots whose header was lost to a power cut
+     * are not counted, so treat the figure as an upper bound.
+     *
+     * @param ratedCycles Erase cycles the flash is specified for.
+     */
+    unsigned long remainingCommits(uint32_t ratedCycles = 100000) const;
+
+private:
+    /**
+     * @brief On-flash slot header; written after the payload.
+     */
+    struct Header {
+        uint32_t magic;
+        uint32_t sequence;
+        uint32_t length; /**< Payload bytes following the header. */
+        uint32_t erases; /**< Erase count of the slot, including the erase before this checkpoint. */
+        uint32_t crc; /**< CRC-32 of sequence, length, erases and the payload. */
+    };
+
+    FlashDevice &device;
+    size_t first; /**< First sector used. */
+    size_t slotCount;
+    size_t sectorsPerSlot;
+    uint32_t *erases; /**< Erase count of each slot. */
+    Writer writer{*this};
+    Reader checkpointReader{*this};
+
+    bool found = false; /**< Whether newest names a committed checkpoint. */
+    size_t newest = 0; /**< Slot of the newest checkpoint. */
+    uint32_t newestSequence = 0;
+    size_t newestLength = 0;
+
+    bool writing = false; /**< Whether a checkpoint is open. */
+    bool failed = false; /**< Whether the open checkpoint overflowed or hit a flash error. */
+    size_t target = 0; /**< Slot being written. */
+    size_t written = 0; /**< Payload bytes accepted so far. */
+    uint32_t crc = 0; /**< Running CRC of the open checkpoint. */
+    uint8_t buffer[CHECKPOINT_WRITE_BUFFER]; /**< Payload bytes not yet programmed. */
+    size_t buffered = 0;
+
+    /**
+     * @brief Reads or writes bytes at an offset of a slot, crossing sector boundaries.
+     */
+    bool access(size_t slot, size_t offset, uint8_t *data, size_t length, bool write);
+
+    bool readHeader(size_t slot, Header &header);
+
+    /**
+     * @brief Returns true if the payload of a slot matches its header's CRC.
+     */
+    bool verify(size_t slot, const Header &header);
+
+    void append(uint8_t value);
+
+    bool flushBuffer();
+};
+
+#endif //CHECKPOINT_STORE_H
@@ -0,0 +1,82 @@
+#ifndef COMPILED_STATE_H
+#define COMPILED_STATE_H
+
+#include <ArduinoJson.h>
+#include "Assignment.h"
+#include "Expression.h"
+#include "DecisionTable.h"
+#include "GlobMatcher.h"
+#include "AggregateWindow.h"
+
+/**
+ * @brief State types recognised by the StepFunction, resolved once at setup.
+ */
+enum StateType : uint8_t {
+    STATE_UNKNOWN, /**< A "Type" the engine does not handle. */
+    STATE_TASK, /**< Runs the user-defined callback. */
+    STATE_CHOICE, /**< Branches on variables. */
+    STATE_WAIT, /**< Delays the execution. */
+    STATE_PASS, /**< Applies its Assign block and moves on. */
+    STATE_DECISION_TABLE, /**< Selects the first matching row of a rule table. */
+    STATE_AGGREGATE, /**< Adds a sample to a sliding window and publishes its statistics. */
+    STATE_DEBOUNCE, /**< Proceeds once its Variable has been stable for a period. */
+    STATE_THROTTLE /**< Proceeds at most once per period. */
+};
+
+/**
+ * @brief The compiled form of one rule in a Choice state's "Choices" or a DecisionTable state's "Rules".
+ */
+struct CompiledChoice {
+    Expression *condition = nullptr; /**< Compiled "Condition", or nullptr for StringEquals rules. */
+    Assignment *assign = nullptr; /**< Compiled rule-level "Assign", or nullptr. */
+    int pattern = -1; /**< Index of the rule's "StringMatches" pattern, or -1. */
+    VariablePath *variable = nullptr; /**< Rule-level "Variable", or nullptr to use the state's. */
+    GlobMatcher *matcher = nullptr; /**< Own automaton for a StringMatches rule with its own Variable. */
+};
+
+/**
+ * @class CompiledState
+ * @brief A state definition with everything that can be prepared ahead of run() already prepared.
+ *
+ * The name and definition reference the parsed configuration document, which
+ * must outlive the CompiledState.
+ */
+class CompiledState {
+public:
+    const char *name = nullptr; /**< The state's key in "States". */
+    JsonObject definition; /**< The state's JSON definition. */
+    StateType type = STATE_UNKNOWN; /**< The resolved "Type". */
+    Assignment *assign = nullptr; /**< Compiled state-level "Assign", or nullptr. */
+    CompiledChoice *choices = nullptr; /**< One entry per rule for Choice and DecisionTable states. */
+    size_t choiceCount = 0; /**< Number of entries in choices. */
+    DecisionTable *table = nullptr; /**< Compiled rule index for DecisionTable states. */
+    GlobMatcher *matcher = nullptr; /**< StringMatches patterns tested against the state's Variable, or nullptr. */
+    VariablePath *variable = nullptr; /**< Compiled state-level "Variable" of a Choice, Aggregate or Debounce state, or nullptr. */
+    AggregateDefinition *aggregate = nullptr; /**< Window configuration of an Aggregate state. */
+    unsigned long period = 0; /**< "Millis" of a Debounce or Throttle state. */
+    bool sideEffects = false; /**< "SideEffects" of a Task state: its work must not be repeated after a restore. */
+
+    CompiledState();
+
+    ~CompiledState();
+
+    CompiledState(const CompiledState &) = delete;
+
+    CompiledState &operator=(const CompiledState &) = delete;
+
+    /**
+     * @brief Resolves the state type and compiles its Assign blocks, Choice conditions, StringMatches patterns, decision table and aggregate window.
+     *
+     * @param stateName The state's key in "States".
+     * @param stateDefinition The state's JSON definition.
+     * @return True on success; false if an expression does not compile.
+     */
+    bool compile(const char *stateName, JsonObject stateDefinition);
+
+    /**
+     * @brief Frees everything compile() prepared and returns the state to its uncompiled form.
+     */
+    void clear();
+};
+
+#endif //COMPILED_STATE_H
@@ -0,0 +1,53 @@
+#ifndef CRON_EXPRESSION_H
+#define CRON_EXPRESSION_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+ * @class CronExpression
+ * @brief A five-field cron schedule ("minute hour day-of-month month day-of-week") compiled into bitsets.
+ *
+ * Each field accepts `*`, numbers, ranges `a-b`, a step after any of
+ * them (`a-b/n`, a star followed by `/n`, or `a/n`, which as in cronie runs
+ * from a to the end of the field), and comma-separated lists of these. Day
+ * of week runs from 0 (Sunday) to 7 (Sunday again). As in Vixie cron, when
+ * both day fields are restricted a day matches if either of them does; when
+ * a day field starts with a star, stepped or not, a day must match both.
+ * Times are UTC.
+ *
+ * @code
+ * "0 * * * *"       every hour on the hour
+ * "0-59/15 8-18 * * 1-5"  every 15 minutes during office hours on weekdays
+ * @endcode
+ */
+class CronExpression {
+public:
+    /**
+     * @brief Parses the five fields.
+     *
+     * @return True if the expression is well formed; otherwise, false.
+     */
+    bool compile(const char *expression);
+
+    /**
+     * @brief Returns the first matching minute strictly after a time.
+     *
+     * @param after Seconds since 1970-01-01 UTC.
+     * @return The next fire time in seconds since the epoch, or 0 if none falls within the next five years.
+     */
+    uint32_t next(uint32_t after) const;
+
+private:
+    uint64_t minutes = 0; /**< Bit n set when minute n matches. */
+    uint32_t hours = 0;
+    uint32_t days = 0; /**< Bit n set when day-of-month n (1-31) matches. */
+    uint16_t months = 0; /**< Bit n set when month n (1-12) matches. */
+    uint8_t weekdays = 0; /**< Bit n set when weekday n (0 = Sunday) matches. */
+    bool anyDay = true; /**< Day-of-month field started with `*`. */
+    bool anyWeekday = true; /**< Day-of-week field started with `*`. */
+
+    bool matchesDay(uint32_t day, uint32_t weekday) const;
+};
+
+#endif //CRON_EXPRESSION_H
@@ -0,0 +1,71 @@
+#ifndef DECISION_TABLE_H
+#define DECISION_TABLE_H
+
+#include <ArduinoJson.h>
+#include "VariablePath.h"
+#include "Variables.h"
+
+/**
+ * @class DecisionTable
+ * @brief The rows of a DecisionTable state compiled into per-input bitset indexes.
+ *
+ * For every input, setup() partitions the value space into the pieces that
+ * the rules can tell apart (distinct strings, booleans, and numeric segments
+ * between the rule boundaries) and stores, for each piece, the bitset of rules
+ * that accept it. Evaluation looks up one bitset per input and intersects
+ * them; the lowest surviving bit is the first matching rule. The cost depends
+ * on the number of inputs and words of bitset, not on the number of rules
+ * that have to be tested.
+ */
+class DecisionTable {
+public:
+    DecisionTable();
+
+    ~DecisionTable();
+
+    DecisionTable(const DecisionTable &) = delete;
+
+    DecisionTable &operator=(const DecisionTable &) = delete;
+
+    /**
+     * @brief Compiles the "Inputs" and "Rules" of a DecisionTable state.
+     *
+     * @param definition The state definition. Next names are referenced, not
+     * copied, so the definition must outlive the DecisionTable.
+     * @return True on success; false if an input path or a cell is malformed.
+     */
+    bool compile(JsonObjectConst definition);
+
+    /**
+     * @brief Finds the first rule that accepts the current variable values.
+     *
+     * @param variables The variable store the inputs are read from.
+     * @return The index of the matching rule, or -1 if none matches.
+     */
+    int evaluate(const Variables &variables) const;
+
+    /**
+     * @brief Returns the "Next" state of a rule.
+     */
+    const char *next(int rule) const;
+
+    /**
+     * @brief Returns the number of rules in the table.
+     */
+    size_t size() const;
+
+private:
+    struct Column;
+
+    Column *columns = nullptr; /**< One index per input. */
+    size_t columnCount = 0;
+    const char **nextStates = nullptr; /**< "Next" of each rule. */
+    size_t ruleCount = 0;
+    size_t words = 0; /**< 32-bit words per rule bitset. */
+
+    mutable uint32_t *candidates = nullptr; /**< Rule bitset of the running evaluate(), allocated once by compile(). */
+
+    void clear();
+};
+
+#endif //DECISION_TABLE_H
@@ -0,0 +1,89 @@
+#ifndef DEFINITION_ANALYSIS_H
+#define DEFINITION_ANALYSIS_H
+
+#include "StepDefinition.h"
+
+/**
+ * @class DefinitionAnalysis
+ * @brief Upper bounds on the run() calls and time between two Wait states of a definition.
+ *
+ * A Wait state is where an execution yields for a known time, so the work
+ * between two of them is what a control loop has to budget for. The
+ * analysis walks the transition graph of the definition: every Next,
+ * Default, Choices and Rules target. Each segment starts at the start of an
+ * execution or after a Wait state, and ends at a Wait state or the end of
+ * the execution. For each one it reports the most run() calls and the most
+ * time any path can take.
+ *
+ * Times come from profiles written by StepFunction::writeProfile(). A state
+ * is charged the longest run() measured for it. A state that never ran is
+ * charged the longest handler call measured for its Resource, plus the
+ * largest engine overhead measured on any state. Without a profile every
+ * bound is 0 µs and only the run() counts are meaningful.
+ *
+ * Debounce and Throttle states are counted as passing straight through,
+ * which keeps the bounds safe. A cycle that contains no Wait state has no
+ * bound: it is reported, together with every segment that can reach it.
+ *
+ * @code
+ * DefinitionAnalysis analysis(definition);
+ * analysis.addProfile(profile.as<JsonObjectConst>());   // from StepFunction::writeProfile()
+ * JsonDocument result;
+ * if (!analysis.analyze(result)) {
+ *     serializeJson(result["Cycles"], Serial);          // loops that never yield
+ * }
+ * serializeJson(result["Worst"], Serial);
+ * @endcode
+ */
+class DefinitionAnalysis {
+public:
+    /**
+     * @param definition The definition to analyse; an indexed one has every state compiled while analyze() runs.
+     */
+    explicit DefinitionAnalysis(StepDefinition &definition);
+
+    ~DefinitionAnalysis();
+
+    DefinitionAnalysis(const DefinitionAnalysis &) = delete;
+
+    DefinitionAnalysis &operator=(const DefinitionAnalysis &) = delete;
+
+    /**
+     * @brief Adds measured latencies, as written by StepFunction::writeProfile().
+     *
+     * Profiles of several executions or devices can be added; the largest figure of each state wins.
+     */
+    void addProfile(JsonObjectConst profile);
+
+    /**
+     * @brief Computes the bounds.
+     *
+     * The result holds:
+     * - `"Segments"`: `[{"From":wait,"To":wait,"Runs":…,"Micros":…}]`. "From" is omitted for
+     *   the start of an execution and "To" for its end. A segment that reaches a cycle has
+     *   `"Unbounded":true` instead of figures.
+     * - `"Worst"`: the segment with the most time, its `"Path"` of states, and `"MaxRuns"`, the most run() calls of any segment.
+     * - `"Cycles"`: the states of each cycle that has no Wait state.
+     * - `"Unmeasured"`: the reachable states no profile measured, once a profile was added.
+     *
+     * @return False if a cycle without a Wait state leaves some segment unbounded.
+     */
+    bool analyze(JsonDocument &result);
+
+private:
+    StepDefinition &definition;
+    size_t count; /**< Number of states. */
+    size_t *buckets; /**< Open-addressing table of state index + 1 by name hash; 0 is empty. */
+    size_t bucketMask;
+    unsigned long *measuredMicros; /**< Longest run() of each state in the added profiles. */
+    unsigned long *handlerMicros; /**< Longest handler call of each state in the added profiles. */
+    bool *measured; /**< Whether a profile covered the state. */
+    bool profiled = false; /**< Whether addProfile() was called. */
+
+    /**
+     * @brief Returns the index of the state with the given name, or count.
+     */
+    size_t lookup(const char *name) const;
+};
+
+#endif //DEFINITION_ANALYSIS_H
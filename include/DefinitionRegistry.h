@@ -0,0 +1,125 @@
+#ifndef DEFINITION_REGISTRY_H
+#define DEFINITION_REGISTRY_H
+
+#include "StepDefinition.h"
+
+/**
+ * @class DefinitionRegistry
+ * @brief The workflows a device runs, by name, and the definition versions snapshots may name.
+ *
+ * add(name, jsonConfig) compiles each workflow once. Every configuration
+ * added this way is copied into one shared document, where ArduinoJson
+ * stores each distinct string once: state names, resources and variable
+ * names repeated across workflows cost RAM only the first time, so memory
+ * grows with unique content rather than with the number of workflows.
+ * find(name) is a hashed lookup.
+ *
+ * After a definition update, snapshots of in-flight executions may still
+ * name the old definition's hash. Keeping the old version registered lets
+ * them finish on it; a newer version whose "Migrations" accept the old one
+ * takes them over instead when the old version is no longer registered.
+ *
+ * @code
+ * DefinitionRegistry registry(16);
+ * registry.add("irrigation", irrigationJson);
+ * registry.add("lighting", lightingJson);
+ * scheduler.setRegistry(registry);
+ * scheduler.spawn("lighting");
+ *
+ * JsonDocument cursor;
+ * if (StepFunction::peekSnapshot(data, length, cursor)) {
+ *     StepDefinition *definition = registry.select(cursor.as<JsonVariantConst>());
+ *     if (definition) {
+ *         scheduler.resume(*definition, data, length);
+ *     }
+ * }
+ * @endcode
+ */
+class DefinitionRegistry {
+public:
+    /**
+     * @param capacity The most definitions the registry holds.
+     */
+    explicit DefinitionRegistry(size_t capacity = 8);
+
+    ~DefinitionRegistry();
+
+    DefinitionRegistry(const DefinitionRegistry &) = delete;
+
+    DefinitionRegistry &operator=(const DefinitionRegistry &) = delete;
+
+    /**
+     * @brief Compiles a configuration into the shared document and registers it under a name.
+     *
+     * Adding a name again registers a new version: find() returns it from
+     * then on, while the earlier version stays available to select().
+     *
+     * @return The compiled definition, owned by the registry; nullptr if the
+     * registry is full, the JSON is invalid or a state does not compile.
+     */
+    StepDefinition *add(const char *name, const char *jsonConfig);
+
+    /**
+     * @brief Registers a definition compiled elsewhere; it must outlive the registry.
+     *
+     * @param name The name to find it by, or nullptr to make it reachable through select() only.
+     * @return False if the registry is full or already holds a definition with the same hash.
+     */
+    bool add(StepDefinition &definition, const char *name = nullptr);
+
+    /**
+     * @brief Returns the newest definition registered under a name, or nullptr.
+     */
+    StepDefinition *find(const char *name) const;
+
+    /**
+     * @brief Returns the definition with the given hash, or nullptr.
+     */
+    StepDefinition *find(uint32_t hash) const;
+
+    /**
+     * @brief Picks the definition to restore a snapshot with.
+     *
+     * The definition the snapshot was saved with if it is registered;
+     * otherwise the most recently added one that accepts the snapshot.
+     *
+     * @param cursor The snapshot, or its cursor from StepFunction::peekSnapshot().
+     * @return The definition, or nullptr if none accepts the snapshot.
+     */
+    StepDefinition *select(JsonVariantConst cursor) const;
+
+    /**
+     * @brief Returns the name a definition was registered under, or nullptr.
+     */
+    const char *nameOf(const StepDefinition *definition) const;
+
+    /**
+     * @brief Returns the number of registered definitions.
+     */
+    size_t size() const;
+
+private:
+    /**
+     * @brief One registered definition.
+     */
+    struct Entry {
+        StepDefinition *definition;
+        const char *name; /**< Interned in configs, or nullptr. */
+        uint32_t nameHash;
+        bool owned; /**< Compiled by add(name, jsonConfig). */
+    };
+
+    JsonDocument configs; /**< Every configuration add(name, jsonConfig) compiled, with its name; strings stored once. */
+    Entry *entries;
+    size_t capacity;
+    size_t count = 0;
+    uint16_t *buckets; /**< Open-addressing table of entry index + 1 by name hash; 0 is empty. */
+    size_t bucketMask; /**< Number of buckets minus one; a power of two at least twice capacity. */
+
+    /**
+     * @brief Makes entry the one find(name) returns for its name.
+     */
+    void index(size_t entry);
+};
+
+#endif //DEFINITION_REGISTRY_H
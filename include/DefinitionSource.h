@@ -0,0 +1,98 @@
+#ifndef DEFINITION_SOURCE_H
+#define DEFINITION_SOURCE_H
+
+#include <Arduino.h>
+#include "FlashDevice.h"
+
+/**
+ * @class DefinitionSource
+ * @brief Configuration text that is read a piece at a time instead of being addressable in RAM.
+ *
+ * StepDefinition::index(DefinitionSource &) keeps only the state names and
+ * their offsets resident and reads a state's text back whenever it compiles
+ * the state, so a definition can be far larger than RAM.
+ */
+class DefinitionSource {
+public:
+    virtual ~DefinitionSource() {}
+
+    /**
+     * @brief Returns the length of the text, in bytes.
+     */
+    virtual size_t size() const = 0;
+
+    /**
+     * @brief Copies length bytes starting at offset.
+     */
+    virtual bool read(size_t offset, uint8_t *data, size_t length) = 0;
+};
+
+/**
+ * @class FlashDefinitionSource
+ * @brief Configuration text stored in consecutive sectors of a FlashDevice.
+ */
+class FlashDefinitionSource : public DefinitionSource {
+public:
+    /**
+     * @param device The flash holding the text; it must outlive the source.
+     * @param firstSector The sector the text starts at.
+     * @param length The length of the text.
+     */
+    FlashDefinitionSource(FlashDevice &device, size_t firstSector, size_t length);
+
+    /**
+     * @brief Erases the sectors a text needs and programs it, starting at firstSector.
+     *
+     * @return False if the text does not fit on the device or a sector fails.
+     */
+    static bool store(FlashDevice &device, size_t firstSector, const char *text, size_t length);
+
+    size_t size() const override;
+
+    bool read(size_t offset, uint8_t *data, size_t length) override;
+
+private:
+    FlashDevice &device;
+    size_t firstSector;
+    size_t length;
+};
+
+#ifndef ARDUINO
+#include <stdio.h>
+
+/**
+ * @class FileDefinitionSource
+ * @brief Configuration text in a host file, for simulating definitions that do not fit in RAM.
+ */
+class FileDefinitionSource : public DefinitionSource {
+public:
+    explicit FileDefinitionSource(const char *path);
+
+    ~FileDefinitionSource() override;
+
+    FileDefinitionSource(const FileDefinitionSource &) = delete;
+
+    FileDefinitionSource &operator=(const FileDefinitionSource &) = delete;
+
+    /**
+     * @brief Returns true if the file could be opened.
+     */
+    bool isOpen() const;
+
+    size_t size() const override;
+
+    bool read(size_t offset, uint8_t *data, size_t length) override;
+
+    /**
+     * @brief Returns the number of read() calls, i.e. how often the text was fetched.
+     */
+    unsigned long reads() const;
+
+private:
+    FILE *file;
+    size_t length = 0;
+    unsigned long readCount = 0;
+};
+#endif
+
+#endif //DEFINITION_SOURCE_H
@@ -0,0 +1,68 @@
+#ifndef EXECUTION_JOURNAL_H
+#define EXECUTION_JOURNAL_H
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+
+/**
+ * @class ExecutionJournal
+ * @brief Records everything an execution's run() decisions depend on, for replay on a host.
+ *
+ * A StepFunction given a journal with setJournal() writes one JSON line per
+ * event to a Print (an SD card file, a UART, a network client):
+ *
+ * - `{"e":"snapshot","t":…,"v":{…}}` where recording began, as saveState() would write it
+ * - `{"e":"start","t":…,"v":…}` the input of start()
+ * - `{"e":"set","t":…,"n":"name","v":…}` a setVariable() from outside
+ * - `{"e":"task","t":…,"r":"resource","v":{…}}` the variables a Task callback left behind
+ * - `{"e":"run","t":…,"r":1,"s":"State"}` each run(): its clock reading, result and the state it moved to
+ *
+ * Those are the execution's only inputs, so JournalReplay can reproduce the
+ * exact sequence of run() results from them, with the recorded clock and
+ * without calling any Task. Blob contents are not journaled.
+ */
+class ExecutionJournal {
+public:
+    /**
+     * @param output Receives the journal; it must outlive the journal.
+     */
+    explicit ExecutionJournal(Print &output);
+
+    /**
+     * @brief Records the state an execution was in when recording began.
+     */
+    void recordSnapshot(unsigned long now, JsonVariantConst snapshot);
+
+    /**
+     * @brief Records the input of a fresh start.
+     */
+    void recordStart(unsigned long now, JsonVariantConst input);
+
+    /**
+     * @brief Records a variable written from outside a Task.
+     */
+    void recordSet(unsigned long now, const char *name, JsonVariantConst value);
+
+    /**
+     * @brief Records the variables after a Task callback.
+     */
+    void recordTask(unsigned long now, const String &resource, JsonVariantConst variables);
+
+    /**
+     * @brief Records the result of a run() and the state it left the execution in.
+     */
+    void recordRun(unsigned long now, int result, const String &state);
+
+    /**
+     * @brief Returns the number of lines written.
+     */
+    unsigned long records() const;
+
+private:
+    Print &output;
+    unsigned long count = 0;
+
+    void write(JsonDocument &record);
+};
+
+#endif //EXECUTION_JOURNAL_H
@@ -0,0 +1,113 @@
+#ifndef EXPRESSION_H
+#define EXPRESSION_H
+
+#include <ArduinoJson.h>
+#include "VariablePath.h"
+#include "Variables.h"
+
+#define EXPRESSION_STACK_SIZE 16
+
+/**
+ * @brief The value produced by evaluating an Expression.
+ *
+ * Strings point either into the compiled expression or into the variable
+ * store, so a value must be consumed before either of them changes.
+ */
+struct ExpressionValue {
+    enum Type : uint8_t {
+        NUL, /**< null, or the result of a failed evaluation. */
+        BOOLEAN, /**< A boolean held in boolean. */
+        NUMBER, /**< A number held in number. */
+        STRING, /**< A NUL-terminated string held in string. */
+        REFERENCE /**< An object or array held in reference. */
+    };
+
+    Type type = NUL;
+    bool boolean = false;
+    double number = 0;
+    const char *string = nullptr;
+    JsonVariantConst reference;
+
+    /**
+     * @brief Converts the value to a boolean: false, 0, "", null and empty collections are false.
+     */
+    bool truthy() const;
+};
+
+/**
+ * @class Expression
+ * @brief An arithmetic/comparison expression compiled once into postfix bytecode.
+ *
+ * The language covers number, string, boolean and null literals, variable
+ * references (`$x`, `$.sensors.temp[2].value`), `+ - * / %`, comparisons
+ * (`= == != < <= > >=`), `and`/`&&`, `or`/`||`, `not`/`!` and parentheses.
+ * Variable references are compiled into VariablePath segment arrays, so
+ * evaluation never re-reads the source text.
+ */
+class Expression {
+public:
+    Expression();
+
+    ~Expression();
+
+    Expression(const Expression &) = delete;
+
+    Expression &operator=(const Expression &) = delete;
+
+    /**
+     * @brief Compiles the expression source into bytecode.
+     *
+     * @param source The expression text.
+     * @param length The number of characters of source to read.
+     * @return True if the expression is well formed; otherwise, false.
+     */
+    bool compile(const char *source, size_t length);
+
+    /**
+     * @brief Compiles a NUL-terminated expression.
+     */
+    bool compile(const char *source);
+
+    /**
+     * @brief Evaluates the compiled bytecode against the variable store.
+     *
+     * @param variables The variable store that `$` references resolve against.
+     * @param result Receives the value of the expression.
+     * @return False on a type error (e.g. arithmetic on a string); result is then null.
+     */
+    bool evaluate(const Variables &variables, ExpressionValue &result) const;
+
+    /**
+     * @brief Locates the body of a `{% ... %}` template string.
+     *
+     * @param text The candidate string.
+     * @param body Receives the start of the body.
+     * @param length Receives the length of the body.
+     * @return True if text is a template; otherwise, false.
+     */
+    static bool unwrap(const char *text, const char *&body, size_t &length);
+
+private:
+    friend struct ExpressionParser;
+
+    /**
+     * @brief One bytecode instruction; operand indexes the matching constant table.
+     */
+    struct Instruction {
+        uint8_t op;
+        uint8_t operand;
+    };
+
+    Instruction *code = nullptr; /**< Postfix instruction stream. */
+    size_t codeLength = 0; /**< Number of instructions in code. */
+    double *numbers = nullptr; /**< Number literals. */
+    size_t numberCount = 0;
+    char **strings = nullptr; /**< String literals. */
+    size_t stringCount = 0;
+    VariablePath **paths = nullptr; /**< Compiled variable references. */
+    size_t pathCount = 0;
+
+    void clear();
+};
+
+#endif //EXPRESSION_H
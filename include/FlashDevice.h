@@ -0,0 +1,104 @@
+#ifndef FLASH_DEVICE_H
+#define FLASH_DEVICE_H
+
+#include <Arduino.h>
+
+/**
+ * @class FlashDevice
+ * @brief Sector-erasable storage that a CheckpointStore writes to.
+ *
+ * Implementations follow NOR flash rules: erase() sets every byte of a
+ * sector to 0xFF, and write() can only clear bits of erased bytes.
+ * Adapters for a platform (an ESP32 partition, an SPI flash chip) implement
+ * the five methods; FileFlashDevice emulates one in a file on the host.
+ */
+class FlashDevice {
+public:
+    virtual ~FlashDevice() {}
+
+    /**
+     * @brief Returns the erase unit, in bytes.
+     */
+    virtual size_t sectorSize() const = 0;
+
+    /**
+     * @brief Returns the number of sectors.
+     */
+    virtual size_t sectorCount() const = 0;
+
+    /**
+     * @brief Sets every byte of a sector to 0xFF.
+     */
+    virtual bool erase(size_t sector) = 0;
+
+    /**
+     * @brief Programs bytes within one sector.
+     */
+    virtual bool write(size_t sector, size_t offset, const uint8_t *data, size_t length) = 0;
+
+    /**
+     * @brief Reads bytes within one sector.
+     */
+    virtual bool read(size_t sector, size_t offset, uint8_t *data, size_t length) = 0;
+};
+
+#ifndef ARDUINO
+#include <stdio.h>
+
+/**
+ * @class FileFlashDevice
+ * @brief A FlashDevice emulated in a host file, for tests and simulations.
+ *
+ * Writes AND into the existing bytes like real NOR flash, erases are
+ * counted per sector, and cutPowerAfter() drops every write past a byte
+ * budget to simulate a power loss in the middle of a checkpoint.
+ */
+class FileFlashDevice : public FlashDevice {
+public:
+    /**
+     * @brief Opens (or creates, erased) the backing file.
+     *
+     * @param path The file; an existing one is reused so checkpoints survive a simulated reboot.
+     * @param sectorSize The erase unit, in bytes.
+     * @param sectorCount The number of sectors.
+     */
+    FileFlashDevice(const char *path, size_t sectorSize, size_t sectorCount);
+
+    ~FileFlashDevice() override;
+
+    FileFlashDevice(const FileFlashDevice &) = delete;
+
+    FileFlashDevice &operator=(const FileFlashDevice &) = delete;
+
+    size_t sectorSize() const override;
+
+    size_t sectorCount() const override;
+
+    bool erase(size_t sector) override;
+
+    bool write(size_t sector, size_t offset, const uint8_t *data, size_t length) override;
+
+    bool read(size_t sector, size_t offset, uint8_t *data, size_t length) override;
+
+    /**
+     * @brief Returns how many times a sector was erased since the device was opened.
+     */
+    unsigned long eraseCount(size_t sector) const;
+
+    /**
+     * @brief Lets only the next bytes bytes be written; later writes and erases fail.
+     */
+    void cutPowerAfter(size_t bytes);
+
+private:
+    FILE *file;
+    size_t size; /**< Bytes per sector. */
+    size_t count; /**< Number of sectors. */
+    unsigned long *erases; /**< Erase counter of each sector. */
+    size_t budget; /**< Bytes that may still be written; SIZE_MAX when power never fails. */
+
+    bool inRange(size_t sector, size_t offset, size_t length) const;
+};
+#endif
+
+#endif //FLASH_DEVICE_H
@@ -0,0 +1,75 @@
+#ifndef GLOB_MATCHER_H
+#define GLOB_MATCHER_H
+
+#include <Arduino.h>
+
+/**
+ * @class GlobMatcher
+ * @brief A set of ASL `StringMatches` patterns compiled into one bit-parallel automaton.
+ *
+ * `*` matches any run of characters, `\*` a literal star and `\\` a literal
+ * backslash. Every pattern position becomes one bit of a shared state vector;
+ * each input character advances all patterns at once with a table lookup, a
+ * mask and a shift, so testing a string against many patterns is a single
+ * linear pass over the string. Bytes that appear in no pattern share one
+ * alphabet class, which keeps the transition table small.
+ */
+class GlobMatcher {
+public:
+    GlobMatcher();
+
+    ~GlobMatcher();
+
+    GlobMatcher(const GlobMatcher &) = delete;
+
+    GlobMatcher &operator=(const GlobMatcher &) = delete;
+
+    /**
+     * @brief Queues a pattern for compile().
+     *
+     * @param pattern The pattern text; it must stay valid until compile() returns.
+     * @return The pattern's index for matched(), or SIZE_MAX if memory ran out; the pattern is then not queued.
+     */
+    size_t add(const char *pattern);
+
+    /**
+     * @brief Builds the automaton from every added pattern.
+     *
+     * @return True on success; false if memory ran out.
+     */
+    bool compile();
+
+    /**
+     * @brief Runs the automaton over text once.
+     *
+     * The outcome for every pattern is available through matched() until the next call.
+     *
+     * @param text The string to test.
+     */
+    void match(const char *text) const;
+
+    /**
+     * @brief Reports whether the last match() call accepted a pattern.
+     *
+     * @param pattern The index returned by add().
+     */
+    bool matched(size_t pattern) const;
+
+private:
+    const char **patterns = nullptr; /**< Patterns queued by add(). */
+    size_t patternCount = 0;
+    size_t patternCapacity = 0;
+
+    uint8_t alphabet[256]; /**< Byte to character class; class 0 is "any other byte". */
+    uint32_t *literals = nullptr; /**< Per class: positions whose literal is that class. */
+    uint32_t *stars = nullptr; /**< Positions holding a `*`. */
+    uint32_t *initial = nullptr; /**< Start positions, closed over leading stars. */
+    size_t *accepting = nullptr; /**< Accepting position of each pattern. */
+    size_t words = 0; /**< 32-bit words per state vector. */
+
+    mutable uint32_t *state = nullptr; /**< State vector of the last match(). */
+
+    void clear();
+};
+
+#endif //GLOB_MATCHER_H
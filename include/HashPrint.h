@@ -0,0 +1,28 @@
+#ifndef HASH_PRINT_H
+#define HASH_PRINT_H
+
+#include <Arduino.h>
+
+/**
+ * @class HashPrint
+ * @brief Hashes whatever is printed to it with 32-bit FNV-1a.
+ *
+ * @code
+ * HashPrint hasher;
+ * serializeJson(value, hasher);
+ * uint32_t fingerprint = hasher.hash;
+ * @endcode
+ */
+class HashPrint : public Print {
+public:
+    size_t write(uint8_t value) override {
+        hash = (hash ^ value) * 16777619UL;
+        return 1;
+    }
+
+    using Print::write;
+
+    uint32_t hash = 2166136261UL;
+};
+
+#endif //HASH_PRINT_H
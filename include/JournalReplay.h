@@ -0,0 +1,97 @@
+#ifndef JOURNAL_REPLAY_H
+#define JOURNAL_REPLAY_H
+
+#include "StepFunction.h"
+
+/**
+ * @class JournalReplay
+ * @brief Re-runs an execution from an ExecutionJournal, on a virtual clock and without real Tasks.
+ *
+ * The replayed execution reads its clock from the journal instead of
+ * millis(), so waits take no time and the replay runs as fast as the CPU
+ * allows. Task states do not call the execution's handler; they take the
+ * variables the device's Task left behind from the journal. Every run()
+ * result and resulting state is compared with the recorded one, which makes
+ * a replay a regression test of the library itself: a change in any
+ * decision is reported as a divergence.
+ *
+ * @code
+ * StepDefinition definition;
+ * definition.parse(config);
+ * StepFunction execution(handler);          // the handler is never called
+ * execution.setup(definition);
+ * JournalReplay replay(journalFile);
+ * if (!replay.replay(execution)) {
+ *     printf("diverged at run %lu: %s\n", replay.runs(), replay.divergence());
+ * }
+ * @endcode
+ */
+class JournalReplay {
+public:
+    /**
+     * @param journal The journal lines; it must outlive the replay.
+     */
+    explicit JournalReplay(Stream &journal);
+
+    /**
+     * @brief Replays events up to and including the next recorded run().
+     *
+     * The execution must be set up with the definition the device ran. Its
+     * clock is switched to the journal's for the whole replay.
+     *
+     * @return True if a run was replayed and matched the journal; false at the end of the journal or on a divergence.
+     */
+    bool next(StepFunction &execution);
+
+    /**
+     * @brief Replays the whole journal.
+     *
+     * @return True if every recorded run() was reproduced.
+     */
+    bool replay(StepFunction &execution);
+
+    /**
+     * @brief Returns true if a replayed decision differed from the journal.
+     */
+    bool diverged() const;
+
+    /**
+     * @brief Describes the first divergence, or returns an empty string.
+     */
+    const char *divergence() const;
+
+    /**
+     * @brief Returns the number of run() records replayed.
+     */
+    unsigned long runs() const;
+
+    /**
+     * @brief Returns the virtual clock: the time of the event being replayed.
+     */
+    unsigned long now() const;
+
+private:
+    friend class StepFunction;
+
+    Stream &journal;
+    JsonDocument record; /**< The event being replayed. */
+    JsonDocument task; /**< Recorded Task event of the coming run(). */
+    unsigned long clock = 0;
+    bool taskPending = false; /**< Whether task holds an outcome the coming run() has not consumed. */
+    unsigned long runCount = 0;
+    bool mismatch = false;
+    String reason;
+
+    static unsigned long virtualClock(void *replay);
+
+    /**
+     * @brief Hands the recorded outcome of a Task to the execution; called from inside run().
+     *
+     * @return The variables to continue with, or null if the journal holds no outcome for resource.
+     */
+    JsonVariantConst taskOutcome(const String &resource);
+
+    void fail(const String &what);
+};
+
+#endif //JOURNAL_REPLAY_H
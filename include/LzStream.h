@@ -0,0 +1,142 @@
+#ifndef LZ_STREAM_H
+#define LZ_STREAM_H
+
+#include <Arduino.h>
+
+#ifndef LZ_WINDOW_BITS
+#define LZ_WINDOW_BITS 8 /**< log2 of the back-reference window; the decoder accepts any stream up to this. */
+#endif
+
+#ifndef LZ_LOOKAHEAD_BITS
+#define LZ_LOOKAHEAD_BITS 4 /**< log2 of the longest back-reference. */
+#endif
+
+#define LZ_WINDOW_SIZE (1 << LZ_WINDOW_BITS)
+#define LZ_LOOKAHEAD_SIZE (1 << LZ_LOOKAHEAD_BITS)
+
+/**
+ * @brief First byte of a compressed stream.
+ *
+ * 0xC1 is never used by MessagePack and cannot start a JSON document, so a
+ * reader can tell compressed snapshots from plain ones by peeking one byte.
+ */
+#define LZ_MAGIC 0xC1
+
+/**
+ * @class LzEncoder
+ * @brief Compresses everything printed to it into another Print, in bounded RAM.
+ *
+ * The format is heatshrink-style LZSS: after a four-byte header, a 1 bit
+ * followed by 8 bits is a literal byte, and a 0 bit followed by a
+ * LZ_WINDOW_BITS offset and a LZ_LOOKAHEAD_BITS length copies earlier
+ * output. The encoder keeps only the window and the lookahead (about 300
+ * bytes with the defaults), so a snapshot is compressed while it is
+ * serialized and is never held whole in RAM.
+ *
+ * @code
+ * File file = LittleFS.open("/state.lz", "w");
+ * LzEncoder encoder(file);
+ * stepFunction.saveStateBinary(encoder);
+ * encoder.finish();
+ * @endcode
+ */
+class LzEncoder : public Print {
+public:
+    /**
+     * @param destination Receives the compressed bytes; it must outlive the encoder.
+     */
+    explicit LzEncoder(Print &destination);
+
+    size_t write(uint8_t value) override;
+
+    using Print::write;
+
+    /**
+     * @brief Compresses the buffered input and pads the last byte; call once after the last write.
+     *
+     * @return The total number of compressed bytes written to the destination.
+     */
+    size_t finish();
+
+private:
+    Print &destination;
+    uint8_t window[LZ_WINDOW_SIZE]; /**< Ring of the most recent input already encoded. */
+    uint8_t lookahead[LZ_LOOKAHEAD_SIZE]; /**< Input waiting to be encoded. */
+    size_t head = 0; /**< Next write position in window. */
+    size_t filled = 0; /**< Number of valid bytes in window. */
+    size_t pending = 0; /**< Number of bytes in lookahead. */
+    uint8_t bits = 0; /**< Output bits not yet written, left-aligned. */
+    uint8_t bitCount = 0;
+    size_t written = 0; /**< Compressed bytes written so far. */
+    bool started = false; /**< Whether the header has been written. */
+
+    void start();
+
+    /**
+     * @brief Encodes the longest match (or one literal) at the front of the lookahead.
+     */
+    void encode();
+
+    void putBits(uint16_t value, uint8_t count);
+};
+
+/**
+ * @class LzDecoder
+ * @brief Reads the decompressed content of a stream written by LzEncoder.
+ *
+ * Decoding needs only the window (256 bytes with the defaults); bytes are
+ * produced one at a time as the reader asks for them, so the decoder can be
+ * handed directly to deserializeJson() or deserializeMsgPack().
+ */
+class LzDecoder : public Stream {
+public:
+    /**
+     * @param source The compressed stream, positioned at its header; it must outlive the decoder.
+     */
+    explicit LzDecoder(Stream &source);
+
+    int available() override;
+
+    int read() override;
+
+    int peek() override;
+
+    /**
+     * @brief The decoder is read-only; writes are discarded.
+     */
+    size_t write(uint8_t value) override;
+
+    using Print::write;
+
+    /**
+     * @brief Returns false if the header is missing or uses a larger window than this build supports.
+     */
+    bool valid();
+
+private:
+    Stream &source;
+    uint8_t window[LZ_WINDOW_SIZE]; /**< Ring of the most recent output. */
+    size_t head = 0; /**< Next write position in window. */
+    uint8_t windowBits = 0; /**< Offset width of this stream. */
+    uint8_t lookaheadBits = 0; /**< Length width of this stream. */
+    size_t copyOffset = 0; /**< Distance of the back-reference being copied. */
+    size_t copyRemaining = 0; /**< Bytes of it still to produce. */
+    uint8_t bits = 0; /**< Input bits not yet consumed, left-aligned. */
+    uint8_t bitCount = 0;
+    int next = -1; /**< Byte produced by peek() and not yet read. */
+    int8_t status = 0; /**< 0 before the header is read, 1 while decoding, 2 at the end, -1 on a bad header. */
+
+    bool readHeader();
+
+    /**
+     * @brief Returns the next count bits, or -1 if the source ends first.
+     */
+    int getBits(uint8_t count);
+
+    /**
+     * @brief Decodes the next output byte, or returns -1 at the end.
+     */
+    int produce();
+};
+
+#endif //LZ_STREAM_H
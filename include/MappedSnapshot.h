@@ -0,0 +1,120 @@
+#ifndef MAPPED_SNAPSHOT_H
+#define MAPPED_SNAPSHOT_H
+
+#include <Arduino.h>
+
+#ifndef ARDUINO
+#include <stdio.h>
+
+/**
+ * @class MappedSnapshot
+ * @brief A snapshot file mapped read-only into memory on the host, for zero-copy restores.
+ *
+ * The file is a single snapshot, or a snapshot store: a sequence of records,
+ * each a 4-byte little-endian length followed by a snapshot written with
+ * SnapshotRecordWriter. Nothing is read up front; the kernel pages the file
+ * in as executions touch it, so reopening a store of a million executions
+ * after a restart costs the page faults of what actually runs.
+ *
+ * Pass the mapped bytes to StepFunction::restoreStateLazy() or
+ * Scheduler::resume(): only the cursor is decoded when resuming, and the
+ * variables are decoded from the mapping when the execution first runs.
+ * The mapping must therefore outlive every execution that has not hydrated.
+ *
+ * @code
+ * MappedSnapshot store("/var/lib/runner/executions.bin");
+ * const uint8_t *data;
+ * size_t length;
+ * for (size_t offset = 0; store.next(offset, data, length);) {
+ *     scheduler.resume(definition, data, length);
+ * }
+ * @endcode
+ */
+class MappedSnapshot {
+public:
+    /**
+     * @brief Maps a file; isOpen() tells whether it worked.
+     *
+     * @param path The file.
+     * @param sequential Advise the kernel to read ahead, for a store that is resumed front to back.
+     */
+    explicit MappedSnapshot(const char *path, bool sequential = false);
+
+    ~MappedSnapshot();
+
+    MappedSnapshot(const MappedSnapshot &) = delete;
+
+    MappedSnapshot &operator=(const MappedSnapshot &) = delete;
+
+    /**
+     * @brief Returns true if the file is mapped.
+     */
+    bool isOpen() const;
+
+    /**
+     * @brief Returns the first byte of the mapping, or nullptr if nothing is mapped.
+     */
+    const uint8_t *data() const;
+
+    /**
+     * @brief Returns the size of the mapping.
+     */
+    size_t size() const;
+
+    /**
+     * @brief Reads the record at offset of a snapshot store and advances offset past it.
+     *
+     * @param offset Byte offset of the record; start at 0.
+     * @param data Receives the first byte of the snapshot, inside the mapping.
+     * @param length Receives the snapshot size.
+     * @return False at the end of the store, or if the record is truncated.
+     */
+    bool next(size_t &offset, const uint8_t *&data, size_t &length) const;
+
+private:
+    uint8_t *mapping = nullptr;
+    size_t length = 0;
+};
+
+/**
+ * @class SnapshotRecordWriter
+ * @brief Appends one snapshot record to a store that MappedSnapshot reads.
+ *
+ * The length prefix is reserved on construction and filled in by finish(),
+ * so the snapshot can be serialized straight into the file:
+ *
+ * @code
+ * SnapshotRecordWriter record(file);
+ * stepFunction.saveStateBinary(record);
+ * record.finish();
+ * @endcode
+ */
+class SnapshotRecordWriter : public Print {
+public:
+    /**
+     * @param file A file opened for writing, positioned where the record goes.
+     */
+    explicit SnapshotRecordWriter(FILE *file);
+
+    size_t write(uint8_t value) override;
+
+    size_t write(const uint8_t *data, size_t length) override;
+
+    using Print::write;
+
+    /**
+     * @brief Writes the length prefix and leaves the file positioned after the record.
+     *
+     * @return False if any write failed.
+     */
+    bool finish();
+
+private:
+    FILE *file;
+    long start; /**< File position of the length prefix. */
+    size_t written = 0;
+    bool failed = false;
+};
+#endif
+
+#endif //MAPPED_SNAPSHOT_H
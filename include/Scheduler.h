@@ -0,0 +1,421 @@
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include "StepFunction.h"
+#include "StepDefinition.h"
+#include "CronExpression.h"
+#include "TimerQueue.h"
+#include "AsyncSnapshotStore.h"
+#include "DefinitionRegistry.h"
+
+#define SCHEDULER_MAX_STEPS 16
+#define SCHEDULER_MAX_QUOTAS 8
+
+/**
+ * @brief What a trigger does when it finds that one or more of its fire times already passed.
+ */
+enum MissedFire : uint8_t {
+    MISSED_FIRE_ONCE, /**< Submit a single execution for all the missed fire times. */
+    MISSED_FIRE_ALL, /**< Submit one execution per missed fire time. */
+    MISSED_FIRE_SKIP /**< Start nothing for a late fire; wait for the next one on schedule. */
+};
+
+/**
+ * @brief What submit() does with a start that cannot be admitted when the start queue is full.
+ */
+enum ShedPolicy : uint8_t {
+    SHED_REJECT, /**< Refuse the new start. */
+    SHED_DROP_OLDEST, /**< Discard the oldest queued start to make room. */
+    SHED_COALESCE /**< Merge a start into a queued one with the same definition and key; refuse it otherwise. */
+};
+
+/**
+ * @brief The outcome of Scheduler::submit().
+ */
+enum Admission : uint8_t {
+    ADMITTED, /**< Started immediately. */
+    QUEUED, /**< Waiting in the start queue. */
+    COALESCED, /**< Merged into a queued start with the same key. */
+    REJECTED /**< Not started and not queued. */
+};
+
+/**
+ * @class Scheduler
+ * @brief Runs executions from a fixed pool and starts them from interval and cron triggers.
+ *
+ * Every pooled StepFunction is constructed once, up front, in one contiguous
+ * block, and recycled when its execution ends. Executions parked in Wait, Debounce or Throttle states
+ * and the next fire time of every trigger are kept in one TimerQueue, so
+ * tick() touches only what is due and nextWakeup() tells the caller how long
+ * it may sleep.
+ *
+ * Starts go through admission control: a concurrency limit, per-definition
+ * quotas and an optional low-memory threshold decide whether a start runs
+ * now; otherwise it waits in a bounded start queue, and the ShedPolicy
+ * decides what gives when that queue is full.
+ *
+ * @code
+ * Scheduler scheduler(taskCallback, 4);
+ * scheduler.addInterval(pollDefinition, 30000);
+ * scheduler.addCron(maintenanceDefinition, "0 * * * *");
+ * scheduler.setEpoch(ntpSeconds);
+ *
+ * void loop() {
+ *     scheduler.tick();
+ *     delay(min(scheduler.nextWakeup(), 1000UL));
+ * }
+ * @endcode
+ */
+class Scheduler {
+public:
+    /**
+     * @param callback The Task callback given to every pooled execution.
+     * @param poolSize The maximum number of concurrent executions.
+     * @param triggerCapacity The maximum number of triggers.
+     * @param queueCapacity The maximum number of starts waiting for admission.
+     */
+    Scheduler(StepFunction::FunctionCallback callback, size_t poolSize, size_t triggerCapacity = 8,
+              size_t queueCapacity = 8);
+
+    /**
+     * @brief Like the FunctionCallback constructor, with pooled executions calling a TaskHandler.
+     */
+    Scheduler(StepFunction::TaskHandler handler, size_t poolSize, size_t triggerCapacity = 8,
+              size_t queueCapacity = 8);
+
+    ~Scheduler();
+
+    Scheduler(const Scheduler &) = delete;
+
+    Scheduler &operator=(const Scheduler &) = delete;
+
+    /**
+     * @brief Starts an execution of definition every period milliseconds, the first one period from now.
+     *
+     * @return The trigger index, or -1 if the trigger table is full or period is 0.
+     */
+    int addInterval(StepDefinition &definition, unsigned long period, MissedFire missed = MISSED_FIRE_ONCE);
+
+    /**
+     * @brief Starts an execution of definition at the times matched by a cron expression.
+     *
+     * Cron triggers stay idle until setEpoch() provides the wall-clock time.
+     *
+     * @return The trigger index, or -1 if the trigger table is full or the expression is malformed.
+     */
+    int addCron(StepDefinition &definition, const char *expression, MissedFire missed = MISSED_FIRE_ONCE);
+
+    /**
+     * @brief Enables or disables a trigger; re-enabling schedules it from now.
+     */
+    void setEnabled(int trigger, bool enabled);
+
+    /**
+     * @brief Sets the wall-clock time, e.g. after an NTP or RTC read.
+     *
+     * @param epochSeconds Seconds since 1970-01-01 UTC now, as read from the clock set by setClock().
+     */
+    void setEpoch(uint32_t epochSeconds);
+
+    /**
+     * @brief Starts an execution of definition now, if admission control allows it.
+     *
+     * @return The execution, e.g. to seed it with setVariable(); nullptr if it was not admitted.
+     */
+    StepFunction *spawn(StepDefinition &definition);
+
+    /**
+     * @brief Starts an execution of the newest definition registered under name in the registry set by setRegistry().
+     *
+     * @return The execution; nullptr if no such definition exists or it was not admitted.
+     */
+    StepFunction *spawn(const char *name);
+
+    /**
+     * @brief Forks a running execution into a free pool slot, sharing its variables copy-on-write.
+     *
+     * The fork is subject to the same admission checks as spawn().
+     *
+     * @param parent The execution to fork; it need not belong to this scheduler.
+     * @return The forked execution, or nullptr if it was not admitted.
+     */
+    StepFunction *fork(StepFunction &parent);
+
+    /**
+     * @brief Resumes an execution of definition from a snapshot, decoding its variables only when it runs.
+     *
+     * Only the current state and wait timer are read now (see
+     * StepFunction::restoreStateLazy()), so resuming many executions after a
+     * reboot is cheap; each one hydrates when the scheduler first runs it,
+     * which for a waiting execution is when its timer expires.
+     *
+     * @param snapshot The snapshot; it must stay valid until the execution hydrates.
+     * @param length The snapshot size.
+     * @return The execution, or nullptr if it was not admitted or the snapshot is unreadable.
+     */
+    StepFunction *resume(StepDefinition &definition, const uint8_t *snapshot, size_t length);
+
+    /**
+     * @brief Starts one execution of definition per element of inputs.
+     *
+     * Starts stop at the first one that is not admissible (see submit()); the
+     * caller can resume from the returned index later.
+     *
+     * @return The number of executions started.
+     */
+    size_t spawnAll(StepDefinition &definition, JsonArrayConst inputs);
+
+    /**
+     * @brief Starts one execution of definition per JSON document read from a JSON Lines stream.
+     *
+     * Each document is deserialized straight into its execution's global
+     * state. A malformed document, or one that is not an object, is skipped
+     * up to the end of its line and counted in stats().malformed; a malformed line that runs into the next
+     * one, e.g. an unclosed object, takes that line with it. Reading stops at
+     * the end of the stream or when the next start is not admissible; the
+     * stream is then positioned at the next unread document.
+     *
+     * @return The number of executions started.
+     */
+    size_t spawnAll(StepDefinition &definition, Stream &jsonLines);
+
+    /**
+     * @brief Starts an execution of definition now, or queues the start until it can be admitted.
+     *
+     * Triggers start their executions through submit().
+     *
+     * @param key Optional identity for SHED_COALESCE, e.g. the event source; nullptr never coalesces.
+     * @return How the start was handled.
+     */
+    Admission submit(StepDefinition &definition, const char *key = nullptr);
+
+    /**
+     * @brief Makes one read-only scope visible to every pooled execution.
+     *
+     * @see StepFunction::setSharedScope()
+     */
+    void setSharedScope(JsonVariantConst scope);
+
+    /**
+     * @brief Makes every pooled execution keep its blob variables in blobs.
+     *
+     * @see StepFunction::setBlobPool()
+     */
+    void setBlobPool(BlobPool &blobs);
+
+    /**
+     * @brief Limits the number of executions running at once; capped at the pool size.
+     */
+    void setConcurrencyLimit(size_t limit);
+
+    /**
+     * @brief Limits the number of concurrent executions of one definition.
+     *
+     * @param limit The quota; 0 removes it.
+     * @return False if SCHEDULER_MAX_QUOTAS definitions already have a quota.
+     */
+    bool setQuota(StepDefinition &definition, size_t limit);
+
+    /**
+     * @brief Pauses admission while free heap is below a threshold.
+     *
+     * @param threshold Minimum free bytes; 0 disables the check.
+     * @param freeMemory Returns the free heap in bytes; nullptr selects the platform's own
+     * (ESP.getFreeHeap() on ESP32/ESP8266).
+     */
+    void setLowMemoryThreshold(size_t threshold, size_t (*freeMemory)() = nullptr);
+
+    /**
+     * @brief Selects what happens to starts that find the start queue full.
+     */
+    void setShedPolicy(ShedPolicy policy);
+
+    /**
+     * @brief Lets tick() write queued snapshots of writer to its target store, a slice per tick.
+     *
+     * While snapshots are queued, nextWakeup() returns 0.
+     *
+     * @param writer The store executions checkpoint into, or nullptr to stop.
+     * @param budget Bytes written per tick.
+     */
+    void setSnapshotWriter(AsyncSnapshotStore *writer, size_t budget = 256);
+
+    /**
+     * @brief Sets the registry spawn(const char *) finds definitions in; it must outlive the scheduler.
+     */
+    void setRegistry(DefinitionRegistry &definitions);
+
+    /**
+     * @brief Replaces millis() as the time source of the scheduler and of every execution in its pool.
+     *
+     * Wakeups are compared with the executions' wait deadlines, so both must
+     * come from one clock: each start hands the scheduler's clock to its
+     * execution again, overriding any StepFunction::setClock() on it. Set the
+     * clock before adding triggers or starting executions.
+     *
+     * @param source The clock, or nullptr to go back to millis().
+     * @param context Passed to every call of source.
+     */
+    void setClock(StepFunction::Clock source, void *context = nullptr);
+
+    /**
+     * @brief Returns the number of starts waiting for admission.
+     */
+    size_t queued() const;
+
+    /**
+     * @brief Counters of admission outcomes since construction.
+     */
+    struct AdmissionStats {
+        uint32_t admitted = 0; /**< Started, directly or from the queue. */
+        uint32_t queued = 0;
+        uint32_t coalesced = 0;
+        uint32_t rejected = 0;
+        uint32_t dropped = 0; /**< Queued starts discarded by SHED_DROP_OLDEST. */
+        uint32_t malformed = 0; /**< JSON Lines documents spawnAll() skipped because they did not parse or are not objects. */
+    };
+
+    /**
+     * @brief Returns the admission counters.
+     */
+    const AdmissionStats &stats() const;
+
+    /**
+     * @brief Fires due triggers and runs due executions until each of them waits or ends.
+     */
+    void tick();
+
+    /**
+     * @brief Returns how many milliseconds the caller may sleep before the next tick() has work.
+     *
+     * @return 0 if work is due now; `(unsigned long) -1` if nothing is scheduled.
+     */
+    unsigned long nextWakeup() const;
+
+    /**
+     * @brief Returns the number of executions currently running or waiting.
+     */
+    size_t active() const;
+
+private:
+    Scheduler(StepFunction::FunctionCallback callback, StepFunction::TaskHandler handler, size_t poolSize,
+              size_t triggerCapacity, size_t queueCapacity);
+
+    /**
+     * @brief A schedule that starts executions of one definition.
+     */
+    struct Trigger {
+        StepDefinition *definition;
+        unsigned long period; /**< Interval in milliseconds; 0 for cron triggers. */
+        CronExpression *cron; /**< Compiled expression; nullptr for interval triggers. */
+        unsigned long next; /**< millis() of the next fire time. */
+        uint32_t nextEpoch; /**< Wall-clock next fire time of a cron trigger; 0 while unknown. */
+        MissedFire missed;
+        bool enabled;
+        bool queued; /**< True while the queue holds an entry for this trigger. */
+    };
+
+    /**
+     * @brief A start waiting for admission.
+     */
+    struct Pending {
+        StepDefinition *definition;
+        uint32_t key; /**< Hash of the submit() key; 0 when there was none. */
+    };
+
+    /**
+     * @brief The maximum number of concurrent executions of one definition.
+     */
+    struct Quota {
+        StepDefinition *definition;
+        size_t limit;
+        size_t active; /**< Running executions of definition. */
+    };
+
+    StepFunction *pool; /**< Executions, constructed once in one block. */
+    StepDefinition **running; /**< Definition each slot runs, or nullptr while the slot is free. */
+    uint32_t *freeSlots; /**< Stack of free slot indexes. */
+    size_t freeCount;
+    size_t poolSize;
+    Trigger *triggers;
+    size_t triggerCount = 0;
+    size_t triggerCapacity;
+    TimerQueue queue; /**< Wakeups of executions (id < poolSize) and triggers (id - poolSize). */
+    uint32_t epochBase = 0; /**< Wall-clock seconds at epochMillis; 0 until setEpoch(). */
+    unsigned long epochMillis = 0;
+    Pending *pending; /**< Start queue, oldest first. */
+    size_t pendingCount = 0;
+    size_t pendingCapacity;
+    Quota quotas[SCHEDULER_MAX_QUOTAS];
+    size_t quotaCount = 0;
+    size_t concurrencyLimit;
+    size_t lowMemoryThreshold = 0;
+    size_t (*freeMemory)() = nullptr;
+    ShedPolicy shedPolicy = SHED_REJECT;
+    AdmissionStats counters;
+    AsyncSnapshotStore *snapshotWriter = nullptr; /**< Store whose queued snapshots tick() writes. */
+    size_t snapshotBudget = 0; /**< Bytes written per tick. */
+    DefinitionRegistry *registry = nullptr; /**< Where spawn(const char *) looks names up, or nullptr. */
+    StepFunction::Clock clock = nullptr; /**< Time source of the scheduler and its executions, or nullptr for millis(). */
+    void *clockContext = nullptr;
+
+    /**
+     * @brief Returns true if a new execution of definition may start now.
+     */
+    bool admissible(const StepDefinition *definition) const;
+
+    /**
+     * @brief Takes a free slot and prepares definition in it; admission must have been checked.
+     *
+     * @param prepare False when the caller sets the slot up itself, through start() or fork().
+     * @return The slot index, or -1 if none is free.
+     */
+    long claim(StepDefinition &definition, bool prepare = true);
+
+    /**
+     * @brief Claims a slot for definition and queues it to run; admission must have been checked.
+     */
+    StepFunction *start(StepDefinition &definition);
+
+    /**
+     * @brief Returns a slot whose execution ended to the free stack.
+     */
+    void release(uint32_t slot);
+
+    /**
+     * @brief Starts queued executions, oldest first, for as long as they are admissible.
+     */
+    void drain();
+
+    /**
+     * @brief Runs one execution until it waits, ends, or used its share of steps.
+     */
+    void runSlot(uint32_t slot, unsigned long now);
+
+    /**
+     * @brief Moves the wakeup of an execution whose Debounce window setVariable() restarted.
+     */
+    static void waitMoved(void *scheduler, StepFunction &execution);
+
+    /**
+     * @brief Queues the next fire time of a trigger unless an entry is already pending.
+     */
+    void schedule(size_t index);
+
+    /**
+     * @brief Returns the time from the clock set by setClock(), or millis().
+     */
+    unsigned long clockMillis() const;
+
+    /**
+     * @brief Converts a wall-clock time to the matching clockMillis() value.
+     */
+    unsigned long toMillis(uint32_t epochSeconds) const;
+
+    /**
+     * @brief Starts the executions for a due trigger and schedules its next fire time.
+     */
+    void fire(Trigger &trigger, unsigned long now);
+};
+
+#endif //SCHEDULER_H
@@ -0,0 +1,66 @@
+#ifndef SNAPSHOT_STORE_H
+#define SNAPSHOT_STORE_H
+
+#include <Arduino.h>
+
+/**
+ * @class SnapshotStore
+ * @brief Destination of the checkpoints a StepFunction takes on its own.
+ *
+ * A checkpoint is written between open() and commit(); a store that keeps
+ * the previous checkpoint until commit() makes checkpoints atomic.
+ * CheckpointStore implements it on raw flash; applications can implement it
+ * on a file, RTC memory or a network connection.
+ */
+class SnapshotStore {
+public:
+    virtual ~SnapshotStore() {}
+
+    /**
+     * @brief Starts a checkpoint and returns the Print receiving it.
+     */
+    virtual Print &open() = 0;
+
+    /**
+     * @brief Makes the checkpoint written since open() the current one.
+     *
+     * @return False if the checkpoint could not be stored.
+     */
+    virtual bool commit() = 0;
+
+    /**
+     * @brief Abandons the checkpoint written since open().
+     */
+    virtual void abort() = 0;
+};
+
+/**
+ * @brief When a StepFunction checkpoints itself; every enabled trigger fires a checkpoint.
+ */
+struct CheckpointPolicy {
+    unsigned int everyTransitions = 0; /**< Checkpoint after this many state transitions; 0 disables. */
+    bool onWait = false; /**< Checkpoint on entering a Wait state, before the device may sleep. */
+    bool afterSideEffects = false; /**< Checkpoint after Task states marked "SideEffects": true. */
+    size_t changedBytes = 0; /**< Checkpoint once variable writes since the last one add up to this many bytes; 0 disables. */
+    bool compress = true; /**< Compress checkpoints with LzEncoder. */
+};
+
+/**
+ * @brief Counters of the checkpoints a StepFunction has taken.
+ */
+struct CheckpointStats {
+    unsigned long checkpoints = 0; /**< Checkpoints committed. */
+    unsigned long failures = 0; /**< Checkpoints the store rejected. */
+    unsigned long bytes = 0; /**< Bytes written to the store, after compression. */
+    unsigned long persistMicros = 0; /**< Time spent serializing and storing checkpoints. */
+    unsigned long runMicros = 0; /**< Time spent in run(), checkpoints included. */
+
+    /**
+     * @brief Returns the share of run() time spent on persistence, 0 to 1.
+     */
+    float persistFraction() const {
+        return runMicros > 0 ? static_cast<float>(persistMicros) / static_cast<float>(runMicros) : 0;
+    }
+};
+
+#endif //SNAPSHOT_STORE_H
@@ -0,0 +1,298 @@
+#ifndef STEP_DEFINITION_H
+#define STEP_DEFINITION_H
+
+#include <ArduinoJson.h>
+#include "CompiledState.h"
+#include "DefinitionSource.h"
+
+/**
+ * @brief How the compiled-state cache of a paged definition has performed.
+ */
+struct DefinitionCacheStats {
+    unsigned long hits = 0; /**< Visits to a state that was compiled already. */
+    unsigned long misses = 0; /**< Visits that had to read and compile the state. */
+    unsigned long evictions = 0; /**< Compiled states dropped to make room. */
+    unsigned long prefetches = 0; /**< States compiled ahead of their first visit. */
+};
+
+/**
+ * @class StepDefinition
+ * @brief A parsed and compiled state machine configuration.
+ *
+ * A definition holds no execution state, so any number of StepFunction
+ * executions can run from the same one (see StepFunction::setup(StepDefinition &)).
+ * It must outlive every execution bound to it.
+ */
+class StepDefinition {
+public:
+    StepDefinition();
+
+    ~StepDefinition();
+
+    StepDefinition(const StepDefinition &) = delete;
+
+    StepDefinition &operator=(const StepDefinition &) = delete;
+
+    /**
+     * @brief Parses a JSON configuration and compiles every state.
+     *
+     * Replaces any configuration parsed before. On failure an error message is
+     * printed and the definition is left without states.
+     *
+     * @param jsonConfig A C-string containing the JSON configuration.
+     * @return True on success; otherwise, false.
+     */
+    bool parse(const char *jsonConfig);
+
+    /**
+     * @brief Compiles a configuration that lives in a document owned elsewhere, without copying it.
+     *
+     * The document must outlive the definition and must not be modified
+     * while the definition uses it; DefinitionRegistry keeps every
+     * definition it compiles in one document this way.
+     *
+     * @param source The configuration object.
+     * @return True on success; otherwise, false.
+     */
+    bool compile(JsonObject source);
+
+    /**
+     * @brief Indexes a configuration and leaves each state to be compiled on its first visit.
+     *
+     * Only the offsets of the state definitions in the text are recorded, so
+     * setup time and RAM grow with the states an execution actually visits.
+     * A state that fails to compile is reported when first visited, where
+     * find() returns nullptr and run() reports INVALID_STATE. State names
+     * must not contain escape sequences.
+     *
+     * @param jsonConfig The configuration, e.g. in flash; it must outlive the definition.
+     * @param length Its length, or 0 if it is NUL-terminated.
+     * @return False if the text is not a JSON object with a "States" object.
+     */
+    bool index(const char *jsonConfig, size_t length = 0);
+
+    /**
+     * @brief Indexes a configuration kept outside RAM and compiles states through a bounded cache.
+     *
+     * Only state names and offsets stay resident. A visited state is read
+     * back from the source and compiled; when cacheStates states are
+     * compiled, the least recently used one is dropped. Aggregate and
+     * Debounce states stay compiled once visited, since executions keep
+     * per-state data that refers to them. After a miss, the states the
+     * visited one can move to are prefetched, most visited first.
+     *
+     * @param text The configuration; it must outlive the definition.
+     * @param cacheStates Compiled states kept in RAM, at least 2.
+     * @param prefetchStates Successors compiled ahead of a visit, at most.
+     * @return False if the text is not a JSON object with a "States" object.
+     */
+    bool index(DefinitionSource &text, size_t cacheStates = 16, size_t prefetchStates = 2);
+
+    /**
+     * @brief Returns true if the definition was indexed from a DefinitionSource.
+     *
+     * A state of a paged definition can be evicted, so executions look it up on every run().
+     */
+    bool isPaged() const;
+
+    /**
+     * @brief Returns the hit, miss, eviction and prefetch counts of an indexed definition.
+     */
+    const DefinitionCacheStats &cacheStats() const;
+
+    /**
+     * @brief Returns how often find() returned the state at index of an indexed definition.
+     */
+    unsigned long visits(size_t index) const;
+
+    /**
+     * @brief Returns the number of states compiled so far; all of them unless the definition was indexed.
+     */
+    size_t compiled() const;
+
+    /**
+     * @brief Looks up the compiled state with the given name.
+     *
+     * @return The compiled state, or nullptr if there is none.
+     */
+    CompiledState *find(const char *name) const;
+
+    /**
+     * @brief Returns the state at index, in "States" order.
+     *
+     * Of an indexed definition, only the name is valid until find() has compiled the state.
+     */
+    CompiledState *state(size_t index) const;
+
+    /**
+     * @brief Returns the number of compiled states.
+     */
+    size_t size() const;
+
+    /**
+     * @brief Returns the number of Aggregate, Debounce and Throttle states compiled so far.
+     *
+     * Executions keep per-state data (sample windows, timers) for these
+     * states only, indexed by slotOf(). An indexed definition numbers a
+     * state when it first compiles it, so the count can grow while
+     * executions run.
+     */
+    size_t statefulCount() const;
+
+    /**
+     * @brief Returns the per-execution data slot of the state at index, or SIZE_MAX if it keeps none.
+     */
+    size_t slotOf(size_t index) const;
+
+    /**
+     * @brief Returns the index of the state that owns a data slot.
+     */
+    size_t slotState(size_t slot) const;
+
+    /**
+     * @brief Returns the "StartAt" state name, or nullptr.
+     */
+    const char *startAt() const;
+
+    /**
+     * @brief Returns the compiled top-level "OutputPath", or nullptr when the whole global state is the output.
+     */
+    const VariablePath *outputPath() const;
+
+    /**
+     * @brief Returns a hash of the whole configuration, which snapshots record to name their definition.
+     */
+    uint32_t hash() const;
+
+    /**
+     * @brief Returns the top-level "Version" string, or nullptr.
+     */
+    const char *version() const;
+
+    /**
+     * @brief Returns true if snapshots of the given definition can be restored into this one.
+     *
+     * That is the case for this definition's own snapshots, for snapshots
+     * without a definition hash (saved before hashes were recorded), and for
+     * snapshots a "Migrations" entry names in its "From".
+     *
+     * @param fromHash The hash the snapshot records.
+     * @param fromVersion The version the snapshot records, or nullptr.
+     */
+    bool accepts(uint32_t fromHash, const char *fromVersion) const;
+
+    /**
+     * @brief Adapts a parsed snapshot of an older definition to this one, in place.
+     *
+     * Applies the "States" and "Variables" renames of the matching
+     * "Migrations" entry to the current state, the per-state timers and
+     * windows, and the top-level variables; only the renamed keys change.
+     * The renames apply as one step, so swaps and chains move every value once.
+     *
+     * @param snapshot A parsed snapshot, or just its cursor.
+     * @return False if the snapshot is from a definition this one does not
+     * accept, its renames collide, or its current state does not exist here.
+     */
+    bool migrate(JsonDocument &snapshot) const;
+
+private:
+    JsonDocument doc; /**< JSON document for parsed configuration data. */
+    JsonObject config; /**< The configuration compiled: the root of doc, or an object in another document. */
+    CompiledState *states = nullptr; /**< States compiled by parse(), one per "States" member. */
+    size_t stateCount = 0; /**< Number of entries in states. */
+    VariablePath *output = nullptr; /**< Compiled "OutputPath", or nullptr. */
+    uint32_t configHash = 0; /**< FNV-1a of the compact configuration. */
+
+    enum SliceStatus : uint8_t {
+        SLICE_PENDING,
+        SLICE_COMPILED,
+        SLICE_FAILED
+    };
+
+    /**
+     * @brief Where an indexed state's definition lies in the source text, and how it is used.
+     */
+    struct StateSlice {
+        uint32_t offset;
+        uint32_t length;
+        SliceStatus status;
+        unsigned long visits; /**< find() calls that returned the state. */
+        unsigned long lastUse; /**< useClock of the latest visit, for eviction. */
+    };
+
+    const char *source = nullptr; /**< Text given to index(), or nullptr when every state is compiled. */
+    DefinitionSource *pagedSource = nullptr; /**< Storage given to index(DefinitionSource &), or nullptr. */
+    StateSlice *slices = nullptr; /**< One per state of an indexed definition. */
+    JsonDocument **stateDocs = nullptr; /**< Parsed definition of each state compiled from source. */
+    char *names = nullptr; /**< State names of an indexed definition, NUL-terminated. */
+    mutable size_t compiledCount = 0; /**< States of an indexed definition compiled so far. */
+    uint16_t *buckets = nullptr; /**< Open-addressing table of state index + 1 by name hash; 0 is empty. */
+    size_t bucketMask = 0; /**< Number of buckets minus one; a power of two at least twice the state count. */
+    size_t cacheCapacity = 0; /**< Evictable compiled states a paged definition keeps; 0 when unbounded. */
+    size_t prefetchLimit = 0; /**< Successors compiled ahead after a miss. */
+    uint16_t *resident = nullptr; /**< Indices of the evictable compiled states. */
+    mutable size_t residentCount = 0; /**< Number of entries in resident. */
+    mutable unsigned long useClock = 0; /**< Counts visits, to order them for eviction. */
+    mutable DefinitionCacheStats cacheCounters;
+    uint16_t *slots = nullptr; /**< Data slot of each state, or NO_SLOT; kept across evictions. */
+    uint16_t *slotStates = nullptr; /**< State index of each data slot. */
+    mutable size_t statefulStates = 0; /**< Data slots numbered so far. */
+
+    static const uint16_t NO_SLOT = 0xFFFF;
+
+    /**
+     * @brief Allocates the slot tables for count states.
+     */
+    void allocateSlots(size_t count);
+
+    /**
+     * @brief Numbers the data slot of a just compiled Aggregate, Debounce or Throttle state.
+     */
+    void assignSlot(size_t index) const;
+
+    template<typename Text>
+    bool indexText(const Text &text, size_t length);
+
+    /**
+     * @brief Parses length bytes of the indexed text starting at offset.
+     */
+    bool readSlice(size_t offset, size_t length, JsonDocument &out) const;
+
+    /**
+     * @brief Returns the index of the state with the given name in an indexed definition, or stateCount.
+     */
+    size_t lookup(const char *name) const;
+
+    /**
+     * @brief Reads and compiles an indexed state, evicting another one (never keep) if the cache is full.
+     */
+    bool load(size_t index, size_t keep) const;
+
+    /**
+     * @brief Drops the least recently used evictable state other than keep.
+     */
+    void evict(size_t keep) const;
+
+    /**
+     * @brief Compiles the not yet compiled successors of a state, most visited first.
+     */
+    void prefetch(size_t index) const;
+
+    bool compileOutput();
+
+    /**
+     * @brief Parses and compiles an indexed state unless done already.
+     *
+     * @return False if the state does not compile.
+     */
+    bool compileLazily(size_t index) const;
+
+    /**
+     * @brief Returns the "Migrations" entry whose "From" names the given hash or version, or null.
+     */
+    JsonObjectConst migrationFrom(uint32_t fromHash, const char *fromVersion) const;
+
+    void clear();
+};
+
+#endif //STEP_DEFINITION_H
@@ -6,6 +6,11 @@
 #define STEP_FUNCTION_H
 
 #include <ArduinoJson.h>
+#include "CompiledState.h"
+#include "StepDefinition.h"
+#include "Variables.h"
+#include "SnapshotStore.h"
+#include "ExecutionJournal.h"
 #define LOG
 
 /**
@@ -18,26 +23,193 @@ enum StepFunctionState {
     WAIT_DELAY = 2 /**< The state machine is currently in a wait/delay state. */
 };
 
+class JournalReplay;
+
 /**
  * @class StepFunction
  * @brief A class to manage a state machine based on JSON-defined configurations.
  */
 class StepFunction {
-    JsonDocument doc; /**< JSON document for parsed configuration data. */
+public:
+    /**
+     * @brief Typedef for the user-defined callback function to handle "Task" states.
+     *
+     * @param resource The resource string defining the task.
+     * @param globalState The shared global state document.
+     */
+    typedef void (*FunctionCallback)(const String &resource, JsonDocument &globalState);
+
+    /**
+     * @brief Typedef for a "Task" handler that works on the variable store instead of the whole document.
+     *
+     * @param resource The resource string defining the task.
+     * @param variables The execution's variables; read with get()/resolve(), write with set()/edit().
+     */
+    typedef void (*TaskHandler)(const String &resource, Variables &variables);
+
+    /**
+     * @brief Typedef for a clock replacing millis(), e.g. a virtual clock for simulations.
+     *
+     * @param context The pointer given to setClock().
+     * @return The current time in milliseconds.
+     */
+    typedef unsigned long (*Clock)(void *context);
+
+    /**
+     * @brief Typedef for a callback told when something outside run() moved an execution's wait deadline.
+     *
+     * @param context The pointer given to setWaitListener().
+     * @param execution The execution; getWaitUntil() returns the new deadline.
+     */
+    typedef void (*WaitListener)(void *context, StepFunction &execution);
+
+private:
+    friend class JournalReplay;
+
+    StepDefinition *definition = nullptr; /**< The configuration this execution runs. */
+    StepDefinition *owned = nullptr; /**< Definition parsed by setup(const char *), owned by this object. */
     JsonDocument globalState; /**< Stores variables and states during execution. */
+    Variables variables{globalState}; /**< Compiled-path view of globalState. */
     String currentState; /**< Tracks the current state in the state machine. */
     unsigned long waitUntil = 0; /**< Holds the timestamp for delay handling. */
     unsigned long recommendedDelay = 0; /**< Holds the timestamp for delay handling. */
+    CompiledState *states = nullptr; /**< The definition's compiled states. */
+    size_t stateCount = 0; /**< Number of entries in states. */
+    CompiledState *current = nullptr; /**< Compiled entry for currentState, resolved lazily. */
+    AggregateWindow **windows = nullptr; /**< Sample windows of this execution, by data slot; created on first visit. */
 
     /**
-     * @brief Typedef for the user-defined callback function to handle "Task" states.
+     * @brief Per-execution timer of a Debounce or Throttle state.
+     */
+    struct StateTimer {
+        unsigned long at; /**< When the debounce window started, or when the throttle last passed. */
+        bool armed; /**< False until the state is first visited. */
+    };
+
+    StateTimer *timers = nullptr; /**< Timers of this execution, by data slot. */
+    size_t slotCapacity = 0; /**< Entries in windows and timers; see StepDefinition::slotOf(). */
+
+    /**
+     * @brief Measured run() time of one state.
+     */
+    struct StateProfile {
+        unsigned long runs; /**< run() calls that executed the state. */
+        unsigned long totalMicros; /**< Their summed duration. */
+        unsigned long maxMicros; /**< The longest of them, checkpoints excluded. */
+        unsigned long handlerMaxMicros; /**< The longest Task handler call, included in maxMicros. */
+    };
+
+    bool profiling = false; /**< Whether run() times states; see setProfiling(). */
+    StateProfile *profiles = nullptr; /**< Profile of each state, parallel to states, while profiling. */
+    unsigned long handlerMicros = 0; /**< Duration of the Task handler called by the current run(). */
+    JsonDocument debounceSample; /**< Value the armed Debounce state is waiting to see stay unchanged. */
+
+    SnapshotStore *checkpointStore = nullptr; /**< Where run() checkpoints to, or nullptr. */
+    CheckpointPolicy policy; /**< When run() checkpoints. */
+    CheckpointStats checkpointStats; /**< Checkpoint and run() time counters. */
+    unsigned int transitionsSinceCheckpoint = 0;
+    CompiledState *processed = nullptr; /**< State executed by the last step(), or nullptr if it only waited. */
+    const uint8_t *lazySnapshot = nullptr; /**< Snapshot whose variables restoreStateLazy() has not decoded yet. */
+    bool hydrationFailed = false; /**< The lazily restored snapshot failed to decode; cleared by setup() and the next restore. */
+    size_t lazyLength = 0;
+    Clock clock = nullptr; /**< Time source, or nullptr for millis(). */
+    void *clockContext = nullptr;
+    WaitListener waitListener = nullptr; /**< Told when setVariable() restarts a Debounce window, or nullptr. */
+    void *waitListenerContext = nullptr;
+    ExecutionJournal *journal = nullptr; /**< Where run() inputs and decisions are recorded, or nullptr. */
+    JournalReplay *replay = nullptr; /**< Replay supplying Task outcomes while it drives run(), or nullptr. */
+
+    FunctionCallback functionCallback = nullptr; /**< The user-defined callback function. */
+    TaskHandler taskHandler = nullptr; /**< The user-defined handler, used instead of functionCallback when set. */
+
+    /**
+     * @brief Looks up the compiled state with the given name.
      *
-     * @param resource The resource string defining the task.
-     * @param globalState The shared global state document.
+     * @param name The state name.
+     * @return The compiled state, or nullptr if there is none.
      */
-    typedef void (*FunctionCallback)(const String &resource, JsonDocument &globalState);
+    CompiledState *findState(const String &name);
+
+    /**
+     * @brief Applies an optional Assign block to the global state.
+     */
+    void applyAssign(const Assignment *assign);
+
+    /**
+     * @brief Returns this execution's data slot of an Aggregate, Debounce or Throttle state.
+     *
+     * Grows windows and timers when an indexed definition has numbered more stateful states since bind().
+     */
+    size_t slotFor(const CompiledState *state);
+
+    /**
+     * @brief Drops every sample window, disarms every timer and forgets the debounce sample.
+     */
+    void resetSlots();
+
+    /**
+     * @brief Returns this execution's sample window for an Aggregate state, creating it on first use.
+     */
+    AggregateWindow &windowFor(const CompiledState *state);
+
+    /**
+     * @brief Writes the statistics of an Aggregate state's window into its result variable.
+     */
+    void publishAggregate(const CompiledState *state, const AggregateWindow &window);
+
+    /**
+     * @brief Starts (or restarts) the window of a Debounce state with the current value of its Variable.
+     */
+    void armDebounce(const CompiledState *state, JsonVariantConst value, unsigned long now);
+
+    /**
+     * @brief Releases the sample windows and timers of this execution.
+     */
+    void clearRuntime();
+
+    /**
+     * @brief Processes the current state and transitions based on its type; run() without checkpointing.
+     *
+     * @param now The clock reading every timer of this step uses.
+     */
+    int step(unsigned long now);
 
-    FunctionCallback functionCallback; /**< The user-defined callback function. */
+    /**
+     * @brief Returns the time from the clock set by setClock(), or millis().
+     */
+    unsigned long clockMillis() const;
+
+    /**
+     * @brief Fills a snapshot document for saveState() or saveStateBinary().
+     *
+     * @param binary True to store blob variables as MessagePack binary; otherwise they are written as null.
+     * @return False if the execution's lazily restored snapshot failed to decode.
+     */
+    bool snapshot(JsonDocument &saveDoc, bool binary);
+
+    /**
+     * @brief Replaces the execution's state with a parsed snapshot, migrating it to the current definition.
+     *
+     * @return False if the definition does not accept the snapshot; nothing is changed then.
+     */
+    bool restore(JsonDocument &restoreDoc);
+
+    /**
+     * @brief Moves MessagePack binary variables of a restored snapshot into the blob pool.
+     */
+    void adoptBlobs();
+
+    /**
+     * @brief Returns the output selected by OutputPath, resolved through shared layers without merging them.
+     *
+     * Without an OutputPath this is only this execution's own document.
+     */
+    JsonVariantConst outputView() const;
+
+    /**
+     * @brief Points this execution at a definition and sizes its per-state data.
+     */
+    void bind(StepDefinition &target);
 
 public:
     /**
@@ -49,15 +221,136 @@ public:
      */
     StepFunction(FunctionCallback callback);
 
+    /**
+     * @brief Constructs a StepFunction whose Task states call a handler working on the variable store.
+     *
+     * @param handler A user-defined function to handle "Task" states.
+     */
+    StepFunction(TaskHandler handler);
+
+    ~StepFunction();
+
+    StepFunction(const StepFunction &) = delete;
+
+    StepFunction &operator=(const StepFunction &) = delete;
+
     /**
      * @brief Initializes the StepFunction with a JSON-based configuration.
      *
-     * Parses the JSON configuration and sets up the initial state for processing.
+     * Parses the JSON configuration, compiles every state (including Assign
+     * expressions and Choice conditions) and sets up the initial state for processing.
      *
      * @param jsonConfig A C-string containing the JSON configuration.
      */
     void setup(const char *jsonConfig);
 
+    /**
+     * @brief Starts a fresh execution of a shared, already compiled definition.
+     *
+     * Clears the global state, the wait timer and all per-state data, and
+     * moves to the definition's "StartAt" state. The definition must outlive
+     * this execution.
+     *
+     * @param shared The definition to run.
+     */
+    void setup(StepDefinition &shared);
+
+    /**
+     * @brief Starts a fresh execution of the current definition with the given input.
+     *
+     * Clears everything setup(StepDefinition &) clears, then copies input into
+     * the global state: the members of an object input become top-level
+     * variables. The input is copied, so it may be the output() of another
+     * execution (but not of this one, which is cleared first). Blob variables
+     * of the input are set to null: a handle from outside is not a reference
+     * this execution holds.
+     *
+     * @param input The execution input.
+     * @return False if no definition has been set up.
+     */
+    bool start(JsonVariantConst input);
+
+    /**
+     * @brief Starts a fresh execution with input deserialized straight from a stream.
+     *
+     * Reads exactly one JSON document, so consecutive calls consume a JSON Lines stream.
+     * As with start(JsonVariantConst), blob variables of the input are set to null.
+     *
+     * @param input The stream to read.
+     * @return False if no definition has been set up, or the stream holds no valid document. A
+     * document that is not an object is refused, as its members are the variables.
+     */
+    bool start(Stream &input);
+
+    /**
+     * @brief Sets up shared and starts it with input in one pass, as setup(shared) then start(input).
+     *
+     * @return Always true.
+     */
+    bool start(StepDefinition &shared, JsonVariantConst input);
+
+    /**
+     * @brief Sets up shared and starts it with input read from a stream, as setup(shared) then start(input).
+     *
+     * @param result Optionally receives the deserialization outcome, e.g. to tell the end of the stream from a
+     * malformed document. It is Ok when the document parsed but is not an object.
+     * @return False if the stream holds no valid document.
+     */
+    bool start(StepDefinition &shared, Stream &input, DeserializationError *result = nullptr);
+
+    /**
+     * @brief Returns the execution's output: the value at the definition's "OutputPath", or the whole global state.
+     *
+     * The view stays valid until the execution runs or restarts; pass it
+     * directly to another execution's start() to chain workflows.
+     */
+    JsonVariantConst output();
+
+    /**
+     * @brief Serializes output() as JSON to a Print or Stream, without an intermediate String.
+     *
+     * @return The number of bytes written.
+     */
+    size_t writeOutput(Print &destination);
+
+    /**
+     * @brief Serializes output() as JSON into a caller buffer.
+     *
+     * @param buffer Receives the NUL-terminated JSON, truncated if it does not fit.
+     * @param size The capacity of buffer.
+     * @return The number of bytes written, excluding the terminator.
+     */
+    size_t writeOutput(char *buffer, size_t size);
+
+    /**
+     * @brief Returns the length of output() serialized as JSON, to size a buffer for writeOutput().
+     */
+    size_t measureOutput();
+
+    /**
+     * @brief Forks this execution into child, sharing variables copy-on-write.
+     *
+     * The child continues from the same state with the same timers and
+     * aggregate windows; afterwards each execution duplicates only the
+     * top-level variables it writes. A document-based FunctionCallback
+     * needs every variable in its own document, so with one the first Task
+     * after a fork copies the shared variables; use a TaskHandler to avoid that.
+     *
+     * @param child The execution to overwrite with the fork.
+     * @return False if this execution has no definition, child is this execution, or its snapshot failed to decode.
+     */
+    bool fork(StepFunction &child);
+
+    /**
+     * @brief Returns the definition this execution runs, or nullptr before setup().
+     */
+    StepDefinition *getDefinition() const;
+
+    /**
+     * @brief Returns the millis() timestamp before which run() only reports WAIT_DELAY.
+     */
+    unsigned long getWaitUntil() const;
+
     /**
      * @brief Executes the step function state logic.
      *
@@ -69,17 +362,157 @@ public:
 
     unsigned long getRecommendedDelay();
 
+    /**
+     * @brief Lets run() take checkpoints by itself, into store, whenever policy says so.
+     *
+     * Checkpoints are saveStateBinary() snapshots, compressed unless the
+     * policy says otherwise, that restoreState(Stream &) reads back. The
+     * changedBytes trigger counts every top-level variable a Task callback
+     * added or rewrote, whichever callback type it is, as well as Assign
+     * blocks, Aggregate results and setVariable().
+     *
+     * @param store Receives the checkpoints; it must outlive the execution.
+     * @param checkpointPolicy When to checkpoint.
+     */
+    void setCheckpointing(SnapshotStore &store, const CheckpointPolicy &checkpointPolicy);
+
+    /**
+     * @brief Stops automatic checkpoints.
+     */
+    void disableCheckpointing();
+
+    /**
+     * @brief Takes a checkpoint into the store set by setCheckpointing() now.
+     *
+     * @return False if no store is set or the store rejected the checkpoint.
+     */
+    bool checkpoint();
+
+    /**
+     * @brief Returns the checkpoint counters, including persistence time as a fraction of run() time.
+     */
+    const CheckpointStats &getCheckpointStats() const;
+
+    /**
+     * @brief Replaces millis() as the time source of waits, timers and windows.
+     *
+     * @param source The clock, or nullptr to go back to millis().
+     * @param context Passed to every call of source.
+     */
+    void setClock(Clock source, void *context = nullptr);
+
+    /**
+     * @brief Sets a callback told when setVariable() restarts a Debounce window and so moves getWaitUntil().
+     *
+     * Scheduler uses it to move the execution's wakeup instead of waking at the old deadline.
+     *
+     * @param listener The callback, or nullptr.
+     * @param context Passed to every call of listener.
+     */
+    void setWaitListener(WaitListener listener, void *context = nullptr);
+
+    /**
+     * @brief Records this execution's inputs and run() decisions, for JournalReplay.
+     *
+     * Starts with a snapshot of the current state, so recording can begin at
+     * any point, e.g. right after a restore. Each Task then journals every
+     * variable, so keep journaling to diagnostics.
+     *
+     * @param target The journal, or nullptr to stop recording; it must outlive the execution.
+     */
+    void setJournal(ExecutionJournal *target);
+
+    /**
+     * @brief Times every run() and Task handler call, per state.
+     *
+     * Costs two micros() calls per run(). The figures feed
+     * DefinitionAnalysis, which turns them into worst-case bounds on the
+     * time between Wait states. Turning profiling off discards them.
+     */
+    void setProfiling(bool enabled);
+
+    /**
+     * @brief Writes the measured latencies of every state that has run since profiling began.
+     *
+     * One member per state: `{"Resource":…,"Runs":…,"MeanMicros":…,"MaxMicros":…,"HandlerMaxMicros":…}`,
+     * Resource for Task states only. Writing a profile never loads a state, so a state a paged
+     * definition has evicted since it ran has no Resource; DefinitionAnalysis reads Resources
+     * from the definition, not from the profile.
+     *
+     * @param out Receives the members; DefinitionAnalysis::addProfile() reads it back.
+     */
+    void writeProfile(JsonObject out) const;
+
+    /**
+     * @brief Declares whether the global state keeps a fixed layout.
+     *
+     * When true, Task callbacks must only overwrite scalar values in the global
+     * state, never remove members or replace objects and arrays. Resolved
+     * variable paths are then cached across runs.
+     *
+     * @param fixed True to enable slot caching.
+     */
+    void setFixedLayout(bool fixed);
+
+    /**
+     * @brief Makes a read-only scope, e.g. device configuration, visible to this execution.
+     *
+     * Choice variables, expressions, decision tables and TaskHandlers read its
+     * members as top-level variables whenever the execution has no variable
+     * of that name; nothing is copied. The scope is not part of saveState(),
+     * and document-based FunctionCallbacks do not see it. It survives
+     * setup(), start() and restoreState(), and is inherited by fork().
+     *
+     * @param scope An object living in a document (RAM, or parsed once from
+     * PROGMEM) that outlives this execution and is not modified while in use.
+     */
+    void setSharedScope(JsonVariantConst scope);
+
+    /**
+     * @brief Sets the pool that blob variables of this execution live in.
+     *
+     * TaskHandlers then pass binary data such as sensor frames between
+     * states by handle with Variables::setBlob() and Variables::getBlob(),
+     * instead of as JSON arrays or base64 strings. Set the pool before the
+     * execution holds any blob; the pool must outlive the execution. It
+     * survives setup(), start() and restoreState(), and is inherited by fork().
+     */
+    void setBlobPool(BlobPool &pool);
+
+    /**
+     * @brief Writes a top-level variable from outside a Task callback, e.g. from an input handler.
+     *
+     * If the execution is waiting in a Debounce state on this value and the
+     * value changes, the debounce window restarts from now; the caller should
+     * re-read getRecommendedDelay() before sleeping.
+     *
+     * @param name The variable name.
+     * @param value The new value; copied into the global state. A `{"$blob": handle}` is stored as null; use Variables::setBlob().
+     * @return False if the execution's lazily restored snapshot failed to decode.
+     */
+    bool setVariable(const char *name, JsonVariantConst value);
+
     /**
      * @brief Saves the step function's internal state into a JSON object.
      *
      * This function serializes the current state, global state, wait info,
      * and other relevant data into a JSON object. The generated JSON
-     * can be used to persist the state across sessions.
+     * can be used to persist the state across sessions. Blob variables
+     * cannot be represented and are saved as null; use saveStateBinary().
      *
-     * @return A JSON string representing the saved state.
+     * @return A JSON string representing the saved state, or an empty string if the execution's
+     * lazily restored snapshot failed to decode.
      */
     String saveState();
 
+    /**
+     * @brief Saves the same snapshot as saveState() in MessagePack, with blob variables as raw binary.
+     *
+     * @param destination The Print or Stream receiving the snapshot.
+     * @return The number of bytes written; 0 if the execution's lazily restored snapshot failed to decode.
+     */
+    size_t saveStateBinary(Print &destination);
+
     /**
      * @brief Restores the step function's internal state from a JSON string.
      *
@@ -90,6 +523,69 @@ public:
      * @return True if the state was restored successfully; otherwise, false.
      */
     bool restoreState(const String &savedState);
+
+    /**
+     * @brief Restores a snapshot from memory: MessagePack from saveStateBinary(), JSON, or compressed.
+     *
+     * @param data The snapshot bytes.
+     * @param length The snapshot size.
+     * @return True if the state was restored successfully; otherwise, false.
+     */
+    bool restoreStateBinary(const uint8_t *data, size_t length);
+
+    /**
+     * @brief Restores only the current state and wait timer now, and the variables when they are first needed.
+     *
+     * @param data The snapshot, JSON, MessagePack or compressed; it must stay
+     * valid until the execution is hydrated or restarted.
+     * @param length The snapshot size.
+     * @return False if the cursor could not be decoded, or the definition does not accept the snapshot.
+     */
+    bool restoreStateLazy(const uint8_t *data, size_t length);
+
+    /**
+     * @brief Decodes only the current state, wait timer and definition hash and version of a snapshot.
+     *
+     * @param data The snapshot, JSON, MessagePack or compressed.
+     * @param length The snapshot size.
+     * @param cursor Receives the decoded members.
+     * @return False if the snapshot could not be decoded.
+     */
+    static bool peekSnapshot(const uint8_t *data, size_t length, JsonDocument &cursor);
+
+    /**
+     * @brief Decodes the rest of a snapshot given to restoreStateLazy(); a no-op otherwise.
+     *
+     * A snapshot that fails to decode stops the execution: run() reports
+     * INVALID_STATE, and setVariable(), saveState(), fork() and checkpoints
+     * fail, until it is set up or restored again.
+     *
+     * @return False if the snapshot failed to decode, now or at an earlier call.
+     */
+    bool hydrate();
+
+    /**
+     * @brief Returns false while a lazily restored execution has not decoded its variables.
+     */
+    bool isHydrated() const;
+
+    /**
+     * @brief Restores a snapshot written by saveStateBinary(), read from a stream.
+     *
+     * Same as restoreState(Stream &), which accepts every snapshot format.
+     */
+    bool restoreStateBinary(Stream &source);
+
+    /**
+     * @brief Restores a JSON, MessagePack or LzEncoder-compressed snapshot from a stream.
+     *
+     * The format is detected from the first byte; compressed snapshots are
+     * decompressed while they are parsed, never whole in RAM.
+     *
+     * @param source The stream positioned at the snapshot, e.g. a flash file.
+     * @return True if the state was restored successfully; otherwise, false.
+     */
+    bool restoreState(Stream &source);
 };
 
 #endif //STEP_FUNCTION_H
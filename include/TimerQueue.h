@@ -0,0 +1,77 @@
+#ifndef TIMER_QUEUE_H
+#define TIMER_QUEUE_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+ * @class TimerQueue
+ * @brief A fixed-capacity binary min-heap of millis() deadlines.
+ *
+ * Deadlines are compared by their signed difference, so ordering stays
+ * correct across millis() rollover as long as all pending deadlines lie
+ * within about 24 days of each other.
+ */
+class TimerQueue {
+public:
+    /**
+     * @brief One pending deadline and the slot it belongs to.
+     */
+    struct Entry {
+        unsigned long deadline;
+        uint32_t id;
+    };
+
+    explicit TimerQueue(size_t capacity);
+
+    ~TimerQueue();
+
+    TimerQueue(const TimerQueue &) = delete;
+
+    TimerQueue &operator=(const TimerQueue &) = delete;
+
+    /**
+     * @brief Adds a deadline.
+     *
+     * @return False if the queue is full.
+     */
+    bool push(unsigned long deadline, uint32_t id);
+
+    /**
+     * @brief Returns the earliest deadline; the queue must not be empty.
+     */
+    const Entry &top() const;
+
+    /**
+     * @brief Removes the earliest deadline.
+     */
+    void pop();
+
+    /**
+     * @brief Moves the pending deadline of id; a linear search, meant for rare changes.
+     *
+     * @return False if id has no pending deadline.
+     */
+    bool reschedule(uint32_t id, unsigned long deadline);
+
+    bool empty() const;
+
+    size_t size() const;
+
+    /**
+     * @brief Returns true if deadline a falls before deadline b.
+     */
+    static bool before(unsigned long a, unsigned long b);
+
+private:
+    Entry *entries;
+    size_t capacity;
+    size_t count = 0;
+
+    /**
+     * @brief Moves the entry at index up or down until the heap order holds again.
+     */
+    void sift(size_t index);
+};
+
+#endif //TIMER_QUEUE_H
@@ -0,0 +1,105 @@
+#ifndef VARIABLE_PATH_H
+#define VARIABLE_PATH_H
+
+#include <ArduinoJson.h>
+
+class Variables;
+
+/**
+ * @class VariablePath
+ * @brief A reference path into the variable store, compiled once into a segment array.
+ *
+ * Accepted forms are `name`, `$name`, `$.name` and any of these followed by
+ * `.field`, `[index]` or `['field']` segments, e.g. `$.sensors.temp[2].value`.
+ * A lone `$` refers to the whole variable store.
+ *
+ * When resolved with a non-zero layout epoch (see Variables::setFixedLayout())
+ * the path caches the slot it found and returns it directly while the epoch
+ * stays the same.
+ */
+class VariablePath {
+public:
+    VariablePath();
+
+    ~VariablePath();
+
+    VariablePath(const VariablePath &) = delete;
+
+    VariablePath &operator=(const VariablePath &) = delete;
+
+    /**
+     * @brief Compiles a reference path.
+     *
+     * @param source The path text.
+     * @param length The number of characters of source to read.
+     * @return True if the path is well formed; otherwise, false.
+     */
+    bool compile(const char *source, size_t length);
+
+    /**
+     * @brief Compiles a NUL-terminated reference path.
+     */
+    bool compile(const char *source);
+
+    /**
+     * @brief Compiles a single top-level key taken verbatim, without path syntax.
+     *
+     * @param key The variable name.
+     */
+    void compileKey(const char *key);
+
+    /**
+     * @brief Walks the compiled segments starting at root.
+     *
+     * @param root The variable store.
+     * @return The referenced value, or a null variant when any segment is missing.
+     */
+    JsonVariantConst resolve(JsonVariantConst root) const;
+
+    /**
+     * @brief Walks the compiled segments, or returns the slot cached for the same layout epoch.
+     *
+     * @param root The variable store.
+     * @param epoch The store's layout epoch, or 0 to bypass the cache.
+     * @return The referenced value, or a null variant when any segment is missing.
+     */
+    JsonVariantConst resolve(JsonVariantConst root, uint32_t epoch) const;
+
+    /**
+     * @brief Resolves the path in a variable store, looking the first key up through its shared layers.
+     *
+     * @param variables The variable store.
+     * @param epoch The store's layout epoch, or 0 to bypass the cache.
+     * @return The referenced value, or a null variant when any segment is missing.
+     */
+    JsonVariantConst resolve(const Variables &variables, uint32_t epoch) const;
+
+    /**
+     * @brief Returns the number of segments, 0 for the root path `$`.
+     */
+    size_t size() const;
+
+private:
+    /**
+     * @brief One step of the path: an object key, or an array index when key is nullptr.
+     */
+    struct Segment {
+        const char *key;
+        size_t index;
+    };
+
+    Segment *segments = nullptr; /**< Compiled segments. */
+    size_t segmentCount = 0; /**< Number of entries in segments. */
+    char *keys = nullptr; /**< Backing storage for the segment keys. */
+    mutable JsonVariantConst cached; /**< Slot found by the last cached resolution. */
+    mutable uint32_t cachedEpoch = 0; /**< Layout epoch cached was resolved in; 0 if none. */
+
+    void clear();
+
+    /**
+     * @brief Walks the segments from index first onwards, starting at node.
+     */
+    JsonVariantConst walk(JsonVariantConst node, size_t first) const;
+};
+
+#endif //VARIABLE_PATH_H
@@ -0,0 +1,328 @@
+#ifndef VARIABLES_H
+#define VARIABLES_H
+
+#include <ArduinoJson.h>
+#include "BlobPool.h"
+
+class VariablePath;
+
+/**
+ * @brief A frozen layer of variables shared copy-on-write by forked executions.
+ *
+ * Layers are created by Variables::fork() and never modified afterwards.
+ * Each layer holds a reference to the older layer below it.
+ */
+struct VariableScope {
+    JsonDocument doc; /**< The variables frozen into this layer. */
+    VariableScope *parent = nullptr; /**< Older layer consulted when a name is missing here. */
+    size_t references = 1; /**< Executions and layers using this layer. */
+};
+
+/**
+ * @class Variables
+ * @brief The variable store of one execution, as seen by compiled paths and expressions.
+ *
+ * Wraps the execution's JSON document and an epoch that identifies its
+ * current layout. When the store is declared fixed-layout, a VariablePath
+ * remembers the slot it resolved to and reuses it for as long as the epoch
+ * is unchanged, so repeated reads of a deep path cost no key scans at all.
+ *
+ * After fork(), the execution's own document only holds the top-level
+ * variables written since; every other name falls through to the shared
+ * VariableScope layers below it. A bare `$` path sees only the own document.
+ *
+ * Below everything sits an optional read-only shared scope (see
+ * setSharedScope()), typically device configuration used by every
+ * execution; its members are read in place and never copied.
+ *
+ * A top-level variable can also hold a binary blob from a BlobPool (see
+ * setBlob()). The variable stores only the blob's handle, as the object
+ * `{"$blob": handle}`, and keeps a reference on it that is dropped when the
+ * variable is overwritten or the store is cleared.
+ */
+class Variables {
+public:
+    /**
+     * @brief Wraps a variable document.
+     *
+     * @param document The document holding the variables; it must outlive this object.
+     */
+    explicit Variables(JsonDocument &document);
+
+    ~Variables();
+
+    Variables(const Variables &) = delete;
+
+    Variables &operator=(const Variables &) = delete;
+
+    /**
+     * @brief Returns a top-level variable, looking through the shared layers when this execution has not written it.
+     *
+     * @param name The variable name.
+     * @return The value, or a null variant if no layer has it.
+     */
+    JsonVariantConst get(const char *name) const;
+
+    /**
+     * @brief Writes a top-level variable into this execution's own document.
+     *
+     * @param name The variable name.
+     * @param value The value to copy.
+     */
+    template<typename T>
+    void set(const char *name, const T &value) {
+        prepareWrite(name);
+        bool container = isContainer(doc[name]);
+        doc[name] = value;
+        retainBlob(doc[name]);
+        noteWrite(doc[name]);
+        if (container || isContainer(doc[name])) {
+            invalidate();
+        }
+    }
+
+    /**
+     * @brief Returns a top-level variable for in-place modification.
+     *
+     * A variable that only exists in a shared layer is copied into this
+     * execution's document first; only that one variable is duplicated.
+     * Cached slots are discarded, as the caller may restructure the value.
+     *
+     * @param name The variable name.
+     */
+    JsonVariant edit(const char *name);
+
+    /**
+     * @brief Must be called before writing the top-level member name of document() directly.
+     *
+     * Discards cached slots when the write would hide a value in a shared layer,
+     * and releases the blob the variable held, if any.
+     */
+    void prepareWrite(const char *name);
+
+    /**
+     * @brief Sets the pool blob variables are created from and resolved against.
+     *
+     * @param pool The pool, or nullptr; it must outlive this store.
+     */
+    void setBlobPool(BlobPool *pool);
+
+    /**
+     * @brief Returns the pool set by setBlobPool(), or nullptr.
+     */
+    BlobPool *blobPool() const;
+
+    /**
+     * @brief Stores a blob in a top-level variable, by handle.
+     *
+     * @code
+     * uint8_t *frame;
+     * uint32_t handle = pool.allocate(length, frame);
+     * camera.read(frame, length);
+     * variables.setBlob("frame", handle);
+     * @endcode
+     *
+     * @param name The variable name.
+     * @param handle A handle from the blob pool; the caller's reference passes to the variable.
+     * @return False if no pool is set or handle is stale; the reference is then dropped.
+     */
+    bool setBlob(const char *name, uint32_t handle);
+
+    /**
+     * @brief Reads a blob variable, without copying its bytes.
+     *
+     * Besides pool blobs, this accepts MessagePack binary values stored in the
+     * document itself, e.g. by restoreStateBinary() when no pool is set.
+     *
+     * @param name The variable name.
+     * @param blob Receives the data view, valid until the variable is overwritten.
+     * @return False if the variable does not hold a blob.
+     */
+    bool getBlob(const char *name, Blob &blob) const;
+
+    /**
+     * @brief Reads a blob from any value, as getBlob() does for a variable.
+     */
+    bool blobOf(JsonVariantConst value, Blob &blob) const;
+
+    /**
+     * @brief Returns the pool handle held by a value, or 0 if it is not a blob variable.
+     */
+    static uint32_t blobHandle(JsonVariantConst value);
+
+    /**
+     * @brief Takes a reference on the blob a value names; call after copying a blob variable's value.
+     *
+     * If the blob is gone or cannot take another reference, the value is set to null.
+     */
+    void retainBlob(JsonVariant value);
+
+    /**
+     * @brief Takes a reference on every blob variable of the own document.
+     *
+     * Call after filling document() wholesale from another store of the same pool.
+     */
+    void retainBlobs();
+
+    /**
+     * @brief Sets every blob variable of the own document to null, without releasing anything.
+     *
+     * Call after filling document() from outside the engine, e.g. from
+     * execution input or a snapshot: a `{"$blob": handle}` there is not a
+     * reference this store holds, and may name another execution's blob.
+     */
+    void stripBlobs();
+
+    /**
+     * @brief Empties the store: releases its blobs, drops the shared layers and clears the own document.
+     */
+    void clear();
+
+    /**
+     * @brief Enables counting the serialized size of variable writes, for changedBytes().
+     */
+    void setChangeTracking(bool enabled);
+
+    /**
+     * @brief Adds the serialized size of a value just written to a variable to changedBytes().
+     *
+     * set(), setBlob(), edit() and Assign blocks call this; code writing document() directly should
+     * too, or be bracketed by watchWrites() and noteWatchedWrites().
+     */
+    void noteWrite(JsonVariantConst value);
+
+    /**
+     * @brief Starts watching the own document for writes that bypass set(), e.g. by a Task callback.
+     *
+     * While tracking is enabled, remembers a fingerprint of every top-level
+     * member; until noteWatchedWrites(), set() and edit() leave the counting
+     * to it. A no-op while tracking is disabled.
+     */
+    void watchWrites();
+
+    /**
+     * @brief Adds every top-level member added or rewritten since watchWrites() to changedBytes().
+     *
+     * Each such member counts with its serialized size, as noteWrite() counts it.
+     */
+    void noteWatchedWrites();
+
+    /**
+     * @brief Returns the bytes written to variables since the last resetChangedBytes(), while tracking is enabled.
+     */
+    size_t changedBytes() const;
+
+    /**
+     * @brief Restarts the changedBytes() count.
+     */
+    void resetChangedBytes();
+
+    /**
+     * @brief Shares this store with child copy-on-write.
+     *
+     * This execution's own variables are moved (not copied) into a new shared
+     * layer on top of the existing ones; both stores then start with an empty
+     * own document. The child's previous variables are discarded.
+     *
+     * @param child The store of the forked execution.
+     */
+    void fork(Variables &child);
+
+    /**
+     * @brief Copies every shared variable into the own document and drops the shared layers.
+     */
+    void flatten();
+
+    /**
+     * @brief Drops the shared layers without copying them.
+     */
+    void detach();
+
+    /**
+     * @brief Sets the read-only scope consulted after all other layers.
+     *
+     * @param scope An object whose members act as top-level variables, or a
+     * null variant to remove it. It is referenced, not copied: the document
+     * holding it must outlive this store and must not change while in use.
+     */
+    void setSharedScope(JsonVariantConst scope);
+
+    /**
+     * @brief Returns true if the store reads through shared layers.
+     */
+    bool isLayered() const;
+
+    /**
+     * @brief Copies the merged view of all layers into target.
+     */
+    void merge(JsonVariant target) const;
+
+    /**
+     * @brief Resolves a compiled path, reusing the cached slot when the layout allows it.
+     *
+     * @param path The compiled path.
+     * @return The referenced value, or a null variant if the path does not exist.
+     */
+    JsonVariantConst resolve(const VariablePath &path) const;
+
+    /**
+     * @brief Returns the underlying document for writing.
+     */
+    JsonDocument &document();
+
+    /**
+     * @brief Returns the underlying document for reading.
+     */
+    JsonVariantConst root() const;
+
+    /**
+     * @brief Declares whether the layout of the store is fixed.
+     *
+     * In a fixed-layout store, Task callbacks only overwrite scalar values:
+     * they never remove members, and never replace an object or array with a
+     * different value. Resolved slots are then cached across run() calls.
+     *
+     * @param fixed True to enable slot caching.
+     */
+    void setFixedLayout(bool fixed);
+
+    /**
+     * @brief Returns true if slot caching is enabled.
+     */
+    bool isFixedLayout() const;
+
+    /**
+     * @brief Discards every cached slot, e.g. after the document was replaced.
+     */
+    void invalidate();
+
+    /**
+     * @brief Returns the identifier of the current layout; 0 while caching is disabled.
+     */
+    uint32_t epoch() const;
+
+private:
+    JsonDocument &doc; /**< The execution's variables. */
+    VariableScope *base = nullptr; /**< Shared layers below doc, or nullptr. */
+    JsonVariantConst shared; /**< Read-only scope below every layer; null if none. */
+    BlobPool *blobs = nullptr; /**< Pool holding the blobs named by blob variables. */
+    uint32_t currentEpoch; /**< Layout identifier, unique across all stores. */
+    bool fixedLayout = false; /**< Whether cached slots may be reused. */
+    bool trackChanges = false; /**< Whether writes are added to changed. */
+    size_t changed = 0; /**< Serialized bytes written since the count was reset. */
+    bool watching = false; /**< Between watchWrites() and noteWatchedWrites(). */
+    uint32_t *fingerprints = nullptr; /**< Key and value hash of each member, as watchWrites() found them. */
+    size_t fingerprintCount = 0; /**< Members fingerprinted. */
+    size_t fingerprintCapacity = 0; /**< Members fingerprints has room for. */
+
+    static uint32_t nextEpoch; /**< Source of unique layout identifiers. */
+
+    static bool isContainer(JsonVariantConst value);
+
+    /**
+     * @brief Drops the reference of every blob variable in a document.
+     */
+    void releaseBlobs(JsonVariantConst variables);
+};
+
+#endif //VARIABLES_H
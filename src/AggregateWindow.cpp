@@ -0,0 +1,287 @@
+#include "AggregateWindow.h"
+#include <string.h>
+
+#if defined(__SSE__) || defined(_M_X64)
+#include <xmmintrin.h>
+#define AGGREGATE_SSE
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#define AGGREGATE_NEON
+#endif
+
+#define AGGREGATE_DEFAULT_CAPACITY 32
+
+bool AggregateDefinition::compile(JsonObjectConst definition) {
+    JsonObjectConst window = definition["Window"];
+    if (window["Count"].is<unsigned long>()) {
+        capacity = window["Count"].as<unsigned long>();
+        millis = 0;
+    } else if (window["Millis"].is<unsigned long>()) {
+        millis = window["Millis"].as<unsigned long>();
+        capacity = window["Capacity"].is<unsigned long>() ? window["Capacity"].as<unsigned long>()
+                                                          : AGGREGATE_DEFAULT_CAPACITY;
+    } else {
+        return false;
+    }
+    if (capacity == 0) {
+        return false;
+    }
+
+    percentileCount = 0;
+    for (JsonVariantConst percent: definition["Percentiles"].as<JsonArrayConst>()) {
+        if (percentileCount == AGGREGATE_MAX_PERCENTILES || !percent.is<unsigned int>() ||
+            percent.as<unsigned int>() > 100) {
+            return false;
+        }
+        percentiles[percentileCount++] = static_cast<uint8_t>(percent.as<unsigned int>());
+    }
+
+    // Statistics land in a single top-level variable: "$.name" or "name"
+    const char *path = definition["ResultPath"].as<const char *>();
+    if (!path) {
+        return false;
+    }
+    if (strncmp(path, "$.", 2) == 0) {
+        path += 2;
+    }
+    size_t length = strlen(path);
+    if (length == 0 || length >= sizeof(result) || strpbrk(path, ".[$")) {
+        return false;
+    }
+    memcpy(result, path, length + 1);
+    return true;
+}
+
+/**
+ * @brief Folds a contiguous run of samples into min, max and sum.
+ */
+static void reduce(const float *values, size_t length, float &min, float &max, float &sum) {
+    size_t i = 0;
+#if defined(AGGREGATE_SSE)
+    if (length >= 4) {
+        __m128 lo = _mm_set1_ps(min);
+        __m128 hi = _mm_set1_ps(max);
+        __m128 total = _mm_setzero_ps();
+        for (; i + 4 <= length; i += 4) {
+            __m128 x = _mm_loadu_ps(values + i);
+            lo = _mm_min_ps(lo, x);
+            hi = _mm_max_ps(hi, x);
+            total = _mm_add_ps(total, x);
+        }
+        float lanes[4];
+        _mm_storeu_ps(lanes, lo);
+        for (float lane: lanes) min = lane < min ? lane : min;
+        _mm_storeu_ps(lanes, hi);
+        for (float lane: lanes) max = lane > max ? lane : max;
+        _mm_storeu_ps(lanes, total);
+        sum += (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+    }
+#elif defined(AGGREGATE_NEON)
+    if (length >= 4) {
+        float32x4_t lo = vdupq_n_f32(min);
+        float32x4_t hi = vdupq_n_f32(max);
+        float32x4_t total = vdupq_n_f32(0);
+        for (; i + 4 <= length; i += 4) {
+            float32x4_t x = vld1q_f32(values + i);
+            lo = vminq_f32(lo, x);
+            hi = vmaxq_f32(hi, x);
+            total = vaddq_f32(total, x);
+        }
+        float lanes[4];
+        vst1q_f32(lanes, lo);
+        for (float lane: lanes) min = lane < min ? lane : min;
+        vst1q_f32(lanes, hi);
+        for (float lane: lanes) max = lane > max ? lane : max;
+        vst1q_f32(lanes, total);
+        sum += (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+    }
+#endif
+    for (; i < length; i++) {
+        float x = values[i];
+        min = x < min ? x : min;
+        max = x > max ? x : max;
+        sum += x;
+    }
+}
+
+/**
+ * @brief Returns the sum of squared deviations from mean over a contiguous run of samples.
+ */
+static float deviation(const float *values, size_t length, float mean) {
+    size_t i = 0;
+    float sum = 0;
+#if defined(AGGREGATE_SSE)
+    if (length >= 4) {
+        __m128 center = _mm_set1_ps(mean);
+        __m128 total = _mm_setzero_ps();
+        for (; i + 4 <= length; i += 4) {
+            __m128 d = _mm_sub_ps(_mm_loadu_ps(values + i), center);
+            total = _mm_add_ps(total, _mm_mul_ps(d, d));
+        }
+        float lanes[4];
+        _mm_storeu_ps(lanes, total);
+        sum = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+    }
+#elif defined(AGGREGATE_NEON)
+    if (length >= 4) {
+        float32x4_t center = vdupq_n_f32(mean);
+        float32x4_t total = vdupq_n_f32(0);
+        for (; i + 4 <= length; i += 4) {
+            float32x4_t d = vsubq_f32(vld1q_f32(values + i), center);
+            total = vmlaq_f32(total, d, d);
+        }
+        float lanes[4];
+        vst1q_f32(lanes, total);
+        sum = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+    }
+#endif
+    for (; i < length; i++) {
+        float d = values[i] - mean;
+        sum += d * d;
+    }
+    return sum;
+}
+
+AggregateWindow::AggregateWindow(const AggregateDefinition &definition)
+    : definition(definition),
+      values(new float[definition.capacity]),
+      times(definition.millis > 0 ? new unsigned long[definition.capacity] : nullptr),
+      scratch(definition.percentileCount > 0 ? new float[definition.capacity] : nullptr) {
+}
+
+AggregateWindow::~AggregateWindow() {
+    delete[] values;
+    delete[] times;
+    delete[] scratch;
+}
+
+void AggregateWindow::add(float value, unsigned long now) {
+    size_t slot = head + count;
+    if (slot >= definition.capacity) {
+        slot -= definition.capacity;
+    }
+    values[slot] = value;
+    if (times) {
+        times[slot] = now;
+    }
+    if (count < definition.capacity) {
+        count++;
+    } else if (++head == definition.capacity) {
+        head = 0;
+    }
+}
+
+void AggregateWindow::expire(unsigned long now) {
+    if (!times) {
+        return;
+    }
+    // Unsigned subtraction keeps the age correct across millis() rollover
+    while (count > 0 && now - times[head] > definition.millis) {
+        if (++head == definition.capacity) {
+            head = 0;
+        }
+        count--;
+    }
+}
+
+void AggregateWindow::summarize(Statistics &statistics) const {
+    statistics = Statistics();
+    if (count == 0) {
+        return;
+    }
+
+    // The live samples are at most two contiguous runs of the ring
+    size_t first = count < definition.capacity - head ? count : definition.capacity - head;
+    size_t second = count - first;
+
+    float min = values[head];
+    float max = values[head];
+    float sum = 0;
+    reduce(values + head, first, min, max, sum);
+    reduce(values, second, min, max, sum);
+
+    float mean = sum / static_cast<float>(count);
+    float squares = deviation(values + head, first, mean) + deviation(values, second, mean);
+
+    statistics.count = count;
+    statistics.min = min;
+    statistics.max = max;
+    statistics.mean = mean;
+    statistics.variance = squares / static_cast<float>(count);
+}
+
+float AggregateWindow::percentile(uint8_t percent) const {
+    if (count == 0 || !scratch) {
+        return 0;
+    }
+
+    size_t first = count < definition.capacity - head ? count : definition.capacity - head;
+    memcpy(scratch, values + head, first * sizeof(float));
+    memcpy(scratch + first, values, (count - first) * sizeof(float));
+
+    // Nearest rank: the smallest sample with at least percent% of samples at or below it
+    size_t rank = (static_cast<size_t>(percent) * count + 99) / 100;
+    size_t k = rank > 0 ? rank - 1 : 0;
+
+    // Wirth's selection, O(n) on average; leaves the k-th smallest sample at scratch[k]
+    long left = 0;
+    long right = static_cast<long>(count) - 1;
+    long target = static_cast<long>(k);
+    while (left < right) {
+        float pivot = scratch[target];
+        long i = left;
+        long j = right;
+        do {
+            while (scratch[i] < pivot) i++;
+            while (pivot < scratch[j]) j--;
+            if (i <= j) {
+                float swap = scratch[i];
+                scratch[i] = scratch[j];
+                scratch[j] = swap;
+                i++;
+                j--;
+            }
+        } while (i <= j);
+        if (j < target) left = i;
+        if (target < i) right = j;
+    }
+    return scratch[k];
+}
+
+void AggregateWindow::copyFrom(const AggregateWindow &other) {
+    memcpy(values, other.values, definition.capacity * sizeof(float));
+    if (times) {
+        memcpy(times, other.times, definition.capacity * sizeof(unsigned long));
+    }
+    head = other.head;
+    count = other.count;
+}
+
+void AggregateWindow::save(JsonObject target) const {
+    JsonArray samples = target["Values"].to<JsonArray>();
+    JsonArray stamps;
+    if (times) {
+        stamps = target["Times"].to<JsonArray>();
+    }
+    for (size_t i = 0; i < count; i++) {
+        size_t slot = head + i;
+        if (slot >= definition.capacity) {
+            slot -= definition.capacity;
+        }
+        samples.add(values[slot]);
+        if (times) {
+            stamps.add(times[slot]);
+        }
+    }
+}
+
+void AggregateWindow::restore(JsonObjectConst source) {
+    head = 0;
+    count = 0;
+    JsonArrayConst samples = source["Values"];
+    JsonArrayConst stamps = source["Times"];
+    size_t index = 0;
+    for (JsonVariantConst sample: samples) {
+        add(sample.as<float>(), stamps[index++].as<unsigned long>());
+    }
+}
@@ -0,0 +1,167 @@
+#include "Assignment.h"
+#include <string.h>
+#include <math.h>
+
+Assignment::Assignment() = default;
+
+Assignment::~Assignment() {
+    clear();
+}
+
+void Assignment::clear() {
+    for (size_t i = 0; i < targetCount; i++) {
+        delete targets[i].expression;
+    }
+    delete[] targets;
+    delete[] names;
+    targets = nullptr;
+    names = nullptr;
+    targetCount = 0;
+}
+
+bool Assignment::compile(JsonObjectConst assign) {
+    clear();
+
+    size_t count = assign.size();
+    if (count == 0) {
+        return true;
+    }
+
+    size_t nameBytes = 0;
+    for (JsonPairConst kv: assign) {
+        nameBytes += strlen(kv.key().c_str()) + 1;
+    }
+
+    targets = new Target[count];
+    names = new char[nameBytes];
+    char *out = names;
+
+    for (JsonPairConst kv: assign) {
+        Target &target = targets[targetCount++];
+        const char *key = kv.key().c_str();
+        size_t keyLength = strlen(key);
+
+        // JSONPath style: "name.$": "$.path"
+        bool pathValue = keyLength > 2 && strcmp(key + keyLength - 2, ".$") == 0;
+        if (pathValue) {
+            keyLength -= 2;
+        }
+        memcpy(out, key, keyLength);
+        out[keyLength] = '\0';
+        target.name = out;
+        out += keyLength + 1;
+
+        target.expression = nullptr;
+        target.literal = kv.value();
+
+        const char *text = kv.value().as<const char *>();
+        const char *body;
+        size_t length;
+        if (pathValue && text) {
+            body = text;
+            length = strlen(text);
+        } else if (!Expression::unwrap(text, body, length)) {
+            continue;
+        }
+
+        target.expression = new Expression();
+        if (!target.expression->compile(body, length)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief Writes an evaluated value into a document member.
+ *
+ * Integral numbers are stored as integers so that they read back as such.
+ */
+template<typename TDestination>
+static void store(TDestination destination, const ExpressionValue &value) {
+    switch (value.type) {
+        case ExpressionValue::BOOLEAN:
+            destination = value.boolean;
+            break;
+        case ExpressionValue::NUMBER:
+            if (value.number == floor(value.number) && fabs(value.number) < 2147483648.0) {
+                destination = static_cast<long>(value.number);
+            } else {
+                destination = value.number;
+            }
+            break;
+        case ExpressionValue::STRING:
+            destination = value.string;
+            break;
+        case ExpressionValue::REFERENCE:
+            destination = value.reference;
+            break;
+        default:
+            destination = nullptr;
+            break;
+    }
+}
+
+/**
+ * @brief Reports whether overwriting a member may free or create child slots.
+ */
+static bool isContainer(JsonVariantConst value) {
+    return value.is<JsonObjectConst>() || value.is<JsonArrayConst>();
+}
+
+bool Assignment::apply(Variables &variables) const {
+    JsonDocument &document = variables.document();
+    bool succeeded = true;
+    bool layoutChanged = false;
+
+    if (targetCount == 1 && !isContainer(targets[0].literal)) {
+        // A single scalar cannot observe its own write; skip the staging copy
+        const Target &target = targets[0];
+        ExpressionValue value;
+        if (target.expression && !target.expression->evaluate(variables, value)) {
+            return false;
+        }
+        if (!target.expression || value.type != ExpressionValue::REFERENCE) {
+            variables.prepareWrite(target.name);
+            if (isContainer(document[target.name])) {
+                variables.invalidate();
+            }
+            if (target.expression) {
+                store(document[target.name], value);
+            } else {
+                document[target.name] = target.literal;
+            }
+            variables.retainBlob(document[target.name]);
+            variables.noteWrite(document[target.name]);
+            return true;
+        }
+    }
+
+    // Evaluate everything against the old values before writing anything back
+    JsonDocument staged;
+    for (size_t i = 0; i < targetCount; i++) {
+        const Target &target = targets[i];
+        if (!target.expression) {
+            staged[target.name] = target.literal;
+            continue;
+        }
+        ExpressionValue value;
+        if (!target.expression->evaluate(variables, value)) {
+            succeeded = false;
+            continue;
+        }
+        store(staged[target.name], value);
+    }
+
+    for (JsonPairConst kv: staged.as<JsonObjectConst>()) {
+        variables.prepareWrite(kv.key().c_str());
+        layoutChanged = layoutChanged || isContainer(kv.value()) || isContainer(document[kv.key()]);
+        document[kv.key()] = kv.value();
+        variables.retainBlob(document[kv.key()]);
+        variables.noteWrite(kv.value());
+    }
+    if (layoutChanged) {
+        variables.invalidate();
+    }
+    return succeeded;
+}
@@ -0,0 +1,265 @@
+#include "AsyncSnapshotStore.h"
+#include <string.h>
+
+AsyncSnapshotStore::Capture::Capture(AsyncSnapshotStore &store) : store(store) {
+}
+
+size_t AsyncSnapshotStore::Capture::write(uint8_t value) {
+    return write(&value, 1);
+}
+
+size_t AsyncSnapshotStore::Capture::write(const uint8_t *data, size_t length) {
+    Buffer *buffer = store.capturing;
+    if (!buffer || store.overflowed) {
+        return 0;
+    }
+    if (length > store.capacity - buffer->length) {
+        store.overflowed = true;
+        return 0;
+    }
+    memcpy(buffer->data + buffer->length, data, length);
+    buffer->length += length;
+    return length;
+}
+
+AsyncSnapshotStore::AsyncSnapshotStore(SnapshotStore &target, size_t capacity, size_t buffers)
+    : target(target),
+      capacity(capacity),
+      bufferCount(buffers > 0 ? buffers : 1) {
+    storage = new uint8_t[capacity * bufferCount];
+    this->buffers = new Buffer[bufferCount];
+    for (size_t i = 0; i < bufferCount; i++) {
+        this->buffers[i] = Buffer{storage + i * capacity, 0, 0, 0, BUFFER_FREE};
+    }
+}
+
+AsyncSnapshotStore::~AsyncSnapshotStore() {
+    stopBackground();
+    delete[] buffers;
+    delete[] storage;
+}
+
+void AsyncSnapshotStore::enter() const {
+#if defined(ESP32)
+    taskENTER_CRITICAL(&lock);
+#elif !defined(ARDUINO)
+    lock.lock();
+#endif
+}
+
+void AsyncSnapshotStore::leave() const {
+#if defined(ESP32)
+    taskEXIT_CRITICAL(&lock);
+#elif !defined(ARDUINO)
+    lock.unlock();
+#endif
+}
+
+Print &AsyncSnapshotStore::open() {
+    abort();
+    enter();
+    // A free buffer, else the oldest queued one: the new snapshot makes it obsolete anyway
+    Buffer *chosen = nullptr;
+    for (size_t i = 0; i < bufferCount; i++) {
+        Buffer &buffer = buffers[i];
+        if (buffer.state == BUFFER_FREE) {
+            chosen = &buffer;
+            break;
+        }
+        if (buffer.state == BUFFER_QUEUED && (!chosen || static_cast<int32_t>(buffer.order - chosen->order) < 0)) {
+            chosen = &buffer;
+        }
+    }
+    if (chosen) {
+        if (chosen->state == BUFFER_QUEUED) {
+            counters.superseded++;
+        }
+        chosen->state = BUFFER_CAPTURING;
+        chosen->length = 0;
+        chosen->offset = 0;
+    }
+    leave();
+
+    capturing = chosen;
+    overflowed = false;
+    return capture;
+}
+
+bool AsyncSnapshotStore::commit() {
+    Buffer *captured = capturing;
+    capturing = nullptr;
+    if (!captured || overflowed) {
+        counters.rejected++;
+        if (captured) {
+            enter();
+            captured->state = BUFFER_FREE;
+            leave();
+        }
+        return false;
+    }
+
+    enter();
+    captured->order = nextOrder++;
+    captured->state = BUFFER_QUEUED;
+    // Older snapshots still waiting are superseded by this one
+    for (size_t i = 0; i < bufferCount; i++) {
+        if (&buffers[i] != captured && buffers[i].state == BUFFER_QUEUED) {
+            buffers[i].state = BUFFER_FREE;
+            counters.superseded++;
+        }
+    }
+    counters.captured++;
+    leave();
+    return true;
+}
+
+void AsyncSnapshotStore::abort() {
+    if (capturing) {
+        enter();
+        capturing->state = BUFFER_FREE;
+        leave();
+        capturing = nullptr;
+    }
+}
+
+bool AsyncSnapshotStore::poll(size_t budget) {
+    enter();
+    Buffer *buffer = nullptr;
+    for (size_t i = 0; i < bufferCount; i++) {
+        if (buffers[i].state == BUFFER_WRITING) {
+            buffer = &buffers[i];
+            break;
+        }
+    }
+    bool starting = false;
+    if (!buffer) {
+        for (size_t i = 0; i < bufferCount; i++) {
+            if (buffers[i].state == BUFFER_QUEUED &&
+                (!buffer || static_cast<int32_t>(buffers[i].order - buffer->order) < 0)) {
+                buffer = &buffers[i];
+            }
+        }
+        if (buffer) {
+            buffer->state = BUFFER_WRITING;
+            starting = true;
+        }
+    }
+    leave();
+    if (!buffer) {
+        return false;
+    }
+
+    // The writer owns the buffer from here on; the slow I/O runs without the lock
+    if (starting) {
+        output = &target.open();
+    }
+    size_t length = buffer->length - buffer->offset < budget ? buffer->length - buffer->offset : budget;
+    if (length > 0) {
+        output->write(buffer->data + buffer->offset, length);
+        buffer->offset += length;
+    }
+    if (buffer->offset < buffer->length) {
+        return true;
+    }
+
+    bool committed = target.commit();
+    enter();
+    buffer->state = BUFFER_FREE;
+    if (committed) {
+        counters.written++;
+    } else {
+        counters.failed++;
+    }
+    leave();
+    if (completion) {
+        completion(committed, completionContext);
+    }
+    return pending() > 0;
+}
+
+void AsyncSnapshotStore::drain() {
+    while (poll(capacity)) {
+    }
+}
+
+size_t AsyncSnapshotStore::pending() const {
+    size_t count = 0;
+    enter();
+    for (size_t i = 0; i < bufferCount; i++) {
+        if (buffers[i].state == BUFFER_QUEUED || buffers[i].state == BUFFER_WRITING) {
+            count++;
+        }
+    }
+    leave();
+    return count;
+}
+
+void AsyncSnapshotStore::onComplete(CompletionCallback callback, void *context) {
+    completion = callback;
+    completionContext = context;
+}
+
+const AsyncSnapshotStats &AsyncSnapshotStore::stats() const {
+    return counters;
+}
+
+void AsyncSnapshotStore::backgroundLoop() {
+#if defined(ASYNC_SNAPSHOT_THREADS)
+    while (running) {
+        if (!poll(backgroundBudget)) {
+            // Nothing queued: give the loop the CPU until the next capture
+#if defined(ESP32)
+            vTaskDelay(1);
+#elif !defined(ARDUINO)
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+#endif
+        }
+    }
+#endif
+}
+
+#if defined(ESP32)
+void AsyncSnapshotStore::backgroundTask(void *store) {
+    AsyncSnapshotStore *self = static_cast<AsyncSnapshotStore *>(store);
+    self->backgroundLoop();
+    self->worker = nullptr;
+    vTaskDelete(nullptr);
+}
+#endif
+
+bool AsyncSnapshotStore::startBackground(size_t budget) {
+#if defined(ASYNC_SNAPSHOT_THREADS)
+    if (running) {
+        return false;
+    }
+    backgroundBudget = budget > 0 ? budget : 1;
+    running = true;
+#if defined(ESP32)
+    if (xTaskCreate(backgroundTask, "snapshot", 4096, this, 1, &worker) != pdPASS) {
+        running = false;
+        return false;
+    }
+#else
+    worker = std::thread(&AsyncSnapshotStore::backgroundLoop, this);
+#endif
+    return true;
+#else
+    (void) budget;
+    return false;
+#endif
+}
+
+void AsyncSnapshotStore::stopBackground() {
+#if defined(ESP32)
+    running = false;
+    // The task clears worker and deletes itself after its current slice
+    while (worker) {
+        vTaskDelay(1);
+    }
+#elif !defined(ARDUINO)
+    running = false;
+    if (worker.joinable()) {
+        worker.join();
+    }
+#endif
+}
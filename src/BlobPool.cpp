@@ -0,0 +1,116 @@
+#include "BlobPool.h"
+#include <string.h>
+
+BlobPool::BlobPool(size_t blockSize, size_t blockCount)
+    : size(blockSize),
+      count(blockCount > 0xFFFF ? 0xFFFF : blockCount) {
+    storage = new uint8_t[size * count];
+    slots = new Slot[count]();
+}
+
+BlobPool::~BlobPool() {
+    delete[] storage;
+    delete[] slots;
+}
+
+// A handle is the slot's generation in the high half and its index + 1 in the low half, so 0 is never valid
+uint32_t BlobPool::handleOf(size_t index) const {
+    return (static_cast<uint32_t>(slots[index].generation) << 16) | static_cast<uint32_t>(index + 1);
+}
+
+BlobPool::Slot *BlobPool::find(uint32_t handle) const {
+    size_t index = (handle & 0xFFFF);
+    if (index == 0 || index > count) {
+        return nullptr;
+    }
+    Slot *slot = &slots[index - 1];
+    if (slot->references == 0 || slot->generation != (handle >> 16)) {
+        return nullptr;
+    }
+    return slot;
+}
+
+size_t BlobPool::claim() {
+    if (used == count) {
+        return count;
+    }
+    for (size_t i = 0; i < count; i++) {
+        if (slots[i].references == 0) {
+            slots[i].references = 1;
+            slots[i].generation++;
+            used++;
+            return i;
+        }
+    }
+    return count;
+}
+
+uint32_t BlobPool::allocate(size_t length, uint8_t *&data) {
+    if (length > size) {
+        return 0;
+    }
+    size_t index = claim();
+    if (index == count) {
+        return 0;
+    }
+    data = storage + index * size;
+    slots[index].blob.data = data;
+    slots[index].blob.length = length;
+    slots[index].blob.owned = true;
+    return handleOf(index);
+}
+
+uint32_t BlobPool::copy(const uint8_t *data, size_t length) {
+    uint8_t *block;
+    uint32_t handle = allocate(length, block);
+    if (handle != 0 && length > 0) {
+        memcpy(block, data, length);
+    }
+    return handle;
+}
+
+uint32_t BlobPool::wrap(const uint8_t *data, size_t length) {
+    size_t index = claim();
+    if (index == count) {
+        return 0;
+    }
+    slots[index].blob.data = data;
+    slots[index].blob.length = length;
+    slots[index].blob.owned = false;
+    return handleOf(index);
+}
+
+bool BlobPool::get(uint32_t handle, Blob &blob) const {
+    Slot *slot = find(handle);
+    if (!slot) {
+        return false;
+    }
+    blob = slot->blob;
+    return true;
+}
+
+bool BlobPool::retain(uint32_t handle) {
+    Slot *slot = find(handle);
+    // A saturated count would reach 0 while references remain
+    if (!slot || slot->references == 0xFFFF) {
+        return false;
+    }
+    slot->references++;
+    return true;
+}
+
+void BlobPool::release(uint32_t handle) {
+    Slot *slot = find(handle);
+    if (slot && --slot->references == 0) {
+        slot->blob = Blob();
+        used--;
+    }
+}
+
+size_t BlobPool::available() const {
+    return count - used;
+}
+
+size_t BlobPool::blockSize() const {
+    return size;
+}
@@ -0,0 +1,276 @@
+#include "CheckpointStore.h"
+#include <string.h>
+
+#define CHECKPOINT_MAGIC 0x4B434653UL /**< "SFCK" in little-endian byte order. */
+
+/**
+ * @brief Feeds bytes into a running CRC-32 (IEEE, reflected); start from 0xFFFFFFFF and invert at the end.
+ */
+static uint32_t crc32Update(uint32_t crc, const uint8_t *data, size_t length) {
+    while (length--) {
+        crc ^= *data++;
+        for (uint8_t bit = 0; bit < 8; bit++) {
+            crc = (crc >> 1) ^ (0xEDB88320UL & (0 - (crc & 1)));
+        }
+    }
+    return crc;
+}
+
+/**
+ * @brief Finishes a CRC over the payload with the header fields it protects.
+ */
+static uint32_t crc32Finish(uint32_t crc, uint32_t sequence, uint32_t length, uint32_t erases) {
+    uint32_t fields[3] = {sequence, length, erases};
+    return ~crc32Update(crc, reinterpret_cast<const uint8_t *>(fields), sizeof(fields));
+}
+
+CheckpointStore::Writer::Writer(CheckpointStore &store) : store(store) {
+}
+
+size_t CheckpointStore::Writer::write(uint8_t value) {
+    if (!store.writing || store.failed) {
+        return 0;
+    }
+    store.append(value);
+    return store.failed ? 0 : 1;
+}
+
+CheckpointStore::Reader::Reader(CheckpointStore &store) : store(store) {
+}
+
+int CheckpointStore::Reader::available() {
+    return store.found ? static_cast<int>(store.newestLength - position) : 0;
+}
+
+int CheckpointStore::Reader::peek() {
+    uint8_t value;
+    if (available() <= 0 || !store.access(store.newest, sizeof(Header) + position, &value, 1, false)) {
+        return -1;
+    }
+    return value;
+}
+
+int CheckpointStore::Reader::read() {
+    int value = peek();
+    if (value >= 0) {
+        position++;
+    }
+    return value;
+}
+
+size_t CheckpointStore::Reader::write(uint8_t) {
+    return 0;
+}
+
+CheckpointStore::CheckpointStore(FlashDevice &device, size_t firstSector, size_t sectorCount, size_t sectorsPerSlot)
+    : device(device),
+      first(firstSector),
+      sectorsPerSlot(sectorsPerSlot > 0 ? sectorsPerSlot : 1) {
+    size_t available = device.sectorCount() > firstSector ? device.sectorCount() - firstSector : 0;
+    if (sectorCount == 0 || sectorCount > available) {
+        sectorCount = available;
+    }
+    slotCount = sectorCount / this->sectorsPerSlot;
+    erases = new uint32_t[slotCount > 0 ? slotCount : 1]();
+}
+
+CheckpointStore::~CheckpointStore() {
+    delete[] erases;
+}
+
+bool CheckpointStore::access(size_t slot, size_t offset, uint8_t *data, size_t length, bool write) {
+    size_t sectorSize = device.sectorSize();
+    while (length > 0) {
+        size_t sector = first + slot * sectorsPerSlot + offset / sectorSize;
+        size_t within = offset % sectorSize;
+        size_t chunk = sectorSize - within < length ? sectorSize - within : length;
+        bool ok = write ? device.write(sector, within, data, chunk) : device.read(sector, within, data, chunk);
+        if (!ok) {
+            return false;
+        }
+        offset += chunk;
+        data += chunk;
+        length -= chunk;
+    }
+    return true;
+}
+
+bool CheckpointStore::readHeader(size_t slot, Header &header) {
+    if (!access(slot, 0, reinterpret_cast<uint8_t *>(&header), sizeof(header), false)) {
+        return false;
+    }
+    return header.magic == CHECKPOINT_MAGIC && header.length <= capacity();
+}
+
+bool CheckpointStore::verify(size_t slot, const Header &header) {
+    uint8_t chunk[CHECKPOINT_WRITE_BUFFER];
+    uint32_t running = 0xFFFFFFFFUL;
+    for (size_t done = 0; done < header.length;) {
+        size_t length = header.length - done < sizeof(chunk) ? header.length - done : sizeof(chunk);
+        if (!access(slot, sizeof(Header) + done, chunk, length, false)) {
+            return false;
+        }
+        running = crc32Update(running, chunk, length);
+        done += length;
+    }
+    return crc32Finish(running, header.sequence, header.length, header.erases) == header.crc;
+}
+
+bool CheckpointStore::begin() {
+    found = false;
+    writing = false;
+
+    // One header per slot; a header that fails the checks gets its magic cleared
+    Header *headers = new Header[slotCount > 0 ? slotCount : 1];
+    for (size_t slot = 0; slot < slotCount; slot++) {
+        if (!readHeader(slot, headers[slot])) {
+            headers[slot].magic = 0;
+        }
+        erases[slot] = headers[slot].magic == CHECKPOINT_MAGIC ? headers[slot].erases : 0;
+    }
+
+    // Only the newest candidate's payload is read; an older one only if that fails its CRC
+    for (;;) {
+        size_t best = slotCount;
+        for (size_t slot = 0; slot < slotCount; slot++) {
+            // Signed distance orders sequence numbers across wraparound
+            if (headers[slot].magic == CHECKPOINT_MAGIC &&
+                (best == slotCount || static_cast<int32_t>(headers[slot].sequence - headers[best].sequence) > 0)) {
+                best = slot;
+            }
+        }
+        if (best == slotCount) {
+            break;
+        }
+        if (verify(best, headers[best])) {
+            found = true;
+            newest = best;
+            newestSequence = headers[best].sequence;
+            newestLength = headers[best].length;
+            break;
+        }
+        headers[best].magic = 0;
+    }
+    delete[] headers;
+    return found;
+}
+
+Print &CheckpointStore::open() {
+    // With a single slot the only checkpoint would be erased before its replacement is complete
+    writing = slotCount >= 2;
+    failed = !writing;
+    target = found ? (newest + 1) % slotCount : 0;
+    written = 0;
+    buffered = 0;
+    crc = 0xFFFFFFFFUL;
+
+    for (size_t i = 0; writing && i < sectorsPerSlot; i++) {
+        if (!device.erase(first + target * sectorsPerSlot + i)) {
+            failed = true;
+        }
+    }
+    if (writing) {
+        erases[target]++;
+    }
+    return writer;
+}
+
+void CheckpointStore::append(uint8_t value) {
+    if (written == capacity()) {
+        failed = true;
+        return;
+    }
+    buffer[buffered++] = value;
+    written++;
+    if (buffered == sizeof(buffer)) {
+        flushBuffer();
+    }
+}
+
+bool CheckpointStore::flushBuffer() {
+    if (buffered == 0) {
+        return true;
+    }
+    crc = crc32Update(crc, buffer, buffered);
+    if (!access(target, sizeof(Header) + written - buffered, buffer, buffered, true)) {
+        failed = true;
+    }
+    buffered = 0;
+    return !failed;
+}
+
+bool CheckpointStore::commit() {
+    if (!writing) {
+        return false;
+    }
+    writing = false;
+    if (failed || !flushBuffer()) {
+        return false;
+    }
+
+    Header header;
+    header.magic = CHECKPOINT_MAGIC;
+    header.sequence = found ? newestSequence + 1 : 1;
+    header.length = static_cast<uint32_t>(written);
+    header.erases = erases[target];
+    header.crc = crc32Finish(crc, header.sequence, header.length, header.erases);
+
+    // The header goes last: until it is complete, the previous checkpoint stays the newest
+    if (!access(target, 0, reinterpret_cast<uint8_t *>(&header), sizeof(header), true)) {
+        return false;
+    }
+    found = true;
+    newest = target;
+    newestSequence = header.sequence;
+    newestLength = written;
+    return true;
+}
+
+void CheckpointStore::abort() {
+    writing = false;
+}
+
+Stream &CheckpointStore::reader() {
+    checkpointReader.position = 0;
+    return checkpointReader;
+}
+
+bool CheckpointStore::hasCheckpoint() const {
+    return found;
+}
+
+uint32_t CheckpointStore::sequence() const {
+    return newestSequence;
+}
+
+size_t CheckpointStore::size() const {
+    return found ? newestLength : 0;
+}
+
+size_t CheckpointStore::capacity() const {
+    return device.sectorSize() * sectorsPerSlot - sizeof(Header);
+}
+
+size_t CheckpointStore::slots() const {
+    return slotCount;
+}
+
+uint32_t CheckpointStore::eraseCount(size_t slot) const {
+    return slot < slotCount ? erases[slot] : 0;
+}
+
+uint32_t CheckpointStore::maxEraseCount() const {
+    uint32_t most = 0;
+    for (size_t slot = 0; slot < slotCount; slot++) {
+        most = erases[slot] > most ? erases[slot] : most;
+    }
+    return most;
+}
+
+unsigned long CheckpointStore::remainingCommits(uint32_t ratedCycles) const {
+    unsigned long remaining = 0;
+    for (size_t slot = 0; slot < slotCount; slot++) {
+        remaining += erases[slot] < ratedCycles ? ratedCycles - erases[slot] : 0;
+    }
+    return remaining;
+}
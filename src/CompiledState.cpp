@@ -0,0 +1,185 @@
+#include "CompiledState.h"
+#include <string.h>
+
+CompiledState::CompiledState() = default;
+
+CompiledState::~CompiledState() {
+    clear();
+}
+
+void CompiledState::clear() {
+    delete assign;
+    for (size_t i = 0; i < choiceCount; i++) {
+        delete choices[i].condition;
+        delete choices[i].assign;
+        delete choices[i].variable;
+        delete choices[i].matcher;
+    }
+    delete[] choices;
+    delete table;
+    delete matcher;
+    delete variable;
+    delete aggregate;
+    name = nullptr;
+    definition = JsonObject();
+    type = STATE_UNKNOWN;
+    assign = nullptr;
+    choices = nullptr;
+    choiceCount = 0;
+    table = nullptr;
+    matcher = nullptr;
+    variable = nullptr;
+    aggregate = nullptr;
+    period = 0;
+    sideEffects = false;
+}
+
+/**
+ * @brief Compiles an optional "Assign" member.
+ *
+ * @return False if the member exists but does not compile.
+ */
+static bool compileAssign(JsonObjectConst owner, Assignment *&assign) {
+    JsonObjectConst block = owner["Assign"];
+    if (block.isNull()) {
+        return true;
+    }
+    assign = new Assignment();
+    return assign->compile(block);
+}
+
+/**
+ * @brief Compiles an optional "Variable" member.
+ *
+ * Values starting with `$` are reference paths such as `$.sensors.temp[2].value`;
+ * anything else names a single top-level variable, as it always has.
+ *
+ * @return False if the member is a malformed reference path.
+ */
+static bool compileVariable(JsonObjectConst owner, VariablePath *&variable) {
+    const char *text = owner["Variable"].as<const char *>();
+    if (!text) {
+        return true;
+    }
+    variable = new VariablePath();
+    if (text[0] != '$') {
+        variable->compileKey(text);
+        return true;
+    }
+    return variable->compile(text);
+}
+
+bool CompiledState::compile(const char *stateName, JsonObject stateDefinition) {
+    name = stateName;
+    definition = stateDefinition;
+
+    const char *typeName = definition["Type"].as<const char *>();
+    if (!typeName) {
+        type = STATE_UNKNOWN;
+    } else if (strcmp(typeName, "Task") == 0) {
+        type = STATE_TASK;
+    } else if (strcmp(typeName, "Choice") == 0) {
+        type = STATE_CHOICE;
+    } else if (strcmp(typeName, "Wait") == 0) {
+        type = STATE_WAIT;
+    } else if (strcmp(typeName, "Pass") == 0) {
+        type = STATE_PASS;
+    } else if (strcmp(typeName, "DecisionTable") == 0) {
+        type = STATE_DECISION_TABLE;
+    } else if (strcmp(typeName, "Aggregate") == 0) {
+        type = STATE_AGGREGATE;
+    } else if (strcmp(typeName, "Debounce") == 0) {
+        type = STATE_DEBOUNCE;
+    } else if (strcmp(typeName, "Throttle") == 0) {
+        type = STATE_THROTTLE;
+    } else {
+        type = STATE_UNKNOWN;
+    }
+
+    if (!compileAssign(definition, assign)) {
+        return false;
+    }
+
+    sideEffects = type == STATE_TASK && definition["SideEffects"].as<bool>();
+
+    if (type == STATE_CHOICE) {
+        if (!compileVariable(definition, variable)) {
+            return false;
+        }
+
+        JsonArray rules = definition["Choices"];
+        choiceCount = rules.size();
+        choices = choiceCount > 0 ? new CompiledChoice[choiceCount] : nullptr;
+
+        size_t index = 0;
+        for (JsonObject rule: rules) {
+            CompiledChoice &choice = choices[index++];
+            if (!compileAssign(rule, choice.assign) || !compileVariable(rule, choice.variable)) {
+                return false;
+            }
+
+            const char *body;
+            size_t length;
+            if (Expression::unwrap(rule["Condition"].as<const char *>(), body, length)) {
+                choice.condition = new Expression();
+                if (!choice.condition->compile(body, length)) {
+                    return false;
+                }
+            }
+
+            // Patterns on the state's Variable share one automaton
+            const char *pattern = rule["StringMatches"].as<const char *>();
+            if (pattern && choice.variable) {
+                choice.matcher = new GlobMatcher();
+                size_t added = choice.matcher->add(pattern);
+                if (added == SIZE_MAX || !choice.matcher->compile()) {
+                    return false;
+                }
+                choice.pattern = static_cast<int>(added);
+            } else if (pattern) {
+                if (!matcher) {
+                    matcher = new GlobMatcher();
+                }
+                size_t added = matcher->add(pattern);
+                if (added == SIZE_MAX) {
+                    return false;
+                }
+                choice.pattern = static_cast<int>(added);
+            }
+        }
+
+        if (matcher && !matcher->compile()) {
+            return false;
+        }
+    } else if (type == STATE_DECISION_TABLE) {
+        table = new DecisionTable();
+        if (!table->compile(definition)) {
+            return false;
+        }
+
+        JsonArray rules = definition["Rules"];
+        choiceCount = rules.size();
+        choices = choiceCount > 0 ? new CompiledChoice[choiceCount] : nullptr;
+
+        size_t index = 0;
+        for (JsonObject rule: rules) {
+            if (!compileAssign(rule, choices[index++].assign)) {
+                return false;
+            }
+        }
+    } else if (type == STATE_AGGREGATE) {
+        aggregate = new AggregateDefinition();
+        if (!aggregate->compile(definition) || !compileVariable(definition, variable) || !variable) {
+            return false;
+        }
+    } else if (type == STATE_DEBOUNCE || type == STATE_THROTTLE) {
+        if (!definition["Millis"].is<unsigned long>()) {
+            return false;
+        }
+        period = definition["Millis"].as<unsigned long>();
+        if (type == STATE_DEBOUNCE && (!compileVariable(definition, variable) || !variable)) {
+            return false;
+        }
+    }
+    return true;
+}
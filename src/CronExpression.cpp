@@ -0,0 +1,177 @@
+#include "CronExpression.h"
+
+#define SECONDS_PER_DAY 86400UL
+
+/**
+ * @brief Parses one field into a bitset of the values between low and high.
+ *
+ * @param text The field; advanced past it and the following blanks.
+ * @param wildcard Set when the field starts with `*`, stepped or not; Vixie cron decides its day rule on that.
+ * @return False if the field is malformed or out of range.
+ */
+static bool parseField(const char *&text, uint8_t low, uint8_t high, uint64_t &bits, bool &wildcard) {
+    bits = 0;
+    wildcard = text[0] == '*';
+    while (true) {
+        unsigned from;
+        unsigned to;
+        bool single = false;
+        if (*text == '*') {
+            from = low;
+            to = high;
+            text++;
+        } else {
+            if (*text < '0' || *text > '9') {
+                return false;
+            }
+            from = 0;
+            while (*text >= '0' && *text <= '9') {
+                from = from * 10 + (*text++ - '0');
+            }
+            to = from;
+            single = *text != '-';
+            if (*text == '-') {
+                text++;
+                if (*text < '0' || *text > '9') {
+                    return false;
+                }
+                to = 0;
+                while (*text >= '0' && *text <= '9') {
+                    to = to * 10 + (*text++ - '0');
+                }
+            }
+        }
+
+        unsigned step = 1;
+        if (*text == '/') {
+            text++;
+            step = 0;
+            while (*text >= '0' && *text <= '9') {
+                step = step * 10 + (*text++ - '0');
+            }
+            if (step == 0) {
+                return false;
+            }
+            // A step after a single value runs to the end of the range, as in cronie: 5/15 is 5-59/15
+            if (single) {
+                to = high;
+            }
+        }
+
+        if (from < low || to > high || from > to) {
+            return false;
+        }
+        for (unsigned value = from; value <= to; value += step) {
+            bits |= 1ULL << value;
+        }
+
+        if (*text != ',') {
+            break;
+        }
+        text++;
+    }
+
+    if (*text != ' ' && *text != '\t' && *text != '\0') {
+        return false;
+    }
+    while (*text == ' ' || *text == '\t') {
+        text++;
+    }
+    return true;
+}
+
+bool CronExpression::compile(const char *expression) {
+    uint64_t bits;
+    bool wildcard;
+    while (*expression == ' ' || *expression == '\t') {
+        expression++;
+    }
+
+    if (!parseField(expression, 0, 59, bits, wildcard)) return false;
+    minutes = bits;
+    if (!parseField(expression, 0, 23, bits, wildcard)) return false;
+    hours = static_cast<uint32_t>(bits);
+    if (!parseField(expression, 1, 31, bits, anyDay)) return false;
+    days = static_cast<uint32_t>(bits);
+    if (!parseField(expression, 1, 12, bits, wildcard)) return false;
+    months = static_cast<uint16_t>(bits);
+    if (!parseField(expression, 0, 7, bits, anyWeekday)) return false;
+    // 7 is another name for Sunday
+    weekdays = static_cast<uint8_t>((bits | (bits >> 7)) & 0x7F);
+
+    return *expression == '\0';
+}
+
+/**
+ * @brief Converts days since 1970-01-01 to a civil date (proleptic Gregorian).
+ */
+static void civilFromDays(uint32_t days, uint32_t &year, uint32_t &month, uint32_t &day) {
+    uint32_t z = days + 719468;
+    uint32_t era = z / 146097;
+    uint32_t dayOfEra = z - era * 146097;
+    uint32_t yearOfEra = (dayOfEra - dayOfEra / 1460 + dayOfEra / 36524 - dayOfEra / 146096) / 365;
+    uint32_t dayOfYear = dayOfEra - (365 * yearOfEra + yearOfEra / 4 - yearOfEra / 100);
+    uint32_t shifted = (5 * dayOfYear + 2) / 153;
+    day = dayOfYear - (153 * shifted + 2) / 5 + 1;
+    month = shifted < 10 ? shifted + 3 : shifted - 9;
+    year = yearOfEra + era * 400 + (month <= 2 ? 1 : 0);
+}
+
+/**
+ * @brief Converts a civil date to days since 1970-01-01.
+ */
+static uint32_t daysFromCivil(uint32_t year, uint32_t month, uint32_t day) {
+    year -= month <= 2 ? 1 : 0;
+    uint32_t era = year / 400;
+    uint32_t yearOfEra = year - era * 400;
+    uint32_t dayOfYear = (153 * (month > 2 ? month - 3 : month + 9) + 2) / 5 + day - 1;
+    uint32_t dayOfEra = yearOfEra * 365 + yearOfEra / 4 - yearOfEra / 100 + dayOfYear;
+    return era * 146097 + dayOfEra - 719468;
+}
+
+bool CronExpression::matchesDay(uint32_t day, uint32_t weekday) const {
+    bool dayMatch = (days >> day) & 1;
+    bool weekdayMatch = (weekdays >> weekday) & 1;
+    // As in Vixie cron, a day field starting with a star makes both fields apply; its own bits still count, so
+    // "*/2" keeps only odd days
+    if (anyDay || anyWeekday) {
+        return dayMatch && weekdayMatch;
+    }
+    return dayMatch || weekdayMatch;
+}
+
+uint32_t CronExpression::next(uint32_t after) const {
+    uint64_t limit = static_cast<uint64_t>(after) + 5 * 366 * SECONDS_PER_DAY;
+    uint64_t time = (after / 60 + 1) * 60ULL;
+
+    // Skip whole months, days and hours that cannot match before testing minutes
+    while (time < limit && time <= UINT32_MAX) {
+        uint32_t dayNumber = static_cast<uint32_t>(time / SECONDS_PER_DAY);
+        uint32_t second = static_cast<uint32_t>(time % SECONDS_PER_DAY);
+        uint32_t year, month, day;
+        civilFromDays(dayNumber, year, month, day);
+
+        if (!((months >> month) & 1)) {
+            uint32_t first = month == 12 ? daysFromCivil(year + 1, 1, 1) : daysFromCivil(year, month + 1, 1);
+            time = static_cast<uint64_t>(first) * SECONDS_PER_DAY;
+            continue;
+        }
+        // 1970-01-01 was a Thursday
+        if (!matchesDay(day, (dayNumber + 4) % 7)) {
+            time = static_cast<uint64_t>(dayNumber + 1) * SECONDS_PER_DAY;
+            continue;
+        }
+        uint32_t hour = second / 3600;
+        if (!((hours >> hour) & 1)) {
+            time = static_cast<uint64_t>(dayNumber) * SECONDS_PER_DAY + (hour + 1) * 3600;
+            continue;
+        }
+        uint32_t minute = (second % 3600) / 60;
+        if (!((minutes >> minute) & 1)) {
+            time += 60;
+            continue;
+        }
+        return static_cast<uint32_t>(time);
+    }
+    return 0;
+}
@@ -0,0 +1,330 @@
+#include "DecisionTable.h"
+#include <string.h>
+#include <stdlib.h>
+
+/**
+ * @brief The bitset index of one input.
+ *
+ * Masks are laid out as one bitset per slot: the 2 * pointCount + 1 numeric
+ * segments, then one per distinct string, then true, false, and "other"
+ * (values no cell can match, which only wildcard rules accept).
+ */
+struct DecisionTable::Column {
+    VariablePath path;
+    double *points = nullptr; /**< Sorted distinct numeric boundaries. */
+    size_t pointCount = 0;
+    const char **strings = nullptr; /**< Sorted distinct string cells. */
+    size_t stringCount = 0;
+    uint32_t *masks = nullptr;
+
+    ~Column() {
+        delete[] points;
+        delete[] strings;
+        delete[] masks;
+    }
+
+    size_t segmentCount() const { return 2 * pointCount + 1; }
+    size_t trueSlot() const { return segmentCount() + stringCount; }
+    size_t falseSlot() const { return trueSlot() + 1; }
+    size_t otherSlot() const { return trueSlot() + 2; }
+    size_t slotCount() const { return trueSlot() + 3; }
+
+    /**
+     * @brief Maps a number to its segment: 2j + 1 is exactly points[j], 2j lies below it.
+     */
+    size_t segmentOf(double value) const {
+        size_t low = 0;
+        size_t high = pointCount;
+        while (low < high) {
+            size_t middle = (low + high) / 2;
+            if (points[middle] < value) {
+                low = middle + 1;
+            } else {
+                high = middle;
+            }
+        }
+        return (low < pointCount && points[low] == value) ? 2 * low + 1 : 2 * low;
+    }
+
+    /**
+     * @brief Returns a value lying inside the given segment.
+     */
+    double representative(size_t segment) const {
+        size_t j = segment / 2;
+        if (segment % 2 == 1) return points[j];
+        if (pointCount == 0) return 0;
+        if (j == 0) return points[0] - 1;
+        if (j == pointCount) return points[pointCount - 1] + 1;
+        return (points[j - 1] + points[j]) / 2;
+    }
+
+    /**
+     * @brief Maps a string to its slot, or the "other" slot if no cell names it.
+     */
+    size_t slotOf(const char *value) const {
+        size_t low = 0;
+        size_t high = stringCount;
+        while (low < high) {
+            size_t middle = (low + high) / 2;
+            int order = strcmp(strings[middle], value);
+            if (order == 0) return segmentCount() + middle;
+            if (order < 0) {
+                low = middle + 1;
+            } else {
+                high = middle;
+            }
+        }
+        return otherSlot();
+    }
+};
+
+static const char *const NUMERIC_OPERATORS[] = {
+    "NumericEquals",
+    "NumericGreaterThan",
+    "NumericGreaterThanEquals",
+    "NumericLessThan",
+    "NumericLessThanEquals"
+};
+
+static bool isNumber(JsonVariantConst value) {
+    return !value.is<bool>() && (value.is<long>() || value.is<unsigned long>() || value.is<double>());
+}
+
+/**
+ * @brief Checks that a cell is null, a string, a boolean, a number, or a numeric comparison object.
+ */
+static bool validCell(JsonVariantConst cell) {
+    if (cell.isNull() || cell.is<const char *>() || cell.is<bool>() || isNumber(cell)) {
+        return true;
+    }
+    if (!cell.is<JsonObjectConst>()) {
+        return false;
+    }
+    for (JsonPairConst kv: cell.as<JsonObjectConst>()) {
+        bool known = false;
+        for (const char *name: NUMERIC_OPERATORS) {
+            known = known || strcmp(kv.key().c_str(), name) == 0;
+        }
+        if (!known || !isNumber(kv.value())) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief Tests a numeric cell (a number, or a comparison object) against a value.
+ */
+static bool acceptsNumber(JsonVariantConst cell, double value) {
+    if (isNumber(cell)) {
+        return value == cell.as<double>();
+    }
+    if (!cell.is<JsonObjectConst>()) {
+        return false;
+    }
+    for (JsonPairConst kv: cell.as<JsonObjectConst>()) {
+        const char *name = kv.key().c_str();
+        double bound = kv.value().as<double>();
+        if (strcmp(name, "NumericEquals") == 0 && !(value == bound)) return false;
+        if (strcmp(name, "NumericGreaterThan") == 0 && !(value > bound)) return false;
+        if (strcmp(name, "NumericGreaterThanEquals") == 0 && !(value >= bound)) return false;
+        if (strcmp(name, "NumericLessThan") == 0 && !(value < bound)) return false;
+        if (strcmp(name, "NumericLessThanEquals") == 0 && !(value <= bound)) return false;
+    }
+    return true;
+}
+
+static int compareDoubles(const void *a, const void *b) {
+    double x = *static_cast<const double *>(a);
+    double y = *static_cast<const double *>(b);
+    return x < y ? -1 : (x > y ? 1 : 0);
+}
+
+static int compareStrings(const void *a, const void *b) {
+    return strcmp(*static_cast<const char *const *>(a), *static_cast<const char *const *>(b));
+}
+
+DecisionTable::DecisionTable() = default;
+
+DecisionTable::~DecisionTable() {
+    clear();
+}
+
+void DecisionTable::clear() {
+    delete[] columns;
+    delete[] nextStates;
+    delete[] candidates;
+    columns = nullptr;
+    nextStates = nullptr;
+    candidates = nullptr;
+    columnCount = ruleCount = words = 0;
+}
+
+bool DecisionTable::compile(JsonObjectConst definition) {
+    clear();
+
+    JsonArrayConst inputs = definition["Inputs"];
+    JsonArrayConst rules = definition["Rules"];
+    columnCount = inputs.size();
+    ruleCount = rules.size();
+    words = (ruleCount + 31) / 32;
+    // evaluate() runs on every run(), so its scratch bitset is allocated here, not per call
+    candidates = new uint32_t[words > 0 ? words : 1];
+
+    // Index rows once; array subscripts walk the list on every access
+    JsonArrayConst *cells = new JsonArrayConst[ruleCount > 0 ? ruleCount : 1];
+    nextStates = new const char *[ruleCount > 0 ? ruleCount : 1];
+    size_t row = 0;
+    for (JsonObjectConst rule: rules) {
+        cells[row] = rule["When"];
+        nextStates[row] = rule["Next"].as<const char *>();
+        if (!nextStates[row] || cells[row].size() > columnCount) {
+            delete[] cells;
+            return false;
+        }
+        row++;
+    }
+
+    columns = new Column[columnCount > 0 ? columnCount : 1];
+    bool valid = true;
+    size_t index = 0;
+    for (JsonVariantConst input: inputs) {
+        Column &column = columns[index];
+        const char *path = input.as<const char *>();
+        if (!path || !column.path.compile(path)) {
+            valid = false;
+            break;
+        }
+
+        // Gather the boundaries and strings this column can distinguish
+        size_t pointCapacity = 0;
+        for (size_t r = 0; r < ruleCount; r++) {
+            JsonVariantConst cell = cells[r][index];
+            if (!validCell(cell)) {
+                valid = false;
+            }
+            pointCapacity += isNumber(cell) ? 1 : cell.size();
+        }
+        if (!valid) {
+            break;
+        }
+
+        double *points = new double[pointCapacity + 1];
+        const char **strings = new const char *[ruleCount + 1];
+        size_t pointCount = 0;
+        size_t stringCount = 0;
+        for (size_t r = 0; r < ruleCount; r++) {
+            JsonVariantConst cell = cells[r][index];
+            if (cell.is<const char *>()) {
+                strings[stringCount++] = cell.as<const char *>();
+            } else if (isNumber(cell)) {
+                points[pointCount++] = cell.as<double>();
+            } else if (cell.is<JsonObjectConst>()) {
+                for (JsonPairConst kv: cell.as<JsonObjectConst>()) {
+                    points[pointCount++] = kv.value().as<double>();
+                }
+            }
+        }
+
+        qsort(points, pointCount, sizeof(double), compareDoubles);
+        qsort(strings, stringCount, sizeof(const char *), compareStrings);
+        size_t distinct = 0;
+        for (size_t i = 0; i < pointCount; i++) {
+            if (distinct == 0 || points[distinct - 1] != points[i]) points[distinct++] = points[i];
+        }
+        column.pointCount = distinct;
+        column.points = new double[distinct > 0 ? distinct : 1];
+        memcpy(column.points, points, distinct * sizeof(double));
+        distinct = 0;
+        for (size_t i = 0; i < stringCount; i++) {
+            if (distinct == 0 || strcmp(strings[distinct - 1], strings[i]) != 0) strings[distinct++] = strings[i];
+        }
+        column.stringCount = distinct;
+        column.strings = new const char *[distinct > 0 ? distinct : 1];
+        memcpy(column.strings, strings, distinct * sizeof(const char *));
+        delete[] points;
+        delete[] strings;
+
+        // Fill the bitset of every slot
+        size_t slots = column.slotCount();
+        column.masks = new uint32_t[slots * words > 0 ? slots * words : 1];
+        memset(column.masks, 0, slots * words * sizeof(uint32_t));
+        for (size_t r = 0; r < ruleCount; r++) {
+            JsonVariantConst cell = cells[r][index];
+            uint32_t bit = 1UL << (r % 32);
+            size_t word = r / 32;
+            if (cell.isNull()) {
+                for (size_t slot = 0; slot < slots; slot++) column.masks[slot * words + word] |= bit;
+            } else if (cell.is<const char *>()) {
+                column.masks[column.slotOf(cell.as<const char *>()) * words + word] |= bit;
+            } else if (cell.is<bool>()) {
+                size_t slot = cell.as<bool>() ? column.trueSlot() : column.falseSlot();
+                column.masks[slot * words + word] |= bit;
+            } else {
+                for (size_t segment = 0; segment < column.segmentCount(); segment++) {
+                    if (acceptsNumber(cell, column.representative(segment))) {
+                        column.masks[segment * words + word] |= bit;
+                    }
+                }
+            }
+        }
+
+        index++;
+    }
+
+    delete[] cells;
+    return valid;
+}
+
+int DecisionTable::evaluate(const Variables &variables) const {
+    if (ruleCount == 0) {
+        return -1;
+    }
+
+    memset(candidates, 0xFF, words * sizeof(uint32_t));
+
+    for (size_t c = 0; c < columnCount; c++) {
+        const Column &column = columns[c];
+        JsonVariantConst value = variables.resolve(column.path);
+
+        size_t slot;
+        if (value.is<bool>()) {
+            slot = value.as<bool>() ? column.trueSlot() : column.falseSlot();
+        } else if (value.is<const char *>()) {
+            slot = column.slotOf(value.as<const char *>());
+        } else if (isNumber(value)) {
+            double number = value.as<double>();
+            slot = number == number ? column.segmentOf(number) : column.otherSlot();
+        } else {
+            slot = column.otherSlot();
+        }
+
+        const uint32_t *mask = column.masks + slot * words;
+        uint32_t any = 0;
+        for (size_t w = 0; w < words; w++) {
+            candidates[w] &= mask[w];
+            any |= candidates[w];
+        }
+        if (!any) {
+            break;
+        }
+    }
+
+    int match = -1;
+    for (size_t w = 0; w < words; w++) {
+        if (candidates[w]) {
+            size_t rule = w * 32 + __builtin_ctzl(candidates[w]);
+            match = rule < ruleCount ? static_cast<int>(rule) : -1;
+            break;
+        }
+    }
+    return match;
+}
+
+const char *DecisionTable::next(int rule) const {
+    return nextStates[rule];
+}
+
+size_t DecisionTable::size() const {
+    return ruleCount;
+}
@@ -0,0 +1,416 @@
+#include "DefinitionAnalysis.h"
+#include <string.h>
+
+static const size_t NONE = SIZE_MAX;
+
+/**
+ * @brief Hashes a state name (FNV-1a).
+ */
+static uint32_t hashName(const char *name) {
+    uint32_t hash = 2166136261UL;
+    while (*name) {
+        hash = (hash ^ static_cast<uint8_t>(*name++)) * 16777619UL;
+    }
+    return hash;
+}
+
+DefinitionAnalysis::DefinitionAnalysis(StepDefinition &definition)
+    : definition(definition), count(definition.size()) {
+    size_t bucketCount = 2;
+    while (bucketCount < count * 2) {
+        bucketCount <<= 1;
+    }
+    buckets = new size_t[bucketCount]();
+    bucketMask = bucketCount - 1;
+    for (size_t i = 0; i < count; i++) {
+        size_t bucket = hashName(definition.state(i)->name) & bucketMask;
+        while (buckets[bucket] != 0) {
+            bucket = (bucket + 1) & bucketMask;
+        }
+        buckets[bucket] = i + 1;
+    }
+    measuredMicros = new unsigned long[count > 0 ? count : 1]();
+    handlerMicros = new unsigned long[count > 0 ? count : 1]();
+    measured = new bool[count > 0 ? count : 1]();
+}
+
+DefinitionAnalysis::~DefinitionAnalysis() {
+    delete[] buckets;
+    delete[] measuredMicros;
+    delete[] handlerMicros;
+    delete[] measured;
+}
+
+size_t DefinitionAnalysis::lookup(const char *name) const {
+    if (!name) {
+        return count;
+    }
+    for (size_t bucket = hashName(name) & bucketMask; buckets[bucket] != 0; bucket = (bucket + 1) & bucketMask) {
+        if (strcmp(definition.state(buckets[bucket] - 1)->name, name) == 0) {
+            return buckets[bucket] - 1;
+        }
+    }
+    return count;
+}
+
+void DefinitionAnalysis::addProfile(JsonObjectConst profile) {
+    profiled = true;
+    for (JsonPairConst entry: profile) {
+        size_t index = lookup(entry.key().c_str());
+        if (index == count) {
+            continue;
+        }
+        unsigned long longest = entry.value()["MaxMicros"].as<unsigned long>();
+        unsigned long handler = entry.value()["HandlerMaxMicros"].as<unsigned long>();
+        measured[index] = true;
+        if (longest > measuredMicros[index]) {
+            measuredMicros[index] = longest;
+        }
+        if (handler > handlerMicros[index]) {
+            handlerMicros[index] = handler;
+        }
+    }
+}
+
+bool DefinitionAnalysis::analyze(JsonDocument &result) {
+    result.clear();
+    size_t n = count;
+    size_t slots = n > 0 ? n : 1;
+
+    // The transition graph, as adjacency lists in one array
+    size_t *edgeStart = new size_t[n + 1];
+    size_t edgeCapacity = slots * 2;
+    size_t edgeCount = 0;
+    size_t *edges = new size_t[edgeCapacity];
+    bool *isWait = new bool[slots]();
+    // Whether a state can end the execution, or fail to find its next state
+    bool *terminal = new bool[slots]();
+    // Hash of a Task state's Resource with the low bit set; 0 for other states
+    uint32_t *resource = new uint32_t[slots]();
+    for (size_t i = 0; i < n; i++) {
+        edgeStart[i] = edgeCount;
+        CompiledState *state = definition.find(definition.state(i)->name);
+        if (!state) {
+            terminal[i] = true;
+            continue;
+        }
+        auto edge = [&](JsonVariantConst next) {
+            size_t target = lookup(next.as<const char *>());
+            if (target == n) {
+                terminal[i] = true;
+                return;
+            }
+            if (edgeCount == edgeCapacity) {
+                size_t *grown = new size_t[edgeCapacity * 2];
+                memcpy(grown, edges, edgeCount * sizeof(size_t));
+                delete[] edges;
+                edges = grown;
+                edgeCapacity *= 2;
+            }
+            edges[edgeCount++] = target;
+        };
+        JsonObjectConst config = state->definition;
+        isWait[i] = state->type == STATE_WAIT;
+        if (state->type == STATE_TASK) {
+            const char *name = config["Resource"].as<const char *>();
+            resource[i] = name ? hashName(name) | 1 : 1;
+        }
+        if (state->type == STATE_CHOICE || state->type == STATE_DECISION_TABLE) {
+            JsonArrayConst rules = config[state->type == STATE_CHOICE ? "Choices" : "Rules"];
+            for (JsonObjectConst rule: rules) {
+                edge(rule["Next"]);
+            }
+            edge(config["Default"]);
+        } else if (state->type == STATE_UNKNOWN) {
+            terminal[i] = true;
+        } else {
+            edge(config["Next"]);
+            if (state->type == STATE_THROTTLE && !config["Default"].isNull()) {
+                edge(config["Default"]);
+            }
+        }
+    }
+    edgeStart[n] = edgeCount;
+
+    // What each state costs: measured, or estimated from its Resource and the engine overhead
+    unsigned long overhead = 0;
+    for (size_t i = 0; i < n; i++) {
+        if (measured[i] && measuredMicros[i] - handlerMicros[i] > overhead) {
+            overhead = measuredMicros[i] - handlerMicros[i];
+        }
+    }
+    unsigned long *weight = new unsigned long[slots];
+    for (size_t i = 0; i < n; i++) {
+        weight[i] = measuredMicros[i];
+        if (!measured[i] && profiled) {
+            unsigned long handler = 0;
+            for (size_t j = 0; resource[i] && j < n; j++) {
+                if (measured[j] && resource[j] == resource[i] && handlerMicros[j] > handler) {
+                    handler = handlerMicros[j];
+                }
+            }
+            weight[i] = overhead + handler;
+        }
+    }
+
+    // Strongly connected components of the states between Waits (Tarjan, without recursion);
+    // they complete sinks first, so filling topo from the back leaves it in topological order
+    size_t *order = new size_t[slots];
+    size_t *low = new size_t[slots];
+    bool *onStack = new bool[slots]();
+    bool *cyclic = new bool[slots]();
+    size_t *sccStack = new size_t[slots];
+    size_t *callState = new size_t[slots];
+    size_t *callEdge = new size_t[slots];
+    size_t *topo = new size_t[slots];
+    size_t topoStart = n;
+    size_t visited = 0;
+    size_t sccDepth = 0;
+    JsonArray cycles = result["Cycles"].to<JsonArray>();
+    for (size_t i = 0; i < n; i++) {
+        order[i] = NONE;
+    }
+    for (size_t root = 0; root < n; root++) {
+        if (isWait[root] || order[root] != NONE) {
+            continue;
+        }
+        size_t depth = 0;
+        auto open = [&](size_t v) {
+            order[v] = low[v] = visited++;
+            sccStack[sccDepth++] = v;
+            onStack[v] = true;
+            callState[depth] = v;
+            callEdge[depth] = edgeStart[v];
+            depth++;
+        };
+        open(root);
+        while (depth > 0) {
+            size_t v = callState[depth - 1];
+            if (callEdge[depth - 1] < edgeStart[v + 1]) {
+                size_t w = edges[callEdge[depth - 1]++];
+                if (isWait[w]) {
+                    continue;
+                }
+                if (order[w] == NONE) {
+                    open(w);
+                } else if (onStack[w] && order[w] < low[v]) {
+                    low[v] = order[w];
+                }
+                continue;
+            }
+            depth--;
+            if (depth > 0 && low[v] < low[callState[depth - 1]]) {
+                low[callState[depth - 1]] = low[v];
+            }
+            if (low[v] != order[v]) {
+                continue;
+            }
+            size_t first = sccDepth;
+            do {
+                first--;
+            } while (sccStack[first] != v);
+            bool loops = sccDepth - first > 1;
+            for (size_t e = edgeStart[v]; !loops && e < edgeStart[v + 1]; e++) {
+                loops = edges[e] == v;
+            }
+            if (loops) {
+                // In the order the search entered them, which follows the transitions
+                JsonArray members = cycles.add<JsonArray>();
+                for (size_t j = first; j < sccDepth; j++) {
+                    members.add(definition.state(sccStack[j])->name);
+                }
+            }
+            while (sccDepth > first) {
+                size_t w = sccStack[--sccDepth];
+                onStack[w] = false;
+                cyclic[w] = loops;
+                topo[--topoStart] = w;
+            }
+        }
+    }
+
+    // Longest paths from every place an execution resumes: its start, and the Next of each Wait
+    unsigned long *micros = new unsigned long[slots];
+    unsigned long *runs = new unsigned long[slots]();
+    size_t *via = new size_t[slots];
+    unsigned long *destMicros = new unsigned long[n + 1];
+    unsigned long *destRuns = new unsigned long[n + 1]();
+    size_t *destVia = new size_t[n + 1];
+    size_t *touched = new size_t[n + 1];
+    bool *reached = new bool[slots]();
+    size_t *path = new size_t[n + 1];
+    size_t pathLength = 0;
+    unsigned long worstMicros = 0;
+    unsigned long worstRuns = 0;
+    unsigned long maxRuns = 0;
+    bool found = false;
+    bool bounded = true;
+    JsonObject worst = result["Worst"].to<JsonObject>();
+    JsonArray segments = result["Segments"].to<JsonArray>();
+
+    for (size_t k = 0; k <= n; k++) {
+        // The start of an execution first, as from == n
+        size_t from = k == 0 ? n : k - 1;
+        size_t entry;
+        if (from == n) {
+            entry = definition.startAt() ? lookup(definition.startAt()) : n;
+        } else if (isWait[from] && edgeStart[from + 1] > edgeStart[from]) {
+            entry = edges[edgeStart[from]];
+        } else {
+            continue;
+        }
+        if (entry == n) {
+            continue;
+        }
+
+        size_t touchedCount = 0;
+        auto offer = [&](size_t destination, size_t before, unsigned long total, unsigned long steps) {
+            if (destRuns[destination] == 0) {
+                touched[touchedCount++] = destination;
+                destMicros[destination] = total;
+                destVia[destination] = before;
+            } else if (total > destMicros[destination]) {
+                destMicros[destination] = total;
+                destVia[destination] = before;
+            }
+            if (steps > destRuns[destination]) {
+                destRuns[destination] = steps;
+            }
+        };
+
+        bool reachesCycle = false;
+        if (isWait[entry]) {
+            reached[entry] = true;
+            offer(entry, NONE, weight[entry], 1);
+        } else {
+            for (size_t t = topoStart; t < n; t++) {
+                runs[topo[t]] = 0;
+            }
+            micros[entry] = weight[entry];
+            runs[entry] = 1;
+            via[entry] = NONE;
+            for (size_t t = topoStart; t < n && !reachesCycle; t++) {
+                size_t v = topo[t];
+                if (runs[v] == 0) {
+                    continue;
+                }
+                reached[v] = true;
+                if (cyclic[v]) {
+                    reachesCycle = true;
+                    break;
+                }
+                if (terminal[v]) {
+                    offer(n, v, micros[v], runs[v]);
+                }
+                for (size_t e = edgeStart[v]; e < edgeStart[v + 1]; e++) {
+                    size_t w = edges[e];
+                    unsigned long total = micros[v] + weight[w];
+                    if (isWait[w]) {
+                        reached[w] = true;
+                        offer(w, v, total, runs[v] + 1);
+                        continue;
+                    }
+                    if (runs[w] == 0 || total > micros[w]) {
+                        micros[w] = total;
+                        via[w] = v;
+                    }
+                    if (runs[v] + 1 > runs[w]) {
+                        runs[w] = runs[v] + 1;
+                    }
+                }
+            }
+        }
+
+        if (reachesCycle) {
+            bounded = false;
+            JsonObject segment = segments.add<JsonObject>();
+            if (from < n) {
+                segment["From"] = definition.state(from)->name;
+            }
+            segment["Unbounded"] = true;
+        }
+        for (size_t d = 0; d < touchedCount; d++) {
+            size_t destination = touched[d];
+            if (!reachesCycle) {
+                JsonObject segment = segments.add<JsonObject>();
+                if (from < n) {
+                    segment["From"] = definition.state(from)->name;
+                }
+                if (destination < n) {
+                    segment["To"] = definition.state(destination)->name;
+                }
+                segment["Runs"] = destRuns[destination];
+                segment["Micros"] = destMicros[destination];
+                if (destRuns[destination] > maxRuns) {
+                    maxRuns = destRuns[destination];
+                }
+
+                if (!found || destMicros[destination] > worstMicros ||
+                    (destMicros[destination] == worstMicros && destRuns[destination] > worstRuns)) {
+                    found = true;
+                    worstMicros = destMicros[destination];
+                    worstRuns = destRuns[destination];
+                    worst.remove("From");
+                    worst.remove("To");
+                    if (from < n) {
+                        worst["From"] = definition.state(from)->name;
+                    }
+                    if (destination < n) {
+                        worst["To"] = definition.state(destination)->name;
+                    }
+                    pathLength = 0;
+                    if (destination < n) {
+                        path[pathLength++] = destination;
+                    }
+                    for (size_t v = destVia[destination]; v != NONE; v = via[v]) {
+                        path[pathLength++] = v;
+                    }
+                }
+            }
+            destRuns[destination] = 0;
+        }
+    }
+
+    if (found) {
+        worst["Runs"] = worstRuns;
+        worst["Micros"] = worstMicros;
+        JsonArray states = worst["Path"].to<JsonArray>();
+        while (pathLength > 0) {
+            states.add(definition.state(path[--pathLength])->name);
+        }
+        worst["MaxRuns"] = maxRuns;
+    }
+    if (profiled) {
+        JsonArray unmeasured = result["Unmeasured"].to<JsonArray>();
+        for (size_t i = 0; i < n; i++) {
+            if (reached[i] && !measured[i]) {
+                unmeasured.add(definition.state(i)->name);
+            }
+        }
+    }
+
+    delete[] edgeStart;
+    delete[] edges;
+    delete[] isWait;
+    delete[] terminal;
+    delete[] resource;
+    delete[] weight;
+    delete[] order;
+    delete[] low;
+    delete[] onStack;
+    delete[] cyclic;
+    delete[] sccStack;
+    delete[] callState;
+    delete[] callEdge;
+    delete[] topo;
+    delete[] micros;
+    delete[] runs;
+    delete[] via;
+    delete[] destMicros;
+    delete[] destRuns;
+    delete[] destVia;
+    delete[] touched;
+    delete[] reached;
+    delete[] path;
+    return bounded;
+}
@@ -0,0 +1,148 @@
+#include "DefinitionRegistry.h"
+#include <string.h>
+
+/**
+ * @brief Hashes a definition name (FNV-1a).
+ */
+static uint32_t hashName(const char *name) {
+    uint32_t hash = 2166136261UL;
+    while (*name) {
+        hash = (hash ^ static_cast<uint8_t>(*name++)) * 16777619UL;
+    }
+    return hash;
+}
+
+DefinitionRegistry::DefinitionRegistry(size_t capacity)
+    : capacity(capacity < 0xFFFF ? capacity : 0xFFFF) {
+    entries = new Entry[this->capacity > 0 ? this->capacity : 1];
+    size_t bucketCount = 2;
+    while (bucketCount < this->capacity * 2) {
+        bucketCount <<= 1;
+    }
+    buckets = new uint16_t[bucketCount]();
+    bucketMask = bucketCount - 1;
+    configs.to<JsonArray>();
+}
+
+DefinitionRegistry::~DefinitionRegistry() {
+    for (size_t i = 0; i < count; i++) {
+        if (entries[i].owned) {
+            delete entries[i].definition;
+        }
+    }
+    delete[] entries;
+    delete[] buckets;
+}
+
+void DefinitionRegistry::index(size_t entry) {
+    const Entry &added = entries[entry];
+    for (size_t bucket = added.nameHash & bucketMask;; bucket = (bucket + 1) & bucketMask) {
+        uint16_t slot = buckets[bucket];
+        // A new version of a name takes over its bucket
+        if (slot == 0 || (entries[slot - 1].nameHash == added.nameHash &&
+                          strcmp(entries[slot - 1].name, added.name) == 0)) {
+            buckets[bucket] = static_cast<uint16_t>(entry + 1);
+            return;
+        }
+    }
+}
+
+StepDefinition *DefinitionRegistry::add(const char *name, const char *jsonConfig) {
+    if (!name || count == capacity) {
+        return nullptr;
+    }
+    JsonDocument parsed;
+    if (deserializeJson(parsed, jsonConfig)) {
+        Serial.println("Failed to parse JSON");
+        return nullptr;
+    }
+
+    // Copying into the shared document is where strings already stored by other definitions are reused
+    JsonObject record = configs.as<JsonArray>().add<JsonObject>();
+    record["Name"] = name;
+    JsonObject config = record["Config"].to<JsonObject>();
+    config.set(parsed.as<JsonObjectConst>());
+
+    StepDefinition *definition = new StepDefinition();
+    if (!definition->compile(config) || find(definition->hash())) {
+        delete definition;
+        configs.as<JsonArray>().remove(configs.as<JsonArray>().size() - 1);
+        return nullptr;
+    }
+    entries[count] = {definition, record["Name"].as<const char *>(), hashName(name), true};
+    index(count++);
+    return definition;
+}
+
+bool DefinitionRegistry::add(StepDefinition &definition, const char *name) {
+    if (count == capacity || find(definition.hash())) {
+        return false;
+    }
+    const char *interned = nullptr;
+    if (name) {
+        JsonObject record = configs.as<JsonArray>().add<JsonObject>();
+        record["Name"] = name;
+        interned = record["Name"].as<const char *>();
+    }
+    entries[count] = {&definition, interned, interned ? hashName(interned) : 0, false};
+    if (interned) {
+        index(count);
+    }
+    count++;
+    return true;
+}
+
+StepDefinition *DefinitionRegistry::find(const char *name) const {
+    if (!name) {
+        return nullptr;
+    }
+    uint32_t hash = hashName(name);
+    for (size_t bucket = hash & bucketMask;; bucket = (bucket + 1) & bucketMask) {
+        uint16_t slot = buckets[bucket];
+        if (slot == 0) {
+            return nullptr;
+        }
+        const Entry &entry = entries[slot - 1];
+        if (entry.nameHash == hash && strcmp(entry.name, name) == 0) {
+            return entry.definition;
+        }
+    }
+}
+
+StepDefinition *DefinitionRegistry::find(uint32_t hash) const {
+    for (size_t i = 0; i < count; i++) {
+        if (entries[i].definition->hash() == hash) {
+            return entries[i].definition;
+        }
+    }
+    return nullptr;
+}
+
+StepDefinition *DefinitionRegistry::select(JsonVariantConst cursor) const {
+    uint32_t hash = cursor["Definition"].as<uint32_t>();
+    StepDefinition *exact = find(hash);
+    if (exact) {
+        return exact;
+    }
+    // Newest first: a later version's migration supersedes an earlier one's
+    const char *version = cursor["Version"].as<const char *>();
+    for (size_t i = count; i-- > 0;) {
+        if (entries[i].definition->accepts(hash, version)) {
+            return entries[i].definition;
+        }
+    }
+    return nullptr;
+}
+
+const char *DefinitionRegistry::nameOf(const StepDefinition *definition) const {
+    for (size_t i = 0; i < count; i++) {
+        if (entries[i].definition == definition) {
+            return entries[i].name;
+        }
+    }
+    return nullptr;
+}
+
+size_t DefinitionRegistry::size() const {
+    return count;
+}
@@ -0,0 +1,83 @@
+#include "DefinitionSource.h"
+
+FlashDefinitionSource::FlashDefinitionSource(FlashDevice &device, size_t firstSector, size_t length)
+    : device(device), firstSector(firstSector), length(length) {
+}
+
+bool FlashDefinitionSource::store(FlashDevice &device, size_t firstSector, const char *text, size_t length) {
+    size_t sectorSize = device.sectorSize();
+    if (firstSector + (length + sectorSize - 1) / sectorSize > device.sectorCount()) {
+        return false;
+    }
+    for (size_t done = 0, sector = firstSector; done < length; sector++) {
+        size_t chunk = length - done < sectorSize ? length - done : sectorSize;
+        if (!device.erase(sector) || !device.write(sector, 0, reinterpret_cast<const uint8_t *>(text) + done, chunk)) {
+            return false;
+        }
+        done += chunk;
+    }
+    return true;
+}
+
+size_t FlashDefinitionSource::size() const {
+    return length;
+}
+
+bool FlashDefinitionSource::read(size_t offset, uint8_t *data, size_t count) {
+    if (offset > length || count > length - offset) {
+        return false;
+    }
+    size_t sectorSize = device.sectorSize();
+    // A read may span sectors
+    while (count > 0) {
+        size_t within = offset % sectorSize;
+        size_t chunk = sectorSize - within < count ? sectorSize - within : count;
+        if (!device.read(firstSector + offset / sectorSize, within, data, chunk)) {
+            return false;
+        }
+        offset += chunk;
+        data += chunk;
+        count -= chunk;
+    }
+    return true;
+}
+
+#ifndef ARDUINO
+
+FileDefinitionSource::FileDefinitionSource(const char *path) {
+    file = fopen(path, "rb");
+    if (file) {
+        fseek(file, 0, SEEK_END);
+        long end = ftell(file);
+        length = end > 0 ? static_cast<size_t>(end) : 0;
+    }
+}
+
+FileDefinitionSource::~FileDefinitionSource() {
+    if (file) {
+        fclose(file);
+    }
+}
+
+bool FileDefinitionSource::isOpen() const {
+    return file != nullptr;
+}
+
+size_t FileDefinitionSource::size() const {
+    return length;
+}
+
+bool FileDefinitionSource::read(size_t offset, uint8_t *data, size_t count) {
+    if (!file || offset > length || count > length - offset) {
+        return false;
+    }
+    readCount++;
+    fseek(file, static_cast<long>(offset), SEEK_SET);
+    return fread(data, 1, count, file) == count;
+}
+
+unsigned long FileDefinitionSource::reads() const {
+    return readCount;
+}
+
+#endif
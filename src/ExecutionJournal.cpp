@@ -0,0 +1,57 @@
+#include "ExecutionJournal.h"
+
+ExecutionJournal::ExecutionJournal(Print &output) : output(output) {
+}
+
+void ExecutionJournal::write(JsonDocument &record) {
+    serializeJson(record, output);
+    output.write('\n');
+    count++;
+}
+
+void ExecutionJournal::recordSnapshot(unsigned long now, JsonVariantConst snapshot) {
+    JsonDocument record;
+    record["e"] = "snapshot";
+    record["t"] = now;
+    record["v"] = snapshot;
+    write(record);
+}
+
+void ExecutionJournal::recordStart(unsigned long now, JsonVariantConst input) {
+    JsonDocument record;
+    record["e"] = "start";
+    record["t"] = now;
+    record["v"] = input;
+    write(record);
+}
+
+void ExecutionJournal::recordSet(unsigned long now, const char *name, JsonVariantConst value) {
+    JsonDocument record;
+    record["e"] = "set";
+    record["t"] = now;
+    record["n"] = name;
+    record["v"] = value;
+    write(record);
+}
+
+void ExecutionJournal::recordTask(unsigned long now, const String &resource, JsonVariantConst variables) {
+    JsonDocument record;
+    record["e"] = "task";
+    record["t"] = now;
+    record["r"] = resource;
+    record["v"] = variables;
+    write(record);
+}
+
+void ExecutionJournal::recordRun(unsigned long now, int result, const String &state) {
+    JsonDocument record;
+    record["e"] = "run";
+    record["t"] = now;
+    record["r"] = result;
+    record["s"] = state;
+    write(record);
+}
+
+unsigned long ExecutionJournal::records() const {
+    return count;
+}
@@ -0,0 +1,522 @@
+#include "Expression.h"
+#include <string.h>
+#include <stdlib.h>
+#include <math.h>
+
+enum ExpressionOp : uint8_t {
+    OP_NUMBER,
+    OP_STRING,
+    OP_TRUE,
+    OP_FALSE,
+    OP_NULL,
+    OP_LOAD,
+    OP_NEG,
+    OP_NOT,
+    OP_ADD,
+    OP_SUB,
+    OP_MUL,
+    OP_DIV,
+    OP_MOD,
+    OP_EQ,
+    OP_NE,
+    OP_LT,
+    OP_LE,
+    OP_GT,
+    OP_GE,
+    OP_AND,
+    OP_OR
+};
+
+bool ExpressionValue::truthy() const {
+    switch (type) {
+        case BOOLEAN:
+            return boolean;
+        case NUMBER:
+            return number != 0;
+        case STRING:
+            return string[0] != '\0';
+        case REFERENCE:
+            return reference.size() > 0;
+        default:
+            return false;
+    }
+}
+
+/**
+ * @brief Recursive-descent parser emitting postfix bytecode into an Expression.
+ *
+ * Precedence, lowest first: or, and, comparison, additive, multiplicative, unary.
+ */
+struct ExpressionParser {
+    Expression &target;
+    const char *p;
+    const char *end;
+    bool failed = false;
+    size_t codeCapacity = 0;
+    size_t numberCapacity = 0;
+    size_t stringCapacity = 0;
+    size_t pathCapacity = 0;
+    int depth = 0;
+
+    ExpressionParser(Expression &expression, const char *source, size_t length)
+        : target(expression), p(source), end(source + length) {
+    }
+
+    template<typename T>
+    static bool grow(T *&array, size_t count, size_t &capacity) {
+        if (count < capacity) {
+            return true;
+        }
+        size_t next = capacity == 0 ? 8 : capacity * 2;
+        T *grown = static_cast<T *>(realloc(array, next * sizeof(T)));
+        if (!grown) {
+            return false;
+        }
+        array = grown;
+        capacity = next;
+        return true;
+    }
+
+    void emit(uint8_t op, size_t operand = 0) {
+        if (failed || operand > 255 || !grow(target.code, target.codeLength, codeCapacity)) {
+            failed = true;
+            return;
+        }
+        target.code[target.codeLength].op = op;
+        target.code[target.codeLength].operand = static_cast<uint8_t>(operand);
+        target.codeLength++;
+
+        // Track the evaluation stack so evaluate() can run on a fixed array
+        if (op <= OP_LOAD) {
+            depth++;
+        } else if (op >= OP_ADD) {
+            depth--;
+        }
+        if (depth > EXPRESSION_STACK_SIZE) {
+            failed = true;
+        }
+    }
+
+    void skipSpace() {
+        while (p < end && (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n')) p++;
+    }
+
+    bool accept(const char *token) {
+        skipSpace();
+        size_t length = strlen(token);
+        if (static_cast<size_t>(end - p) < length || strncmp(p, token, length) != 0) {
+            return false;
+        }
+        // Keywords must not run into an identifier ("order" is not "or")
+        if (token[0] >= 'a' && token[0] <= 'z' && p + length < end) {
+            char next = p[length];
+            if ((next >= 'a' && next <= 'z') || (next >= 'A' && next <= 'Z') || (next >= '0' && next <= '9') || next == '_') {
+                return false;
+            }
+        }
+        p += length;
+        return true;
+    }
+
+    void parseOr() {
+        parseAnd();
+        while (!failed && (accept("or") || accept("||"))) {
+            parseAnd();
+            emit(OP_OR);
+        }
+    }
+
+    void parseAnd() {
+        parseComparison();
+        while (!failed && (accept("and") || accept("&&"))) {
+            parseComparison();
+            emit(OP_AND);
+        }
+    }
+
+    void parseComparison() {
+        parseAdditive();
+        uint8_t op;
+        if (accept("==") || accept("=")) op = OP_EQ;
+        else if (accept("!=")) op = OP_NE;
+        else if (accept("<=")) op = OP_LE;
+        else if (accept(">=")) op = OP_GE;
+        else if (accept("<")) op = OP_LT;
+        else if (accept(">")) op = OP_GT;
+        else return;
+        parseAdditive();
+        emit(op);
+    }
+
+    void parseAdditive() {
+        parseMultiplicative();
+        while (!failed) {
+            if (accept("+")) {
+                parseMultiplicative();
+                emit(OP_ADD);
+            } else if (accept("-")) {
+                parseMultiplicative();
+                emit(OP_SUB);
+            } else {
+                break;
+            }
+        }
+    }
+
+    void parseMultiplicative() {
+        parseUnary();
+        while (!failed) {
+            if (accept("*")) {
+                parseUnary();
+                emit(OP_MUL);
+            } else if (accept("/")) {
+                parseUnary();
+                emit(OP_DIV);
+            } else if (accept("%")) {
+                parseUnary();
+                emit(OP_MOD);
+            } else {
+                break;
+            }
+        }
+    }
+
+    void parseUnary() {
+        skipSpace();
+        if (accept("-")) {
+            parseUnary();
+            emit(OP_NEG);
+        } else if ((p + 1 < end && p[0] == '!' && p[1] != '=' && accept("!")) || accept("not")) {
+            parseUnary();
+            emit(OP_NOT);
+        } else {
+            parsePrimary();
+        }
+    }
+
+    void parsePrimary() {
+        skipSpace();
+        if (failed || p >= end) {
+            failed = true;
+            return;
+        }
+
+        char c = *p;
+        if (c == '(') {
+            p++;
+            parseOr();
+            if (!accept(")")) failed = true;
+        } else if ((c >= '0' && c <= '9') || c == '.') {
+            parseNumber();
+        } else if (c == '\'' || c == '"') {
+            parseString();
+        } else if (c == '$') {
+            parsePath();
+        } else if (accept("true")) {
+            emit(OP_TRUE);
+        } else if (accept("false")) {
+            emit(OP_FALSE);
+        } else if (accept("null")) {
+            emit(OP_NULL);
+        } else {
+            failed = true;
+        }
+    }
+
+    void parseNumber() {
+        double value = 0;
+        bool digits = false;
+        while (p < end && *p >= '0' && *p <= '9') {
+            value = value * 10 + (*p++ - '0');
+            digits = true;
+        }
+        if (p < end && *p == '.') {
+            p++;
+            double scale = 0.1;
+            while (p < end && *p >= '0' && *p <= '9') {
+                value += (*p++ - '0') * scale;
+                scale /= 10;
+                digits = true;
+            }
+        }
+        if (digits && p < end && (*p == 'e' || *p == 'E')) {
+            p++;
+            bool negative = p < end && *p == '-';
+            if (p < end && (*p == '-' || *p == '+')) p++;
+            int exponent = 0;
+            while (p < end && *p >= '0' && *p <= '9') exponent = exponent * 10 + (*p++ - '0');
+            value *= pow(10, negative ? -exponent : exponent);
+        }
+        if (!digits) {
+            failed = true;
+            return;
+        }
+
+        if (!grow(target.numbers, target.numberCount, numberCapacity)) {
+            failed = true;
+            return;
+        }
+        target.numbers[target.numberCount] = value;
+        emit(OP_NUMBER, target.numberCount++);
+    }
+
+    void parseString() {
+        char quote = *p++;
+        const char *start = p;
+        size_t length = 0;
+        while (p < end && *p != quote) {
+            if (*p == '\\' && p + 1 < end) p++;
+            p++;
+            length++;
+        }
+        if (p >= end) {
+            failed = true;
+            return;
+        }
+
+        char *value = new char[length + 1];
+        char *out = value;
+        for (const char *s = start; s < p; s++) {
+            if (*s == '\\') s++;
+            *out++ = *s;
+        }
+        *out = '\0';
+        p++;
+
+        if (!grow(target.strings, target.stringCount, stringCapacity)) {
+            delete[] value;
+            failed = true;
+            return;
+        }
+        target.strings[target.stringCount] = value;
+        emit(OP_STRING, target.stringCount++);
+    }
+
+    void parsePath() {
+        const char *start = p++;
+        while (p < end) {
+            char c = *p;
+            if ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_' || c == '.') {
+                p++;
+            } else if (c == '[') {
+                // Copy the whole bracket, including quoted keys that may contain ']'
+                p++;
+                char quote = (p < end && (*p == '\'' || *p == '"')) ? *p++ : 0;
+                while (p < end && (quote ? *p != quote : *p != ']')) p++;
+                if (quote && p < end) p++;
+                if (p < end && *p == ']') p++;
+            } else {
+                break;
+            }
+        }
+
+        VariablePath *path = new VariablePath();
+        if (!path->compile(start, p - start)) {
+            delete path;
+            failed = true;
+            return;
+        }
+
+        if (!grow(target.paths, target.pathCount, pathCapacity)) {
+            delete path;
+            failed = true;
+            return;
+        }
+        target.paths[target.pathCount] = path;
+        emit(OP_LOAD, target.pathCount++);
+    }
+};
+
+Expression::Expression() = default;
+
+Expression::~Expression() {
+    clear();
+}
+
+void Expression::clear() {
+    for (size_t i = 0; i < stringCount; i++) {
+        delete[] strings[i];
+    }
+    for (size_t i = 0; i < pathCount; i++) {
+        delete paths[i];
+    }
+    free(code);
+    free(numbers);
+    free(strings);
+    free(paths);
+    code = nullptr;
+    numbers = nullptr;
+    strings = nullptr;
+    paths = nullptr;
+    codeLength = numberCount = stringCount = pathCount = 0;
+}
+
+bool Expression::compile(const char *source) {
+    return compile(source, strlen(source));
+}
+
+bool Expression::compile(const char *source, size_t length) {
+    clear();
+
+    ExpressionParser parser(*this, source, length);
+    parser.parseOr();
+    parser.skipSpace();
+    if (parser.failed || parser.p != parser.end) {
+        clear();
+        return false;
+    }
+    return true;
+}
+
+bool Expression::unwrap(const char *text, const char *&body, size_t &length) {
+    if (!text) {
+        return false;
+    }
+    size_t size = strlen(text);
+    if (size < 4 || strncmp(text, "{%", 2) != 0 || strcmp(text + size - 2, "%}") != 0) {
+        return false;
+    }
+    body = text + 2;
+    length = size - 4;
+    return true;
+}
+
+/**
+ * @brief Converts a variable-store value into an evaluation value.
+ */
+static void load(JsonVariantConst variant, ExpressionValue &value) {
+    value.reference = JsonVariantConst();
+    if (variant.is<bool>()) {
+        value.type = ExpressionValue::BOOLEAN;
+        value.boolean = variant.as<bool>();
+    } else if (variant.is<const char *>()) {
+        value.type = ExpressionValue::STRING;
+        value.string = variant.as<const char *>();
+    } else if (variant.is<long>() || variant.is<unsigned long>() || variant.is<double>()) {
+        value.type = ExpressionValue::NUMBER;
+        value.number = variant.as<double>();
+    } else if (variant.is<JsonObjectConst>() || variant.is<JsonArrayConst>()) {
+        value.type = ExpressionValue::REFERENCE;
+        value.reference = variant;
+    } else {
+        value.type = ExpressionValue::NUL;
+    }
+}
+
+static bool equals(const ExpressionValue &a, const ExpressionValue &b) {
+    if (a.type != b.type) {
+        return false;
+    }
+    switch (a.type) {
+        case ExpressionValue::BOOLEAN:
+            return a.boolean == b.boolean;
+        case ExpressionValue::NUMBER:
+            return a.number == b.number;
+        case ExpressionValue::STRING:
+            return strcmp(a.string, b.string) == 0;
+        case ExpressionValue::REFERENCE:
+            return a.reference == b.reference;
+        default:
+            return true;
+    }
+}
+
+/**
+ * @brief Orders two values; only number/number and string/string pairs are ordered.
+ *
+ * @return False if the operands cannot be ordered.
+ */
+static bool compare(const ExpressionValue &a, const ExpressionValue &b, int &order) {
+    if (a.type == ExpressionValue::NUMBER && b.type == ExpressionValue::NUMBER) {
+        order = a.number < b.number ? -1 : (a.number > b.number ? 1 : 0);
+        return true;
+    }
+    if (a.type == ExpressionValue::STRING && b.type == ExpressionValue::STRING) {
+        order = strcmp(a.string, b.string);
+        return true;
+    }
+    return false;
+}
+
+bool Expression::evaluate(const Variables &variables, ExpressionValue &result) const {
+    ExpressionValue stack[EXPRESSION_STACK_SIZE];
+    size_t top = 0;
+
+    result = ExpressionValue();
+    if (codeLength == 0) {
+        return false;
+    }
+
+    for (size_t pc = 0; pc < codeLength; pc++) {
+        const Instruction &instruction = code[pc];
+        switch (instruction.op) {
+            case OP_NUMBER:
+                stack[top].type = ExpressionValue::NUMBER;
+                stack[top++].number = numbers[instruction.operand];
+                continue;
+            case OP_STRING:
+                stack[top].type = ExpressionValue::STRING;
+                stack[top++].string = strings[instruction.operand];
+                continue;
+            case OP_TRUE:
+            case OP_FALSE:
+                stack[top].type = ExpressionValue::BOOLEAN;
+                stack[top++].boolean = instruction.op == OP_TRUE;
+                continue;
+            case OP_NULL:
+                stack[top++].type = ExpressionValue::NUL;
+                continue;
+            case OP_LOAD:
+                load(variables.resolve(*paths[instruction.operand]), stack[top++]);
+                continue;
+            case OP_NEG:
+                if (stack[top - 1].type != ExpressionValue::NUMBER) return false;
+                stack[top - 1].number = -stack[top - 1].number;
+                continue;
+            case OP_NOT:
+                stack[top - 1].boolean = !stack[top - 1].truthy();
+                stack[top - 1].type = ExpressionValue::BOOLEAN;
+                continue;
+            default:
+                break;
+        }
+
+        // Binary operators
+        ExpressionValue &a = stack[top - 2];
+        const ExpressionValue &b = stack[top - 1];
+        top--;
+
+        if (instruction.op >= OP_ADD && instruction.op <= OP_MOD) {
+            if (a.type != ExpressionValue::NUMBER || b.type != ExpressionValue::NUMBER) {
+                return false;
+            }
+            switch (instruction.op) {
+                case OP_ADD: a.number += b.number; break;
+                case OP_SUB: a.number -= b.number; break;
+                case OP_MUL: a.number *= b.number; break;
+                case OP_DIV: a.number /= b.number; break;
+                default: a.number = fmod(a.number, b.number); break;
+            }
+            continue;
+        }
+
+        bool outcome;
+        int order;
+        switch (instruction.op) {
+            case OP_EQ: outcome = equals(a, b); break;
+            case OP_NE: outcome = !equals(a, b); break;
+            case OP_LT: outcome = compare(a, b, order) && order < 0; break;
+            case OP_LE: outcome = compare(a, b, order) && order <= 0; break;
+            case OP_GT: outcome = compare(a, b, order) && order > 0; break;
+            case OP_GE: outcome = compare(a, b, order) && order >= 0; break;
+            case OP_AND: outcome = a.truthy() && b.truthy(); break;
+            default: outcome = a.truthy() || b.truthy(); break;
+        }
+        a.type = ExpressionValue::BOOLEAN;
+        a.boolean = outcome;
+        a.reference = JsonVariantConst();
+    }
+
+    result = stack[0];
+    return true;
+}
@@ -0,0 +1,103 @@
+#include "FlashDevice.h"
+
+#ifndef ARDUINO
+#include <stdint.h>
+#include <string.h>
+
+FileFlashDevice::FileFlashDevice(const char *path, size_t sectorSize, size_t sectorCount)
+    : size(sectorSize), count(sectorCount), erases(new unsigned long[sectorCount]()), budget(SIZE_MAX) {
+    file = fopen(path, "r+b");
+    if (!file) {
+        file = fopen(path, "w+b");
+    }
+    if (!file) {
+        return;
+    }
+    // Grow the file to the full device, erased
+    fseek(file, 0, SEEK_END);
+    long length = ftell(file);
+    uint8_t erased[64];
+    memset(erased, 0xFF, sizeof(erased));
+    for (size_t total = size * count; length >= 0 && static_cast<size_t>(length) < total;) {
+        size_t chunk = total - length < sizeof(erased) ? total - length : sizeof(erased);
+        fwrite(erased, 1, chunk, file);
+        length += static_cast<long>(chunk);
+    }
+    fflush(file);
+}
+
+FileFlashDevice::~FileFlashDevice() {
+    if (file) {
+        fclose(file);
+    }
+    delete[] erases;
+}
+
+size_t FileFlashDevice::sectorSize() const {
+    return size;
+}
+
+size_t FileFlashDevice::sectorCount() const {
+    return count;
+}
+
+bool FileFlashDevice::inRange(size_t sector, size_t offset, size_t length) const {
+    return file && sector < count && offset <= size && length <= size - offset;
+}
+
+bool FileFlashDevice::erase(size_t sector) {
+    if (!inRange(sector, 0, size) || budget == 0) {
+        return false;
+    }
+    uint8_t erased[64];
+    memset(erased, 0xFF, sizeof(erased));
+    fseek(file, static_cast<long>(sector * size), SEEK_SET);
+    for (size_t done = 0; done < size; done += sizeof(erased)) {
+        fwrite(erased, 1, size - done < sizeof(erased) ? size - done : sizeof(erased), file);
+    }
+    fflush(file);
+    erases[sector]++;
+    return true;
+}
+
+bool FileFlashDevice::write(size_t sector, size_t offset, const uint8_t *data, size_t length) {
+    if (!inRange(sector, offset, length)) {
+        return false;
+    }
+    bool complete = length <= budget;
+    if (!complete) {
+        length = budget;
+    }
+    if (budget != SIZE_MAX) {
+        budget -= length;
+    }
+    // Programming can only clear bits, as on NOR flash
+    long position = static_cast<long>(sector * size + offset);
+    for (size_t i = 0; i < length; i++) {
+        uint8_t current = 0xFF;
+        fseek(file, position + static_cast<long>(i), SEEK_SET);
+        fread(&current, 1, 1, file);
+        current &= data[i];
+        fseek(file, position + static_cast<long>(i), SEEK_SET);
+        fwrite(&current, 1, 1, file);
+    }
+    fflush(file);
+    return complete;
+}
+
+bool FileFlashDevice::read(size_t sector, size_t offset, uint8_t *data, size_t length) {
+    if (!inRange(sector, offset, length)) {
+        return false;
+    }
+    fseek(file, static_cast<long>(sector * size + offset), SEEK_SET);
+    return fread(data, 1, length, file) == length;
+}
+
+unsigned long FileFlashDevice::eraseCount(size_t sector) const {
+    return sector < count ? erases[sector] : 0;
+}
+
+void FileFlashDevice::cutPowerAfter(size_t bytes) {
+    budget = bytes;
+}
+#endif
@@ -0,0 +1,156 @@
+#include "GlobMatcher.h"
+#include <string.h>
+#include <stdlib.h>
+
+/**
+ * @brief Reads the next pattern token.
+ *
+ * @param p The read position, advanced past the token.
+ * @param literal Receives the literal byte when the token is not a star.
+ * @return True for a (run of) `*`, false for a literal.
+ */
+static bool nextToken(const char *&p, uint8_t &literal) {
+    if (*p == '*') {
+        while (*p == '*') p++;
+        return true;
+    }
+    if (*p == '\\' && p[1] != '\0') {
+        p++;
+    }
+    literal = static_cast<uint8_t>(*p++);
+    return false;
+}
+
+static inline void setBit(uint32_t *bits, size_t index) {
+    bits[index / 32] |= 1UL << (index % 32);
+}
+
+GlobMatcher::GlobMatcher() {
+    memset(alphabet, 0, sizeof(alphabet));
+}
+
+GlobMatcher::~GlobMatcher() {
+    clear();
+    free(patterns);
+}
+
+void GlobMatcher::clear() {
+    delete[] literals;
+    delete[] stars;
+    delete[] initial;
+    delete[] accepting;
+    delete[] state;
+    literals = stars = initial = state = nullptr;
+    accepting = nullptr;
+    words = 0;
+}
+
+size_t GlobMatcher::add(const char *pattern) {
+    if (patternCount == patternCapacity) {
+        size_t next = patternCapacity == 0 ? 4 : patternCapacity * 2;
+        const char **grown = static_cast<const char **>(realloc(patterns, next * sizeof(const char *)));
+        if (!grown) {
+            // Not the next index: that one belongs to whichever pattern is added next
+            return SIZE_MAX;
+        }
+        patterns = grown;
+        patternCapacity = next;
+    }
+    patterns[patternCount] = pattern ? pattern : "";
+    return patternCount++;
+}
+
+bool GlobMatcher::compile() {
+    clear();
+    memset(alphabet, 0, sizeof(alphabet));
+
+    // Size the state vector and collect the alphabet
+    size_t bits = 0;
+    size_t classCount = 1;
+    for (size_t i = 0; i < patternCount; i++) {
+        const char *p = patterns[i];
+        while (*p) {
+            uint8_t literal;
+            if (!nextToken(p, literal) && alphabet[literal] == 0) {
+                alphabet[literal] = static_cast<uint8_t>(classCount++);
+            }
+            bits++;
+        }
+        bits++; // accepting position
+    }
+
+    words = (bits + 31) / 32;
+    if (words == 0) {
+        words = 1;
+    }
+    literals = new uint32_t[classCount * words]();
+    stars = new uint32_t[words]();
+    initial = new uint32_t[words]();
+    state = new uint32_t[words]();
+    accepting = new size_t[patternCount > 0 ? patternCount : 1];
+
+    // Lay out each pattern's positions back to back
+    size_t position = 0;
+    for (size_t i = 0; i < patternCount; i++) {
+        setBit(initial, position);
+        const char *p = patterns[i];
+        while (*p) {
+            uint8_t literal;
+            if (nextToken(p, literal)) {
+                setBit(stars, position);
+            } else {
+                setBit(literals + alphabet[literal] * words, position);
+            }
+            position++;
+        }
+        accepting[i] = position++;
+    }
+
+    // A leading star may match nothing
+    uint32_t carry = 0;
+    for (size_t w = 0; w < words; w++) {
+        uint32_t skipped = initial[w] & stars[w];
+        initial[w] |= (skipped << 1) | carry;
+        carry = skipped >> 31;
+    }
+
+    // The patterns are no longer needed once compiled
+    free(patterns);
+    patterns = nullptr;
+    patternCapacity = 0;
+    return true;
+}
+
+void GlobMatcher::match(const char *text) const {
+    memcpy(state, initial, words * sizeof(uint32_t));
+
+    for (const uint8_t *c = reinterpret_cast<const uint8_t *>(text); *c; c++) {
+        const uint32_t *literal = literals + alphabet[*c] * words;
+
+        // Advance over literals, stay on stars
+        uint32_t carry = 0;
+        uint32_t alive = 0;
+        for (size_t w = 0; w < words; w++) {
+            uint32_t advanced = state[w] & literal[w];
+            state[w] = (advanced << 1) | carry | (state[w] & stars[w]);
+            carry = advanced >> 31;
+            alive |= state[w];
+        }
+        if (!alive) {
+            return;
+        }
+
+        // Let every star also match nothing
+        carry = 0;
+        for (size_t w = 0; w < words; w++) {
+            uint32_t skipped = state[w] & stars[w];
+            state[w] |= (skipped << 1) | carry;
+            carry = skipped >> 31;
+        }
+    }
+}
+
+bool GlobMatcher::matched(size_t pattern) const {
+    size_t position = accepting[pattern];
+    return (state[position / 32] >> (position % 32)) & 1;
+}
@@ -0,0 +1,99 @@
+#include "JournalReplay.h"
+
+JournalReplay::JournalReplay(Stream &journal) : journal(journal) {
+}
+
+unsigned long JournalReplay::virtualClock(void *replay) {
+    return static_cast<JournalReplay *>(replay)->clock;
+}
+
+void JournalReplay::fail(const String &what) {
+    if (!mismatch) {
+        mismatch = true;
+        reason = what;
+    }
+}
+
+JsonVariantConst JournalReplay::taskOutcome(const String &resource) {
+    if (!taskPending || task["r"].as<String>() != resource) {
+        fail("Task " + resource + " has no recorded outcome");
+        return JsonVariantConst();
+    }
+    taskPending = false;
+    return task["v"];
+}
+
+bool JournalReplay::next(StepFunction &execution) {
+    if (mismatch) {
+        return false;
+    }
+    execution.setClock(virtualClock, this);
+    execution.replay = this;
+    taskPending = false;
+
+    bool replayed = false;
+    for (;;) {
+        DeserializationError error = deserializeJson(record, journal);
+        if (error) {
+            if (error != DeserializationError::EmptyInput) {
+                fail("Malformed journal line");
+            }
+            break;
+        }
+        // Every event happened at its recorded time; the next run() sees the same clock as the device did
+        clock = record["t"].as<unsigned long>();
+        String event = record["e"].as<String>();
+        if (event == "snapshot") {
+            JsonDocument saved;
+            saved.set(record["v"]);
+            if (!execution.restore(saved)) {
+                fail("Journal snapshot is from another definition");
+                break;
+            }
+        } else if (event == "start") {
+            execution.start(record["v"].as<JsonVariantConst>());
+        } else if (event == "set") {
+            execution.setVariable(record["n"].as<const char *>(), record["v"].as<JsonVariantConst>());
+        } else if (event == "task") {
+            task.set(record.as<JsonVariantConst>());
+            taskPending = true;
+        } else if (event == "run") {
+            runCount++;
+            int result = execution.run();
+            if (taskPending) {
+                fail("Run " + String(runCount) + " did not execute Task " + task["r"].as<String>());
+            }
+            if (result != record["r"].as<int>() || execution.currentState != record["s"].as<String>()) {
+                fail("Run " + String(runCount) + " returned " + String(result) + " in " + execution.currentState +
+                     ", journal has " + String(record["r"].as<int>()) + " in " + record["s"].as<String>());
+            }
+            replayed = true;
+            break;
+        }
+    }
+
+    execution.replay = nullptr;
+    return replayed && !mismatch;
+}
+
+bool JournalReplay::replay(StepFunction &execution) {
+    while (next(execution)) {
+    }
+    return !mismatch;
+}
+
+bool JournalReplay::diverged() const {
+    return mismatch;
+}
+
+const char *JournalReplay::divergence() const {
+    return reason.c_str();
+}
+
+unsigned long JournalReplay::runs() const {
+    return runCount;
+}
+
+unsigned long JournalReplay::now() const {
+    return clock;
+}
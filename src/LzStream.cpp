@@ -0,0 +1,204 @@
+#include "LzStream.h"
+#include <string.h>
+
+// Header: magic, 'L', 'Z', then the window bits in the high nibble and the lookahead bits in the low one
+static const uint8_t LZ_HEADER[3] = {LZ_MAGIC, 'L', 'Z'};
+
+// A back-reference costs 1 + W + L bits, so it only pays off from two bytes up
+#define LZ_MIN_MATCH 2
+
+LzEncoder::LzEncoder(Print &destination) : destination(destination) {
+}
+
+void LzEncoder::start() {
+    started = true;
+    written += destination.write(LZ_HEADER, sizeof(LZ_HEADER));
+    written += destination.write(static_cast<uint8_t>((LZ_WINDOW_BITS << 4) | LZ_LOOKAHEAD_BITS));
+}
+
+size_t LzEncoder::write(uint8_t value) {
+    if (!started) {
+        start();
+    }
+    if (pending == LZ_LOOKAHEAD_SIZE) {
+        encode();
+    }
+    lookahead[pending++] = value;
+    return 1;
+}
+
+void LzEncoder::putBits(uint16_t value, uint8_t count) {
+    while (count > 0) {
+        count--;
+        bits = static_cast<uint8_t>((bits << 1) | ((value >> count) & 1));
+        if (++bitCount == 8) {
+            written += destination.write(bits);
+            bits = 0;
+            bitCount = 0;
+        }
+    }
+}
+
+void LzEncoder::encode() {
+    // Greedy longest match; a match may run on into the lookahead, which encodes runs cheaply
+    size_t bestLength = 0;
+    size_t bestDistance = 0;
+    for (size_t distance = 1; distance <= filled; distance++) {
+        size_t start = (head + LZ_WINDOW_SIZE - distance) & (LZ_WINDOW_SIZE - 1);
+        size_t length = 0;
+        while (length < pending) {
+            uint8_t candidate = length < distance ? window[(start + length) & (LZ_WINDOW_SIZE - 1)]
+                                                  : lookahead[length - distance];
+            if (candidate != lookahead[length]) {
+                break;
+            }
+            length++;
+        }
+        if (length > bestLength) {
+            bestLength = length;
+            bestDistance = distance;
+            if (length == pending) {
+                break;
+            }
+        }
+    }
+
+    size_t consumed;
+    if (bestLength >= LZ_MIN_MATCH) {
+        putBits(0, 1);
+        putBits(static_cast<uint16_t>(bestDistance - 1), LZ_WINDOW_BITS);
+        putBits(static_cast<uint16_t>(bestLength - 1), LZ_LOOKAHEAD_BITS);
+        consumed = bestLength;
+    } else {
+        putBits(1, 1);
+        putBits(lookahead[0], 8);
+        consumed = 1;
+    }
+
+    for (size_t i = 0; i < consumed; i++) {
+        window[head] = lookahead[i];
+        head = (head + 1) & (LZ_WINDOW_SIZE - 1);
+    }
+    filled = filled + consumed < LZ_WINDOW_SIZE ? filled + consumed : LZ_WINDOW_SIZE;
+    pending -= consumed;
+    memmove(lookahead, lookahead + consumed, pending);
+}
+
+size_t LzEncoder::finish() {
+    if (!started) {
+        start();
+    }
+    while (pending > 0) {
+        encode();
+    }
+    // Fewer than 8 padding bits can never complete a token, so the decoder stops at them
+    if (bitCount > 0) {
+        putBits(0, 8 - bitCount);
+    }
+    return written;
+}
+
+LzDecoder::LzDecoder(Stream &source) : source(source) {
+    // End of input is final; do not wait for more bytes
+    setTimeout(0);
+}
+
+bool LzDecoder::readHeader() {
+    for (uint8_t expected: LZ_HEADER) {
+        if (source.read() != expected) {
+            return false;
+        }
+    }
+    int parameters = source.read();
+    if (parameters < 0) {
+        return false;
+    }
+    windowBits = static_cast<uint8_t>(parameters >> 4);
+    lookaheadBits = static_cast<uint8_t>(parameters & 0x0F);
+    return windowBits > 0 && windowBits <= LZ_WINDOW_BITS && lookaheadBits > 0 && lookaheadBits <= 8;
+}
+
+bool LzDecoder::valid() {
+    if (status == 0) {
+        status = readHeader() ? 1 : -1;
+    }
+    return status > 0;
+}
+
+int LzDecoder::getBits(uint8_t count) {
+    int value = 0;
+    while (count > 0) {
+        if (bitCount == 0) {
+            int byte = source.read();
+            if (byte < 0) {
+                return -1;
+            }
+            bits = static_cast<uint8_t>(byte);
+            bitCount = 8;
+        }
+        value = (value << 1) | ((bits >> 7) & 1);
+        bits <<= 1;
+        bitCount--;
+        count--;
+    }
+    return value;
+}
+
+int LzDecoder::produce() {
+    if (!valid() || status != 1) {
+        return -1;
+    }
+    // Any token cut short by the end of the source, including the padding, ends the output
+    if (copyRemaining == 0) {
+        int tag = getBits(1);
+        if (tag < 0) {
+            status = 2;
+            return -1;
+        }
+        if (tag == 1) {
+            int literal = getBits(8);
+            if (literal < 0) {
+                status = 2;
+                return -1;
+            }
+            window[head] = static_cast<uint8_t>(literal);
+            head = (head + 1) & (LZ_WINDOW_SIZE - 1);
+            return literal;
+        }
+        int offset = getBits(windowBits);
+        int length = offset < 0 ? -1 : getBits(lookaheadBits);
+        if (length < 0) {
+            status = 2;
+            return -1;
+        }
+        copyOffset = static_cast<size_t>(offset) + 1;
+        copyRemaining = static_cast<size_t>(length) + 1;
+    }
+
+    uint8_t value = window[(head + LZ_WINDOW_SIZE - copyOffset) & (LZ_WINDOW_SIZE - 1)];
+    window[head] = value;
+    head = (head + 1) & (LZ_WINDOW_SIZE - 1);
+    copyRemaining--;
+    return value;
+}
+
+int LzDecoder::peek() {
+    if (next < 0) {
+        next = produce();
+    }
+    return next;
+}
+
+int LzDecoder::read() {
+    int value = peek();
+    next = -1;
+    return value;
+}
+
+int LzDecoder::available() {
+    return peek() >= 0 ? 1 : 0;
+}
+
+size_t LzDecoder::write(uint8_t) {
+    return 0;
+}
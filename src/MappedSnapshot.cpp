@@ -0,0 +1,94 @@
+#include "MappedSnapshot.h"
+
+#ifndef ARDUINO
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+MappedSnapshot::MappedSnapshot(const char *path, bool sequential) {
+    int descriptor = ::open(path, O_RDONLY);
+    if (descriptor < 0) {
+        return;
+    }
+    struct stat info;
+    if (fstat(descriptor, &info) == 0 && info.st_size > 0) {
+        void *mapped = mmap(nullptr, static_cast<size_t>(info.st_size), PROT_READ, MAP_PRIVATE, descriptor, 0);
+        if (mapped != MAP_FAILED) {
+            mapping = static_cast<uint8_t *>(mapped);
+            length = static_cast<size_t>(info.st_size);
+            // Executions resume in file order but run in any order; only a full scan benefits from read-ahead
+            madvise(mapped, length, sequential ? MADV_SEQUENTIAL : MADV_RANDOM);
+        }
+    }
+    // The mapping keeps the file alive
+    ::close(descriptor);
+}
+
+MappedSnapshot::~MappedSnapshot() {
+    if (mapping) {
+        munmap(mapping, length);
+    }
+}
+
+bool MappedSnapshot::isOpen() const {
+    return mapping != nullptr;
+}
+
+const uint8_t *MappedSnapshot::data() const {
+    return mapping;
+}
+
+size_t MappedSnapshot::size() const {
+    return length;
+}
+
+bool MappedSnapshot::next(size_t &offset, const uint8_t *&data, size_t &recordLength) const {
+    if (!mapping || offset > length || length - offset < 4) {
+        return false;
+    }
+    const uint8_t *prefix = mapping + offset;
+    size_t size = static_cast<size_t>(prefix[0]) | static_cast<size_t>(prefix[1]) << 8 |
+                  static_cast<size_t>(prefix[2]) << 16 | static_cast<size_t>(prefix[3]) << 24;
+    if (size > length - offset - 4) {
+        return false;
+    }
+    data = prefix + 4;
+    recordLength = size;
+    offset += 4 + size;
+    return true;
+}
+
+SnapshotRecordWriter::SnapshotRecordWriter(FILE *file) : file(file) {
+    static const uint8_t placeholder[4] = {0, 0, 0, 0};
+    start = ftell(file);
+    failed = start < 0 || fwrite(placeholder, 1, sizeof(placeholder), file) != sizeof(placeholder);
+}
+
+size_t SnapshotRecordWriter::write(uint8_t value) {
+    return write(&value, 1);
+}
+
+size_t SnapshotRecordWriter::write(const uint8_t *data, size_t size) {
+    if (failed) {
+        return 0;
+    }
+    size_t done = fwrite(data, 1, size, file);
+    written += done;
+    failed = done != size;
+    return done;
+}
+
+bool SnapshotRecordWriter::finish() {
+    if (failed || written > 0xFFFFFFFFUL) {
+        return false;
+    }
+    uint8_t prefix[4] = {
+        static_cast<uint8_t>(written), static_cast<uint8_t>(written >> 8),
+        static_cast<uint8_t>(written >> 16), static_cast<uint8_t>(written >> 24)
+    };
+    long end = ftell(file);
+    return fseek(file, start, SEEK_SET) == 0 && fwrite(prefix, 1, sizeof(prefix), file) == sizeof(prefix) &&
+           fseek(file, end, SEEK_SET) == 0;
+}
+#endif
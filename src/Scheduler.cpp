@@ -0,0 +1,581 @@
+#include "Scheduler.h"
+#include <Arduino.h>
+#include <string.h>
+#include <new>
+
+Scheduler::Scheduler(StepFunction::FunctionCallback callback, size_t poolSize, size_t triggerCapacity,
+                     size_t queueCapacity)
+    : Scheduler(callback, nullptr, poolSize, triggerCapacity, queueCapacity) {
+}
+
+Scheduler::Scheduler(StepFunction::TaskHandler handler, size_t poolSize, size_t triggerCapacity,
+                     size_t queueCapacity)
+    : Scheduler(nullptr, handler, poolSize, triggerCapacity, queueCapacity) {
+}
+
+Scheduler::Scheduler(StepFunction::FunctionCallback callback, StepFunction::TaskHandler handler, size_t poolSize,
+                     size_t triggerCapacity, size_t queueCapacity)
+    : pool(static_cast<StepFunction *>(::operator new(sizeof(StepFunction) * poolSize))),
+      running(new StepDefinition *[poolSize]()),
+      freeSlots(new uint32_t[poolSize]),
+      freeCount(poolSize),
+      poolSize(poolSize),
+      triggers(new Trigger[triggerCapacity]),
+      triggerCapacity(triggerCapacity),
+      queue(poolSize + triggerCapacity),
+      pending(new Pending[queueCapacity]),
+      pendingCapacity(queueCapacity),
+      concurrencyLimit(poolSize) {
+    for (size_t i = 0; i < poolSize; i++) {
+        if (handler) {
+            new(&pool[i]) StepFunction(handler);
+        } else {
+            new(&pool[i]) StepFunction(callback);
+        }
+        pool[i].setWaitListener(waitMoved, this);
+        // Lowest slots on top, so executions start in slot order
+        freeSlots[i] = static_cast<uint32_t>(poolSize - 1 - i);
+    }
+}
+
+Scheduler::~Scheduler() {
+    for (size_t i = 0; i < poolSize; i++) {
+        pool[i].~StepFunction();
+    }
+    ::operator delete(pool);
+    delete[] running;
+    delete[] freeSlots;
+    delete[] pending;
+    for (size_t i = 0; i < triggerCount; i++) {
+        delete triggers[i].cron;
+    }
+    delete[] triggers;
+}
+
+int Scheduler::addInterval(StepDefinition &definition, unsigned long period, MissedFire missed) {
+    if (triggerCount == triggerCapacity || period == 0) {
+        return -1;
+    }
+    Trigger &trigger = triggers[triggerCount];
+    trigger = {&definition, period, nullptr, clockMillis() + period, 0, missed, true, false};
+    schedule(triggerCount);
+    return static_cast<int>(triggerCount++);
+}
+
+int Scheduler::addCron(StepDefinition &definition, const char *expression, MissedFire missed) {
+    if (triggerCount == triggerCapacity) {
+        return -1;
+    }
+    CronExpression *cron = new CronExpression();
+    if (!cron->compile(expression)) {
+#ifdef LOG
+        Serial.print("Invalid cron expression: ");
+        Serial.println(expression);
+#endif
+        delete cron;
+        return -1;
+    }
+    Trigger &trigger = triggers[triggerCount];
+    trigger = {&definition, 0, cron, 0, 0, missed, true, false};
+    if (epochBase != 0) {
+        uint32_t now = epochBase + (clockMillis() - epochMillis) / 1000;
+        trigger.nextEpoch = cron->next(now);
+        trigger.next = toMillis(trigger.nextEpoch);
+        schedule(triggerCount);
+    }
+    return static_cast<int>(triggerCount++);
+}
+
+void Scheduler::setEnabled(int index, bool enabled) {
+    if (index < 0 || static_cast<size_t>(index) >= triggerCount) {
+        return;
+    }
+    Trigger &trigger = triggers[index];
+    if (enabled && !trigger.enabled) {
+        unsigned long now = clockMillis();
+        if (trigger.cron) {
+            if (epochBase == 0) {
+                trigger.enabled = true;
+                return;
+            }
+            trigger.nextEpoch = trigger.cron->next(epochBase + (now - epochMillis) / 1000);
+            trigger.next = toMillis(trigger.nextEpoch);
+        } else {
+            trigger.next = now + trigger.period;
+        }
+    }
+    trigger.enabled = enabled;
+    if (enabled) {
+        schedule(index);
+    }
+}
+
+void Scheduler::setEpoch(uint32_t epochSeconds) {
+    epochBase = epochSeconds;
+    epochMillis = clockMillis();
+
+    // Cron fire times were unknown, or are now off by the clock correction
+    for (size_t i = 0; i < triggerCount; i++) {
+        Trigger &trigger = triggers[i];
+        if (trigger.cron && trigger.enabled) {
+            trigger.nextEpoch = trigger.cron->next(epochSeconds);
+            trigger.next = toMillis(trigger.nextEpoch);
+            schedule(i);
+        }
+    }
+}
+
+unsigned long Scheduler::toMillis(uint32_t epochSeconds) const {
+    return epochMillis + (epochSeconds - epochBase) * 1000UL;
+}
+
+void Scheduler::schedule(size_t index) {
+    Trigger &trigger = triggers[index];
+    if (trigger.queued || (trigger.cron && trigger.nextEpoch == 0)) {
+        return;
+    }
+    trigger.queued = queue.push(trigger.next, static_cast<uint32_t>(poolSize + index));
+}
+
+#if defined(ESP32) || defined(ESP8266)
+static size_t platformFreeMemory() {
+    return ESP.getFreeHeap();
+}
+#endif
+
+void Scheduler::setSharedScope(JsonVariantConst scope) {
+    for (size_t i = 0; i < poolSize; i++) {
+        pool[i].setSharedScope(scope);
+    }
+}
+
+void Scheduler::setBlobPool(BlobPool &blobs) {
+    for (size_t i = 0; i < poolSize; i++) {
+        pool[i].setBlobPool(blobs);
+    }
+}
+
+void Scheduler::setConcurrencyLimit(size_t limit) {
+    concurrencyLimit = limit < poolSize ? limit : poolSize;
+}
+
+bool Scheduler::setQuota(StepDefinition &definition, size_t limit) {
+    for (size_t i = 0; i < quotaCount; i++) {
+        if (quotas[i].definition == &definition) {
+            if (limit == 0) {
+                quotas[i] = quotas[--quotaCount];
+            } else {
+                quotas[i].limit = limit;
+            }
+            return true;
+        }
+    }
+    if (limit == 0) {
+        return true;
+    }
+    if (quotaCount == SCHEDULER_MAX_QUOTAS) {
+        return false;
+    }
+    size_t active = 0;
+    for (size_t i = 0; i < poolSize; i++) {
+        active += running[i] == &definition ? 1 : 0;
+    }
+    quotas[quotaCount++] = {&definition, limit, active};
+    return true;
+}
+
+void Scheduler::setLowMemoryThreshold(size_t threshold, size_t (*memory)()) {
+    lowMemoryThreshold = threshold;
+    freeMemory = memory;
+#if defined(ESP32) || defined(ESP8266)
+    if (!freeMemory) {
+        freeMemory = platformFreeMemory;
+    }
+#endif
+}
+
+void Scheduler::setShedPolicy(ShedPolicy policy) {
+    shedPolicy = policy;
+}
+
+void Scheduler::setRegistry(DefinitionRegistry &definitions) {
+    registry = &definitions;
+}
+
+void Scheduler::setClock(StepFunction::Clock source, void *context) {
+    clock = source;
+    clockContext = context;
+    for (size_t i = 0; i < poolSize; i++) {
+        pool[i].setClock(source, context);
+    }
+}
+
+unsigned long Scheduler::clockMillis() const {
+    return clock ? clock(clockContext) : millis();
+}
+
+void Scheduler::setSnapshotWriter(AsyncSnapshotStore *writer, size_t budget) {
+    snapshotWriter = writer;
+    snapshotBudget = budget > 0 ? budget : 1;
+}
+
+bool Scheduler::admissible(const StepDefinition *definition) const {
+    if (poolSize - freeCount >= concurrencyLimit) {
+        return false;
+    }
+    for (size_t i = 0; i < quotaCount; i++) {
+        if (quotas[i].definition == definition && quotas[i].active >= quotas[i].limit) {
+            return false;
+        }
+    }
+    // Every execution grows its own document, so admission stops before the heap runs out
+    if (lowMemoryThreshold > 0 && freeMemory && freeMemory() < lowMemoryThreshold) {
+        return false;
+    }
+    return true;
+}
+
+long Scheduler::claim(StepDefinition &definition, bool prepare) {
+    if (freeCount == 0) {
+        return -1;
+    }
+    uint32_t slot = freeSlots[--freeCount];
+    running[slot] = &definition;
+    for (size_t i = 0; i < quotaCount; i++) {
+        if (quotas[i].definition == &definition) {
+            quotas[i].active++;
+        }
+    }
+    // Wakeups are only right while the execution keeps the scheduler's clock
+    pool[slot].setClock(clock, clockContext);
+    if (prepare) {
+        pool[slot].setup(definition);
+    }
+    counters.admitted++;
+    return static_cast<long>(slot);
+}
+
+void Scheduler::release(uint32_t slot) {
+    for (size_t i = 0; i < quotaCount; i++) {
+        if (quotas[i].definition == running[slot]) {
+            quotas[i].active--;
+        }
+    }
+    running[slot] = nullptr;
+    freeSlots[freeCount++] = slot;
+}
+
+StepFunction *Scheduler::start(StepDefinition &definition) {
+    long slot = claim(definition);
+    if (slot < 0) {
+        return nullptr;
+    }
+    queue.push(clockMillis(), static_cast<uint32_t>(slot));
+    return &pool[slot];
+}
+
+StepFunction *Scheduler::fork(StepFunction &parent) {
+    StepDefinition *definition = parent.getDefinition();
+    if (!definition || !admissible(definition)) {
+        return nullptr;
+    }
+    // fork() clears and binds the child itself
+    long slot = claim(*definition, false);
+    if (slot < 0) {
+        return nullptr;
+    }
+    parent.fork(pool[slot]);
+    queue.push(clockMillis(), static_cast<uint32_t>(slot));
+    return &pool[slot];
+}
+
+StepFunction *Scheduler::resume(StepDefinition &definition, const uint8_t *snapshot, size_t length) {
+    if (!admissible(&definition)) {
+        return nullptr;
+    }
+    long slot = claim(definition);
+    if (slot < 0) {
+        return nullptr;
+    }
+    if (!pool[slot].restoreStateLazy(snapshot, length)) {
+        counters.admitted--;
+        release(static_cast<uint32_t>(slot));
+        return nullptr;
+    }
+    // A waiting execution sleeps in the queue until its timer, still undecoded
+    unsigned long now = clockMillis();
+    unsigned long wake = pool[slot].getWaitUntil();
+    queue.push(static_cast<long>(wake - now) > 0 ? wake : now, static_cast<uint32_t>(slot));
+    return &pool[slot];
+}
+
+size_t Scheduler::spawnAll(StepDefinition &definition, JsonArrayConst inputs) {
+    size_t started = 0;
+    unsigned long now = clockMillis();
+    for (JsonVariantConst input: inputs) {
+        if (!admissible(&definition)) {
+            break;
+        }
+        // start() sets the slot up, so claiming it skips a second clear and allocation
+        long slot = claim(definition, false);
+        pool[slot].start(definition, input);
+        // Equal deadlines never sift, so seeding the queue costs O(1) per execution
+        queue.push(now, static_cast<uint32_t>(slot));
+        started++;
+    }
+    return started;
+}
+
+size_t Scheduler::spawnAll(StepDefinition &definition, Stream &jsonLines) {
+    size_t started = 0;
+    unsigned long now = clockMillis();
+    while (admissible(&definition)) {
+        long slot = claim(definition, false);
+        DeserializationError error;
+        if (!pool[slot].start(definition, jsonLines, &error)) {
+            // Hand the slot back unused; only the end of the stream ends the batch
+            counters.admitted--;
+            release(static_cast<uint32_t>(slot));
+            if (error == DeserializationError::EmptyInput) {
+                break;
+            }
+            counters.malformed++;
+            if (!error) {
+                // A document that is not an object ended where it parsed; a scalar may have taken its newline
+                continue;
+            }
+            for (int c = jsonLines.read(); c >= 0 && c != '\n'; c = jsonLines.read()) {
+            }
+            continue;
+        }
+        queue.push(now, static_cast<uint32_t>(slot));
+        started++;
+    }
+    return started;
+}
+
+StepFunction *Scheduler::spawn(StepDefinition &definition) {
+    if (!admissible(&definition)) {
+#ifdef LOG
+        Serial.println("Execution not admitted.");
+#endif
+        return nullptr;
+    }
+    return start(definition);
+}
+
+StepFunction *Scheduler::spawn(const char *name) {
+    StepDefinition *definition = registry ? registry->find(name) : nullptr;
+    if (!definition) {
+#ifdef LOG
+        Serial.println("No definition registered under that name.");
+#endif
+        return nullptr;
+    }
+    return spawn(*definition);
+}
+
+/**
+ * @brief Hashes a coalescing key (FNV-1a); never returns 0, which means "no key".
+ */
+static uint32_t hashKey(const char *key) {
+    uint32_t hash = 2166136261UL;
+    while (*key) {
+        hash = (hash ^ static_cast<uint8_t>(*key++)) * 16777619UL;
+    }
+    return hash ? hash : 1;
+}
+
+Admission Scheduler::submit(StepDefinition &definition, const char *key) {
+    uint32_t hash = key ? hashKey(key) : 0;
+
+    // Only start directly when nothing older is waiting for the same definition
+    bool waiting = false;
+    for (size_t i = 0; i < pendingCount; i++) {
+        if (pending[i].definition == &definition) {
+            waiting = true;
+            if (shedPolicy == SHED_COALESCE && hash != 0 && pending[i].key == hash) {
+                counters.coalesced++;
+                return COALESCED;
+            }
+        }
+    }
+    if (!waiting && admissible(&definition) && start(definition)) {
+        return ADMITTED;
+    }
+
+    if (pendingCount == pendingCapacity) {
+        if (shedPolicy != SHED_DROP_OLDEST || pendingCapacity == 0) {
+            counters.rejected++;
+#ifdef LOG
+            Serial.println("Start queue full; start rejected.");
+#endif
+            return REJECTED;
+        }
+        memmove(pending, pending + 1, (pendingCount - 1) * sizeof(Pending));
+        pendingCount--;
+        counters.dropped++;
+    }
+    pending[pendingCount++] = {&definition, hash};
+    counters.queued++;
+    return QUEUED;
+}
+
+void Scheduler::drain() {
+    size_t index = 0;
+    while (index < pendingCount) {
+        // A start blocked by its quota does not hold back other definitions
+        if (!admissible(pending[index].definition)) {
+            if (lowMemoryThreshold > 0 && freeMemory && freeMemory() < lowMemoryThreshold) {
+                return;
+            }
+            index++;
+            continue;
+        }
+        if (!start(*pending[index].definition)) {
+            return;
+        }
+        memmove(pending + index, pending + index + 1, (pendingCount - index - 1) * sizeof(Pending));
+        pendingCount--;
+    }
+}
+
+size_t Scheduler::queued() const {
+    return pendingCount;
+}
+
+const Scheduler::AdmissionStats &Scheduler::stats() const {
+    return counters;
+}
+
+void Scheduler::fire(Trigger &trigger, unsigned long now) {
+    // Count the fire times that are already due, including the current one
+    size_t due = 1;
+    if (trigger.cron) {
+        uint32_t nowEpoch = epochBase + (now - epochMillis) / 1000;
+        uint32_t next = trigger.cron->next(trigger.nextEpoch);
+        while (next != 0 && next <= nowEpoch) {
+            if (due < poolSize) {
+                due++;
+            }
+            next = trigger.cron->next(next);
+        }
+        trigger.nextEpoch = next;
+        trigger.next = toMillis(next);
+    } else {
+        unsigned long late = now - trigger.next;
+        unsigned long missed = late / trigger.period;
+        due += missed < poolSize ? missed : poolSize;
+        trigger.next += (missed + 1) * trigger.period;
+    }
+
+    size_t starts = 1;
+    if (trigger.missed == MISSED_FIRE_ALL) {
+        starts = due;
+    } else if (trigger.missed == MISSED_FIRE_SKIP && due > 1) {
+        starts = 0;
+#ifdef LOG
+        Serial.println("Trigger fired late; skipped.");
+#endif
+    }
+    for (size_t i = 0; i < starts; i++) {
+        submit(*trigger.definition);
+    }
+}
+
+void Scheduler::runSlot(uint32_t slot, unsigned long now) {
+    StepFunction &execution = pool[slot];
+    for (int step = 0; step < SCHEDULER_MAX_STEPS; step++) {
+        int status = execution.run();
+        if (status == NEXT_STEP) {
+            continue;
+        }
+        if (status == WAIT_DELAY) {
+            queue.push(execution.getWaitUntil(), slot);
+        } else {
+            // END_OF_PROCESS or INVALID_STATE: recycle the slot
+            release(slot);
+        }
+        return;
+    }
+    // Used its share of steps; continue on the next tick so others get to run
+    queue.push(now, slot);
+}
+
+void Scheduler::waitMoved(void *scheduler, StepFunction &execution) {
+    Scheduler &self = *static_cast<Scheduler *>(scheduler);
+    uint32_t slot = static_cast<uint32_t>(&execution - self.pool);
+    if (self.running[slot]) {
+        // One wakeup when the restarted window expires, not one at the old deadline as well
+        self.queue.reschedule(slot, execution.getWaitUntil());
+    }
+}
+
+void Scheduler::tick() {
+    unsigned long now = clockMillis();
+
+    // Slots freed since the last tick go to queued starts first
+    drain();
+    size_t budget = queue.size();
+
+    // Only entries that were due when the tick started are handled, so a busy execution cannot starve the caller
+    while (!queue.empty() && budget-- > 0 && !TimerQueue::before(now, queue.top().deadline)) {
+        TimerQueue::Entry entry = queue.top();
+        queue.pop();
+
+        if (entry.id >= poolSize) {
+            Trigger &trigger = triggers[entry.id - poolSize];
+            trigger.queued = false;
+            if (!trigger.enabled) {
+                continue;
+            }
+            if (entry.deadline != trigger.next) {
+                // Rescheduled since this entry was queued
+                schedule(entry.id - poolSize);
+                continue;
+            }
+            fire(trigger, now);
+            if (!trigger.cron || trigger.nextEpoch != 0) {
+                schedule(entry.id - poolSize);
+            }
+            budget = queue.size();
+            continue;
+        }
+
+        if (!running[entry.id]) {
+            continue;
+        }
+        StepFunction &execution = pool[entry.id];
+        if (TimerQueue::before(now, execution.getWaitUntil())) {
+            // The wait was extended since this entry was queued (e.g. a Debounce restart)
+            queue.push(execution.getWaitUntil(), entry.id);
+            continue;
+        }
+        runSlot(entry.id, now);
+        if (!running[entry.id] && pendingCount > 0) {
+            drain();
+            budget = queue.size();
+        }
+    }
+
+    // Snapshots captured by the executions above are written a slice at a time
+    if (snapshotWriter) {
+        snapshotWriter->poll(snapshotBudget);
+    }
+}
+
+unsigned long Scheduler::nextWakeup() const {
+    if (snapshotWriter && snapshotWriter->pending() > 0) {
+        return 0;
+    }
+    if (queue.empty()) {
+        return static_cast<unsigned long>(-1);
+    }
+    unsigned long now = clockMillis();
+    unsigned long deadline = queue.top().deadline;
+    return TimerQueue::before(now, deadline) ? deadline - now : 0;
+}
+
+size_t Scheduler::active() const {
+    return poolSize - freeCount;
+}
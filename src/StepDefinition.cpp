@@ -0,0 +1,772 @@
+#include "StepDefinition.h"
+#include "HashPrint.h"
+#include <Arduino.h>
+#include <string.h>
+
+/**
+ * @brief Returns false if two renames share a target name.
+ */
+static bool distinctTargets(JsonObjectConst renames) {
+    for (JsonPairConst rename: renames) {
+        const char *to = rename.value().as<const char *>();
+        for (JsonPairConst other: renames) {
+            if (strcmp(other.key().c_str(), rename.key().c_str()) == 0) {
+                break;
+            }
+            const char *otherTo = other.value().as<const char *>();
+            if (to && otherTo && strcmp(to, otherTo) == 0) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief Returns the new name of member, or nullptr if renames leaves it where it is.
+ */
+static const char *renamedTo(JsonObjectConst renames, const char *member) {
+    const char *to = renames[member].as<const char *>();
+    return to && strcmp(to, member) != 0 ? to : nullptr;
+}
+
+/**
+ * @brief Renames members of object as one step, so swaps and chains move every value once.
+ *
+ * Missing members and renames to the same name are skipped.
+ *
+ * @return False, leaving members unchanged, if a renamed member would replace one that stays.
+ */
+static bool renameKeys(JsonObject members, JsonObjectConst renames) {
+    if (members.isNull()) {
+        return true;
+    }
+    JsonDocument moved;
+    for (JsonPairConst rename: renames) {
+        const char *from = rename.key().c_str();
+        const char *to = renamedTo(renames, from);
+        if (!to || members[from].isNull()) {
+            continue;
+        }
+        if (!members[to].isNull() && !renamedTo(renames, to)) {
+            return false;
+        }
+        moved[to].set(members[from]);
+    }
+    for (JsonPairConst rename: renames) {
+        if (renamedTo(renames, rename.key().c_str())) {
+            members.remove(rename.key().c_str());
+        }
+    }
+    for (JsonPair member: moved.as<JsonObject>()) {
+        members[member.key().c_str()].set(member.value());
+    }
+    return true;
+}
+
+/**
+ * @brief Advances pos past whitespace.
+ */
+template<typename Text>
+static void skipSpace(const Text &text, size_t length, size_t &pos) {
+    while (pos < length && (text[pos] == ' ' || text[pos] == '\t' || text[pos] == '\r' || text[pos] == '\n')) {
+        pos++;
+    }
+}
+
+/**
+ * @brief Advances pos past the string starting at pos, including its quotes.
+ *
+ * @return False if there is no string at pos or it is unterminated.
+ */
+template<typename Text>
+static bool skipString(const Text &text, size_t length, size_t &pos) {
+    if (pos >= length || text[pos] != '"') {
+        return false;
+    }
+    for (pos++; pos < length; pos++) {
+        if (text[pos] == '\\') {
+            pos++;
+        } else if (text[pos] == '"') {
+            pos++;
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * @brief Advances pos past the JSON value starting at pos, without parsing it.
+ *
+ * @return False if the value is truncated.
+ */
+template<typename Text>
+static bool skipValue(const Text &text, size_t length, size_t &pos) {
+    if (pos < length && text[pos] == '"') {
+        return skipString(text, length, pos);
+    }
+    if (pos < length && (text[pos] == '{' || text[pos] == '[')) {
+        size_t depth = 0;
+        while (pos < length) {
+            char c = text[pos];
+            if (c == '"') {
+                if (!skipString(text, length, pos)) {
+                    return false;
+                }
+                continue;
+            }
+            pos++;
+            if (c == '{' || c == '[') {
+                depth++;
+            } else if ((c == '}' || c == ']') && --depth == 0) {
+                return true;
+            }
+        }
+        return false;
+    }
+    // A number or literal ends at the next delimiter
+    size_t start = pos;
+    while (pos < length && text[pos] != ',' && text[pos] != '}' && text[pos] != ']' &&
+           text[pos] != ' ' && text[pos] != '\t' && text[pos] != '\r' && text[pos] != '\n') {
+        pos++;
+    }
+    return pos > start;
+}
+
+/**
+ * @brief Reads the key at pos and the colon after it, leaving pos at the value.
+ *
+ * @return False on malformed input.
+ */
+template<typename Text>
+static bool readKey(const Text &text, size_t length, size_t &pos, size_t &keyStart, size_t &keyLength) {
+    skipSpace(text, length, pos);
+    keyStart = pos + 1;
+    if (!skipString(text, length, pos)) {
+        return false;
+    }
+    keyLength = pos - 1 - keyStart;
+    skipSpace(text, length, pos);
+    if (pos >= length || text[pos] != ':') {
+        return false;
+    }
+    pos++;
+    skipSpace(text, length, pos);
+    return true;
+}
+
+/**
+ * @brief Calls visit(keyStart, keyLength, valueStart, valueLength) for each member of the object at pos.
+ *
+ * @return False on malformed input.
+ */
+template<typename Text, typename Visitor>
+static bool scanObject(const Text &text, size_t length, size_t &pos, Visitor visit) {
+    skipSpace(text, length, pos);
+    if (pos >= length || text[pos] != '{') {
+        return false;
+    }
+    pos++;
+    skipSpace(text, length, pos);
+    if (pos < length && text[pos] == '}') {
+        pos++;
+        return true;
+    }
+    while (pos < length) {
+        size_t keyStart, keyLength;
+        if (!readKey(text, length, pos, keyStart, keyLength)) {
+            return false;
+        }
+        size_t valueStart = pos;
+        if (!skipValue(text, length, pos)) {
+            return false;
+        }
+        if (!visit(keyStart, keyLength, valueStart, pos - valueStart)) {
+            return false;
+        }
+        skipSpace(text, length, pos);
+        if (pos < length && text[pos] == ',') {
+            pos++;
+        } else if (pos < length && text[pos] == '}') {
+            pos++;
+            return true;
+        } else {
+            return false;
+        }
+    }
+    return false;
+}
+
+template<typename Text>
+static bool keyIs(const Text &text, size_t keyStart, size_t keyLength, const char *name) {
+    for (size_t i = 0; i < keyLength; i++) {
+        if (name[i] != text[keyStart + i]) {
+            return false;
+        }
+    }
+    return name[keyLength] == '\0';
+}
+
+/**
+ * @brief Text of an indexed definition read from a DefinitionSource a page at a time.
+ */
+class PagedText {
+public:
+    explicit PagedText(DefinitionSource &source) : source(source) {
+    }
+
+    char operator[](size_t pos) const {
+        if (pos < start || pos >= start + sizeof(page)) {
+            start = pos;
+            size_t length = source.size() - pos < sizeof(page) ? source.size() - pos : sizeof(page);
+            if (!source.read(pos, reinterpret_cast<uint8_t *>(page), length)) {
+                length = 0;
+            }
+            memset(page + length, 0, sizeof(page) - length);
+        }
+        return page[pos - start];
+    }
+
+private:
+    DefinitionSource &source;
+    mutable char page[64];
+    mutable size_t start = SIZE_MAX;
+};
+
+/**
+ * @brief Hashes a state name (FNV-1a).
+ */
+static uint32_t hashName(const char *name) {
+    uint32_t hash = 2166136261UL;
+    while (*name) {
+        hash = (hash ^ static_cast<uint8_t>(*name++)) * 16777619UL;
+    }
+    return hash;
+}
+
+StepDefinition::StepDefinition() = default;
+
+StepDefinition::~StepDefinition() {
+    clear();
+}
+
+void StepDefinition::clear() {
+    for (size_t i = 0; stateDocs && i < stateCount; i++) {
+        delete stateDocs[i];
+    }
+    delete[] stateDocs;
+    stateDocs = nullptr;
+    delete[] states;
+    states = nullptr;
+    stateCount = 0;
+    delete output;
+    output = nullptr;
+    config = JsonObject();
+    delete[] slices;
+    slices = nullptr;
+    delete[] names;
+    names = nullptr;
+    delete[] buckets;
+    buckets = nullptr;
+    delete[] resident;
+    resident = nullptr;
+    residentCount = 0;
+    cacheCapacity = 0;
+    source = nullptr;
+    pagedSource = nullptr;
+    compiledCount = 0;
+    cacheCounters = DefinitionCacheStats();
+    delete[] slots;
+    slots = nullptr;
+    delete[] slotStates;
+    slotStates = nullptr;
+    statefulStates = 0;
+}
+
+void StepDefinition::allocateSlots(size_t count) {
+    slots = new uint16_t[count > 0 ? count : 1];
+    slotStates = new uint16_t[count > 0 ? count : 1];
+    for (size_t i = 0; i < count; i++) {
+        slots[i] = NO_SLOT;
+    }
+}
+
+void StepDefinition::assignSlot(size_t index) const {
+    StateType type = states[index].type;
+    if (slots[index] == NO_SLOT && (type == STATE_AGGREGATE || type == STATE_DEBOUNCE || type == STATE_THROTTLE)) {
+        slots[index] = static_cast<uint16_t>(statefulStates);
+        slotStates[statefulStates++] = static_cast<uint16_t>(index);
+    }
+}
+
+size_t StepDefinition::statefulCount() const {
+    return statefulStates;
+}
+
+size_t StepDefinition::slotOf(size_t index) const {
+    return index < stateCount && slots[index] != NO_SLOT ? slots[index] : SIZE_MAX;
+}
+
+size_t StepDefinition::slotState(size_t slot) const {
+    return slotStates[slot];
+}
+
+bool StepDefinition::parse(const char *jsonConfig) {
+    // Drop states compiled from a previous configuration
+    clear();
+
+    // Deserialize the JSON configuration and check for errors
+    DeserializationError error = deserializeJson(doc, jsonConfig);
+    if (error) {
+        // Handle error in case of invalid JSON input
+        Serial.println("Failed to parse JSON");
+        return false;
+    }
+    return compile(doc.as<JsonObject>());
+}
+
+bool StepDefinition::compile(JsonObject source) {
+    clear();
+    config = source;
+
+    // Snapshots record the hash, so a changed configuration is told apart from the one they were saved with
+    HashPrint hasher;
+    serializeJson(config, hasher);
+    configHash = hasher.hash;
+
+    // Compile every state once so run() never re-parses types or expressions
+    JsonObject definitions = config["States"];
+    size_t count = definitions.size();
+    if (count > 0) {
+        states = new CompiledState[count];
+        allocateSlots(count);
+        for (JsonPair kv: definitions) {
+            if (!states[stateCount].compile(kv.key().c_str(), kv.value().as<JsonObject>())) {
+                Serial.print("Failed to compile state: ");
+                Serial.println(kv.key().c_str());
+                clear();
+                return false;
+            }
+            assignSlot(stateCount);
+            stateCount++;
+        }
+    }
+
+    return compileOutput();
+}
+
+bool StepDefinition::compileOutput() {
+    // The execution's result is the part of the global state selected by "OutputPath"
+    const char *outputText = config["OutputPath"].as<const char *>();
+    if (outputText) {
+        output = new VariablePath();
+        if (!output->compile(outputText)) {
+            Serial.print("Invalid OutputPath: ");
+            Serial.println(outputText);
+            clear();
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief Indexes a configuration without compiling its states.
+ *
+ * One pass over the text records where each state's definition starts and
+ * ends; nothing is allocated per state beyond its name and a CompiledState.
+ * find() then parses and compiles a state the first time it is looked up.
+ *
+ * @code
+ * static const char config[] = "...";      // generated, thousands of states
+ * definition.index(config);
+ * stepFunction.setup(definition);
+ * @endcode
+ *
+ * @param jsonConfig The configuration; it must outlive the definition.
+ * @param length Its length, or 0 if it is NUL-terminated.
+ * @return False if the text is not a JSON object with a "States" object.
+ */
+bool StepDefinition::index(const char *jsonConfig, size_t length) {
+    clear();
+    if (!jsonConfig) {
+        return false;
+    }
+    source = jsonConfig;
+    return indexText(jsonConfig, length > 0 ? length : strlen(jsonConfig));
+}
+
+/**
+ * @brief Indexes a configuration kept in external storage, with a bounded cache of compiled states.
+ *
+ * Like index(const char *), but the text stays in the source: the index is
+ * built reading it a page at a time, and each state is read and compiled
+ * when visited. At most cacheStates compiled states stay in RAM; the least
+ * recently used one is evicted to make room. When a state is compiled, the
+ * states it can transition to are prefetched, most visited first, so a
+ * steady-state loop finds them in RAM.
+ *
+ * @code
+ * FileDefinitionSource text("/data/big.json");
+ * definition.index(text, 32);
+ * @endcode
+ *
+ * @param text The configuration; it must outlive the definition.
+ * @param cacheStates Compiled states kept in RAM, at least 2.
+ * @param prefetchStates Successors compiled ahead of a visit, at most.
+ * @return False if the text is not a JSON object with a "States" object.
+ */
+bool StepDefinition::index(DefinitionSource &text, size_t cacheStates, size_t prefetchStates) {
+    clear();
+    pagedSource = &text;
+    cacheCapacity = cacheStates >= 2 ? cacheStates : 2;
+    prefetchLimit = prefetchStates < cacheCapacity - 1 ? prefetchStates : cacheCapacity - 1;
+    resident = new uint16_t[cacheCapacity];
+    return indexText(PagedText(text), text.size());
+}
+
+template<typename Text>
+bool StepDefinition::indexText(const Text &text, size_t length) {
+    doc.clear();
+
+    // Top level: keep the small members, find the States object
+    size_t statesAt = 0;
+    size_t statesLength = 0;
+    size_t pos = 0;
+    bool scanned = scanObject(text, length, pos, [&](size_t key, size_t keyLength, size_t value, size_t valueLength) {
+        if (keyIs(text, key, keyLength, "States")) {
+            statesAt = value;
+            statesLength = valueLength;
+            return true;
+        }
+        static const char *const kept[] = {"StartAt", "OutputPath", "Version", "Migrations"};
+        for (const char *name: kept) {
+            if (keyIs(text, key, keyLength, name)) {
+                JsonDocument member;
+                if (!readSlice(value, valueLength, member)) {
+                    return false;
+                }
+                doc[name].set(member.as<JsonVariantConst>());
+            }
+        }
+        return true;
+    });
+    if (!scanned || statesLength == 0) {
+        Serial.println("Failed to parse JSON");
+        clear();
+        return false;
+    }
+
+    // Count the states and the bytes of their names
+    size_t count = 0;
+    size_t nameBytes = 0;
+    pos = statesAt;
+    scanned = scanObject(text, statesAt + statesLength, pos, [&](size_t, size_t keyLength, size_t, size_t) {
+        count++;
+        nameBytes += keyLength + 1;
+        return true;
+    });
+    if (!scanned || count >= 0xFFFF) {
+        Serial.println("Failed to parse JSON");
+        clear();
+        return false;
+    }
+
+    config = doc.as<JsonObject>();
+    states = new CompiledState[count > 0 ? count : 1];
+    allocateSlots(count);
+    stateDocs = new JsonDocument *[count > 0 ? count : 1]();
+    slices = new StateSlice[count > 0 ? count : 1]();
+    names = new char[nameBytes > 0 ? nameBytes : 1];
+    bucketMask = 1;
+    while (bucketMask + 1 < count * 2) {
+        bucketMask = (bucketMask << 1) | 1;
+    }
+    buckets = new uint16_t[bucketMask + 1]();
+
+    char *name = names;
+    pos = statesAt;
+    scanObject(text, statesAt + statesLength, pos, [&](size_t key, size_t keyLength, size_t value, size_t valueLength) {
+        for (size_t i = 0; i < keyLength; i++) {
+            name[i] = text[key + i];
+        }
+        name[keyLength] = '\0';
+        states[stateCount].name = name;
+        slices[stateCount].offset = static_cast<uint32_t>(value);
+        slices[stateCount].length = static_cast<uint32_t>(valueLength);
+        // Hashed by name so run() finds its state in O(1) however many there are
+        size_t bucket = hashName(name) & bucketMask;
+        while (buckets[bucket] != 0) {
+            bucket = (bucket + 1) & bucketMask;
+        }
+        buckets[bucket] = static_cast<uint16_t>(stateCount + 1);
+        name += keyLength + 1;
+        stateCount++;
+        return true;
+    });
+
+    // The same hash parse() gives, as long as numbers and escapes are written the way ArduinoJson writes them
+    HashPrint hasher;
+    for (size_t i = 0; i < length; i++) {
+        char c = text[i];
+        if (c == '"') {
+            size_t end = i;
+            skipString(text, length, end);
+            for (; i < end; i++) {
+                hasher.write(static_cast<uint8_t>(text[i]));
+            }
+            i--;
+        } else if (c != ' ' && c != '\t' && c != '\r' && c != '\n') {
+            hasher.write(static_cast<uint8_t>(c));
+        }
+    }
+    configHash = hasher.hash;
+    return compileOutput();
+}
+
+bool StepDefinition::readSlice(size_t offset, size_t length, JsonDocument &out) const {
+    if (source) {
+        return !deserializeJson(out, source + offset, length);
+    }
+    char *buffer = new char[length > 0 ? length : 1];
+    bool read = pagedSource->read(offset, reinterpret_cast<uint8_t *>(buffer), length) &&
+                !deserializeJson(out, const_cast<const char *>(buffer), length);
+    delete[] buffer;
+    return read;
+}
+
+size_t StepDefinition::lookup(const char *name) const {
+    for (size_t bucket = hashName(name) & bucketMask; buckets[bucket] != 0; bucket = (bucket + 1) & bucketMask) {
+        size_t index = buckets[bucket] - 1;
+        if (strcmp(states[index].name, name) == 0) {
+            return index;
+        }
+    }
+    return stateCount;
+}
+
+bool StepDefinition::compileLazily(size_t index) const {
+    StateSlice &slice = slices[index];
+    slice.visits++;
+    slice.lastUse = ++useClock;
+    if (slice.status == SLICE_COMPILED) {
+        cacheCounters.hits++;
+        return true;
+    }
+    if (slice.status == SLICE_FAILED) {
+        return false;
+    }
+    cacheCounters.misses++;
+    if (!load(index, index)) {
+        return false;
+    }
+    if (pagedSource) {
+        prefetch(index);
+    }
+    return true;
+}
+
+bool StepDefinition::load(size_t index, size_t keep) const {
+    StateSlice &slice = slices[index];
+    if (cacheCapacity > 0 && residentCount == cacheCapacity) {
+        evict(keep);
+    }
+
+    JsonDocument *stateDoc = new JsonDocument();
+    if (!readSlice(slice.offset, slice.length, *stateDoc) ||
+        !states[index].compile(states[index].name, stateDoc->as<JsonObject>())) {
+        Serial.print("Failed to compile state: ");
+        Serial.println(states[index].name);
+        const char *name = states[index].name;
+        states[index].clear();
+        states[index].name = name;
+        delete stateDoc;
+        slice.status = SLICE_FAILED;
+        return false;
+    }
+    stateDocs[index] = stateDoc;
+    slice.status = SLICE_COMPILED;
+    compiledCount++;
+    assignSlot(index);
+
+    // Executions keep per-state data that refers to Aggregate and Debounce states, so those stay compiled
+    bool pinned = states[index].type == STATE_AGGREGATE || states[index].type == STATE_DEBOUNCE;
+    if (cacheCapacity > 0 && !pinned) {
+        resident[residentCount++] = static_cast<uint16_t>(index);
+    }
+    return true;
+}
+
+void StepDefinition::evict(size_t keep) const {
+    size_t victim = residentCount;
+    for (size_t i = 0; i < residentCount; i++) {
+        if (resident[i] != keep && (victim == residentCount || slices[resident[i]].lastUse < slices[resident[victim]].lastUse)) {
+            victim = i;
+        }
+    }
+    if (victim == residentCount) {
+        return;
+    }
+    size_t index = resident[victim];
+    resident[victim] = resident[--residentCount];
+
+    delete stateDocs[index];
+    stateDocs[index] = nullptr;
+    const char *name = states[index].name;
+    states[index].clear();
+    states[index].name = name;
+    slices[index].status = SLICE_PENDING;
+    compiledCount--;
+    cacheCounters.evictions++;
+}
+
+void StepDefinition::prefetch(size_t index) const {
+    // Breadth first from the visited state; the successors of one state, most visited first
+    size_t queue[8];
+    size_t head = 0;
+    size_t count = 0;
+    auto consider = [&](JsonVariantConst next) {
+        const char *name = next.as<const char *>();
+        size_t target = name ? lookup(name) : stateCount;
+        if (target == stateCount || target == index || slices[target].status != SLICE_PENDING || count == 8) {
+            return;
+        }
+        for (size_t i = 0; i < count; i++) {
+            if (queue[i] == target) {
+                return;
+            }
+        }
+        size_t at = count++;
+        while (at > head && slices[queue[at - 1]].visits < slices[target].visits) {
+            queue[at] = queue[at - 1];
+            at--;
+        }
+        queue[at] = target;
+    };
+    auto successors = [&](size_t from) {
+        JsonObjectConst definition = states[from].definition;
+        consider(definition["Next"]);
+        consider(definition["Default"]);
+        for (JsonObjectConst rule: definition["Choices"].as<JsonArrayConst>()) {
+            consider(rule["Next"]);
+        }
+        for (JsonObjectConst rule: definition["Rules"].as<JsonArrayConst>()) {
+            consider(rule["Next"]);
+        }
+    };
+
+    successors(index);
+    for (size_t loaded = 0; head < count && loaded < prefetchLimit; loaded++) {
+        size_t target = queue[head++];
+        // Prefetched states count as just used, so the next prefetch does not evict them
+        slices[target].lastUse = useClock;
+        if (load(target, index)) {
+            cacheCounters.prefetches++;
+            successors(target);
+        }
+    }
+}
+
+size_t StepDefinition::compiled() const {
+    return slices ? compiledCount : stateCount;
+}
+
+CompiledState *StepDefinition::find(const char *name) const {
+    if (slices) {
+        // An indexed definition compiles a state the first time it is asked for
+        size_t index = lookup(name);
+        return index < stateCount && compileLazily(index) ? &states[index] : nullptr;
+    }
+    for (size_t i = 0; i < stateCount; i++) {
+        if (strcmp(name, states[i].name) == 0) {
+            return &states[i];
+        }
+    }
+    return nullptr;
+}
+
+bool StepDefinition::isPaged() const {
+    return pagedSource != nullptr;
+}
+
+const DefinitionCacheStats &StepDefinition::cacheStats() const {
+    return cacheCounters;
+}
+
+unsigned long StepDefinition::visits(size_t index) const {
+    return slices && index < stateCount ? slices[index].visits : 0;
+}
+
+CompiledState *StepDefinition::state(size_t index) const {
+    return index < stateCount ? &states[index] : nullptr;
+}
+
+size_t StepDefinition::size() const {
+    return stateCount;
+}
+
+const char *StepDefinition::startAt() const {
+    return config["StartAt"].as<const char *>();
+}
+
+const VariablePath *StepDefinition::outputPath() const {
+    return output;
+}
+
+uint32_t StepDefinition::hash() const {
+    return configHash;
+}
+
+const char *StepDefinition::version() const {
+    return config["Version"].as<const char *>();
+}
+
+JsonObjectConst StepDefinition::migrationFrom(uint32_t fromHash, const char *fromVersion) const {
+    for (JsonObjectConst migration: config["Migrations"].as<JsonArrayConst>()) {
+        JsonVariantConst from = migration["From"];
+        if (from.is<const char *>() ? fromVersion && strcmp(from.as<const char *>(), fromVersion) == 0
+                                    : from.is<uint32_t>() && from.as<uint32_t>() == fromHash) {
+            return migration;
+        }
+    }
+    return JsonObjectConst();
+}
+
+bool StepDefinition::accepts(uint32_t fromHash, const char *fromVersion) const {
+    return fromHash == 0 || fromHash == configHash || !migrationFrom(fromHash, fromVersion).isNull();
+}
+
+bool StepDefinition::migrate(JsonDocument &snapshot) const {
+    uint32_t fromHash = snapshot["Definition"].as<uint32_t>();
+    if (fromHash != 0 && fromHash != configHash) {
+        JsonObjectConst migration = migrationFrom(fromHash, snapshot["Version"].as<const char *>());
+        if (migration.isNull()) {
+            Serial.println("Snapshot is from another definition");
+            return false;
+        }
+        JsonObjectConst states = migration["States"];
+        JsonObjectConst variables = migration["Variables"];
+        if (!distinctTargets(states) || !distinctTargets(variables)) {
+            Serial.println("Migration renames collide");
+            return false;
+        }
+        const char *current = snapshot["CurrentState"].as<const char *>();
+        const char *renamed = current ? renamedTo(states, current) : nullptr;
+        if (!renameKeys(snapshot["Timers"].as<JsonObject>(), states) ||
+            !renameKeys(snapshot["Aggregates"].as<JsonObject>(), states) ||
+            !renameKeys(snapshot["GlobalState"].as<JsonObject>(), variables)) {
+            Serial.println("Migration renames collide");
+            return false;
+        }
+        if (renamed) {
+            snapshot["CurrentState"] = renamed;
+        }
+        snapshot["Definition"] = configHash;
+    }
+    const char *current = snapshot["CurrentState"].as<const char *>();
+    if (!current || !find(current)) {
+        Serial.println("Saved state does not exist in the definition");
+        return false;
+    }
+    return true;
+}
@@ -3,8 +3,98 @@
 //
 
 #include "StepFunction.h"
+#include "LzStream.h"
+#include "JournalReplay.h"
 #include <Arduino.h>
 
+/**
+ * @brief A read-only Stream over a byte buffer, for decompressing in-memory snapshots.
+ */
+class BufferStream : public Stream {
+public:
+    BufferStream(const uint8_t *data, size_t length) : data(data), length(length) {
+    }
+
+    int available() override {
+        return static_cast<int>(length - position);
+    }
+
+    int read() override {
+        return position < length ? data[position++] : -1;
+    }
+
+    int peek() override {
+        return position < length ? data[position] : -1;
+    }
+
+    size_t write(uint8_t) override {
+        return 0;
+    }
+
+private:
+    const uint8_t *data;
+    size_t length;
+    size_t position = 0;
+};
+
+/**
+ * @brief Returns true if a snapshot starting with this byte is JSON rather than MessagePack.
+ */
+static bool isJsonStart(int first) {
+    return first == '{' || first == ' ' || first == '\t' || first == '\r' || first == '\n';
+}
+
+/**
+ * @brief Returns the text a Choice compares: a string as it is, any other value in its JSON form.
+ *
+ * Numbers and booleans thus match their text, e.g. 5 matches "5" and true matches "true".
+ *
+ * @param buffer Receives the JSON form of a short non-string value.
+ * @param spill Receives the JSON form of a longer one.
+ * @return The text, or nullptr if the value is null.
+ */
+static const char *choiceText(JsonVariantConst value, char (&buffer)[24], String &spill) {
+    if (value.isNull()) {
+        return nullptr;
+    }
+    const char *text = value.as<const char *>();
+    if (text) {
+        return text;
+    }
+    if (measureJson(value) < sizeof(buffer)) {
+        serializeJson(value, buffer, sizeof(buffer));
+        return buffer;
+    }
+    spill = value.as<String>();
+    return spill.c_str();
+}
+
+/**
+ * @brief Counts the bytes passing to the store, for CheckpointStats::bytes.
+ */
+class CountingPrint : public Print {
+public:
+    explicit CountingPrint(Print &destination) : destination(destination) {
+    }
+
+    size_t write(uint8_t value) override {
+        size_t written = destination.write(value);
+        count += written;
+        return written;
+    }
+
+    size_t write(const uint8_t *buffer, size_t size) override {
+        size_t written = destination.write(buffer, size);
+        count += written;
+        return written;
+    }
+
+    size_t count = 0;
+
+private:
+    Print &destination;
+};
+
 /**
  * @brief Constructs a StepFunction object.
  *
@@ -17,6 +107,24 @@ StepFunction::StepFunction(StepFunction::FunctionCallback callback) {
     functionCallback = callback;
 }
 
+/**
+ * @brief Constructs a StepFunction whose Task states call a handler working on the variable store.
+ *
+ * Unlike a FunctionCallback, a TaskHandler reads and writes through
+ * Variables, so a forked execution keeps sharing its unmodified variables
+ * with its parent.
+ *
+ * @param handler A user-defined function to handle "Task" type states.
+ */
+StepFunction::StepFunction(StepFunction::TaskHandler handler) {
+    taskHandler = handler;
+}
+
+StepFunction::~StepFunction() {
+    clearRuntime();
+    delete owned;
+}
+
 /**
  * @brief Initializes the StepFunction with a JSON-based configuration.
  *
@@ -47,16 +155,365 @@ StepFunction::StepFunction(StepFunction::FunctionCallback callback) {
  * @endcode
  */
 void StepFunction::setup(const char *jsonConfig) {
-    // Deserialize the JSON configuration and check for errors
-    DeserializationError error = deserializeJson(doc, jsonConfig);
-    if (error) {
-        // Handle error in case of invalid JSON input
-        Serial.println("Failed to parse JSON");
+    // Drop states compiled from a previous configuration
+    clearRuntime();
+    lazySnapshot = nullptr;
+    hydrationFailed = false;
+    if (!owned) {
+        owned = new StepDefinition();
+    }
+    bool parsed = owned->parse(jsonConfig);
+    bind(*owned);
+    if (!parsed) {
         return;
     }
 
     // Initialize the current state with the "StartAt" value from the JSON
-    currentState = doc["StartAt"].as<String>();
+    currentState = owned->startAt();
+}
+
+/**
+ * @brief Starts a fresh execution of a shared, already compiled definition.
+ *
+ * Nothing is parsed or compiled: the execution only allocates its own
+ * global state and per-state data, so executions of one definition are
+ * cheap to create and recycle.
+ *
+ * @param shared The definition to run.
+ */
+void StepFunction::setup(StepDefinition &shared) {
+    clearRuntime();
+    lazySnapshot = nullptr;
+    hydrationFailed = false;
+    bind(shared);
+    variables.clear();
+    currentState = shared.startAt();
+    waitUntil = 0;
+    recommendedDelay = 0;
+}
+
+/**
+ * @brief Starts a fresh execution of the current definition with the given input.
+ *
+ * @code
+ * JsonDocument input;
+ * input["threshold"] = 30;
+ * stepFunction.start(input.as<JsonVariantConst>());
+ * while (stepFunction.run() != END_OF_PROCESS) {}
+ * stepFunction.writeOutput(Serial);
+ * @endcode
+ *
+ * @param input The execution input.
+ * @return False if no definition has been set up.
+ */
+bool StepFunction::start(JsonVariantConst input) {
+    if (!definition) {
+        return false;
+    }
+    return start(*definition, input);
+}
+
+bool StepFunction::start(StepDefinition &shared, JsonVariantConst input) {
+    setup(shared);
+    globalState.set(input);
+    // Input comes from outside; only handles the engine stored itself are references
+    variables.stripBlobs();
+    if (journal) {
+        journal->recordStart(clockMillis(), globalState.as<JsonVariantConst>());
+    }
+    return true;
+}
+
+bool StepFunction::start(Stream &input) {
+    if (!definition) {
+        return false;
+    }
+    return start(*definition, input);
+}
+
+bool StepFunction::start(StepDefinition &shared, Stream &input, DeserializationError *result) {
+    setup(shared);
+    DeserializationError error = deserializeJson(globalState, input);
+    if (result) {
+        *result = error;
+    }
+    // The variables are the members of an object; any other document would leave them unwritable
+    if (!error && !globalState.is<JsonObject>()) {
+        Serial.println("Execution input is not an object");
+        globalState.clear();
+        return false;
+    }
+    if (error) {
+        if (error != DeserializationError::EmptyInput) {
+            Serial.println("Failed to parse execution input");
+        }
+        globalState.clear();
+        return false;
+    }
+    // As with start(JsonVariantConst): handles in the stream are not references this execution holds
+    variables.stripBlobs();
+    if (journal) {
+        journal->recordStart(clockMillis(), globalState.as<JsonVariantConst>());
+    }
+    return true;
+}
+
+/**
+ * @brief Forks this execution into child, sharing variables copy-on-write.
+ *
+ * The child continues from the same state with the same timers and
+ * aggregate windows. Neither execution copies variables until it writes
+ * one, and then only that top-level variable.
+ *
+ * @code
+ * StepFunction trial(handler);
+ * stepFunction.fork(trial);
+ * trial.setVariable("gain", value);
+ * @endcode
+ *
+ * @param child The execution to overwrite with the fork.
+ * @return False if this execution has no definition, child is this execution, or its snapshot failed to decode.
+ */
+bool StepFunction::fork(StepFunction &child) {
+    if (!definition || &child == this || !hydrate()) {
+        return false;
+    }
+    child.lazySnapshot = nullptr;
+    child.hydrationFailed = false;
+    child.clearRuntime();
+    child.bind(*definition);
+    variables.fork(child.variables);
+
+    child.currentState = currentState;
+    child.waitUntil = waitUntil;
+    child.recommendedDelay = recommendedDelay;
+    for (size_t slot = 0; slot < slotCapacity; slot++) {
+        const CompiledState *state = &states[definition->slotState(slot)];
+        size_t childSlot = child.slotFor(state);
+        child.timers[childSlot] = timers[slot];
+        if (windows[slot]) {
+            child.windowFor(state).copyFrom(*windows[slot]);
+        }
+    }
+    child.debounceSample.set(debounceSample.as<JsonVariantConst>());
+    return true;
+}
+
+JsonVariantConst StepFunction::output() {
+    if (!hydrate()) {
+        return JsonVariantConst();
+    }
+    // A forked execution's whole-store output needs its shared variables in one document;
+    // an OutputPath is resolved through the layers instead
+    const VariablePath *path = definition ? definition->outputPath() : nullptr;
+    if (!path || path->size() == 0) {
+        variables.flatten();
+    }
+    return outputView();
+}
+
+JsonVariantConst StepFunction::outputView() const {
+    const VariablePath *path = definition ? definition->outputPath() : nullptr;
+    if (!path || path->size() == 0) {
+        return globalState.as<JsonVariantConst>();
+    }
+    // Through every layer, so a fork sees the variables it still shares with its parent
+    return variables.resolve(*path);
+}
+
+size_t StepFunction::writeOutput(Print &destination) {
+    return serializeJson(output(), destination);
+}
+
+size_t StepFunction::writeOutput(char *buffer, size_t size) {
+    return serializeJson(output(), buffer, size);
+}
+
+size_t StepFunction::measureOutput() {
+    return measureJson(output());
+}
+
+void StepFunction::bind(StepDefinition &target) {
+    definition = &target;
+    states = target.state(0);
+    stateCount = target.size();
+    current = nullptr;
+    // Only Aggregate, Debounce and Throttle states keep data per execution
+    slotCapacity = target.statefulCount();
+    if (slotCapacity > 0) {
+        windows = new AggregateWindow *[slotCapacity]();
+        timers = new StateTimer[slotCapacity]();
+    }
+    if (profiling && stateCount > 0) {
+        profiles = new StateProfile[stateCount]();
+    }
+}
+
+unsigned long StepFunction::clockMillis() const {
+    return clock ? clock(clockContext) : millis();
+}
+
+void StepFunction::setClock(Clock source, void *context) {
+    clock = source;
+    clockContext = context;
+}
+
+void StepFunction::setWaitListener(WaitListener listener, void *context) {
+    waitListener = listener;
+    waitListenerContext = context;
+}
+
+void StepFunction::setProfiling(bool enabled) {
+    profiling = enabled;
+    if (!enabled) {
+        delete[] profiles;
+        profiles = nullptr;
+    } else if (!profiles && stateCount > 0) {
+        profiles = new StateProfile[stateCount]();
+    }
+}
+
+void StepFunction::writeProfile(JsonObject out) const {
+    for (size_t i = 0; profiles && i < stateCount; i++) {
+        const StateProfile &profile = profiles[i];
+        if (profile.runs == 0) {
+            continue;
+        }
+        JsonObject entry = out[states[i].name].to<JsonObject>();
+        if (states[i].type == STATE_TASK) {
+            entry["Resource"] = states[i].definition["Resource"];
+        }
+        entry["Runs"] = profile.runs;
+        entry["MeanMicros"] = profile.totalMicros / profile.runs;
+        entry["MaxMicros"] = profile.maxMicros;
+        entry["HandlerMaxMicros"] = profile.handlerMaxMicros;
+    }
+}
+
+/**
+ * @brief Records this execution's inputs and run() decisions, for JournalReplay.
+ *
+ * @code
+ * File file = SD.open("/journal.jsonl", FILE_APPEND);
+ * ExecutionJournal journal(file);
+ * stepFunction.setJournal(&journal);
+ * @endcode
+ *
+ * @param target The journal, or nullptr to stop recording.
+ */
+void StepFunction::setJournal(ExecutionJournal *target) {
+    journal = target;
+    if (journal && definition) {
+        JsonDocument saved;
+        if (snapshot(saved, false)) {
+            journal->recordSnapshot(clockMillis(), saved.as<JsonVariantConst>());
+        }
+    }
+}
+
+StepDefinition *StepFunction::getDefinition() const {
+    return definition;
+}
+
+unsigned long StepFunction::getWaitUntil() const {
+    return waitUntil;
+}
+
+CompiledState *StepFunction::findState(const String &name) {
+    return definition ? definition->find(name.c_str()) : nullptr;
+}
+
+void StepFunction::applyAssign(const Assignment *assign) {
+    if (assign && !assign->apply(variables)) {
+#ifdef LOG
+        Serial.println("Assign expression failed to evaluate.");
+#endif
+    }
+}
+
+size_t StepFunction::slotFor(const CompiledState *state) {
+    size_t slot = definition->slotOf(state - states);
+    if (slot >= slotCapacity) {
+        // An indexed definition numbers its stateful states as it compiles them
+        size_t capacity = definition->statefulCount();
+        AggregateWindow **grownWindows = new AggregateWindow *[capacity]();
+        StateTimer *grownTimers = new StateTimer[capacity]();
+        for (size_t i = 0; i < slotCapacity; i++) {
+            grownWindows[i] = windows[i];
+            grownTimers[i] = timers[i];
+        }
+        delete[] windows;
+        delete[] timers;
+        windows = grownWindows;
+        timers = grownTimers;
+        slotCapacity = capacity;
+    }
+    return slot;
+}
+
+void StepFunction::resetSlots() {
+    for (size_t slot = 0; slot < slotCapacity; slot++) {
+        delete windows[slot];
+        windows[slot] = nullptr;
+        timers[slot].armed = false;
+    }
+    debounceSample.clear();
+}
+
+AggregateWindow &StepFunction::windowFor(const CompiledState *state) {
+    size_t slot = slotFor(state);
+    if (!windows[slot]) {
+        windows[slot] = new AggregateWindow(*state->aggregate);
+    }
+    return *windows[slot];
+}
+
+void StepFunction::publishAggregate(const CompiledState *state, const AggregateWindow &window) {
+    const AggregateDefinition &definition = *state->aggregate;
+    AggregateWindow::Statistics statistics;
+    window.summarize(statistics);
+
+    // Overwrite the members in place so cached slots of a fixed-layout store stay valid
+    JsonObject result = globalState[definition.result];
+    if (result.isNull()) {
+        result = globalState[definition.result].to<JsonObject>();
+        variables.invalidate();
+    }
+    result["count"] = statistics.count;
+    result["min"] = statistics.min;
+    result["max"] = statistics.max;
+    result["mean"] = statistics.mean;
+    result["variance"] = statistics.variance;
+    for (size_t i = 0; i < definition.percentileCount; i++) {
+        char key[8];
+        snprintf(key, sizeof(key), "p%u", static_cast<unsigned>(definition.percentiles[i]));
+        result[static_cast<const char *>(key)] = window.percentile(definition.percentiles[i]);
+    }
+    variables.noteWrite(result);
+}
+
+void StepFunction::armDebounce(const CompiledState *state, JsonVariantConst value, unsigned long now) {
+    size_t slot = slotFor(state);
+    StateTimer &timer = timers[slot];
+    debounceSample.set(value);
+    timer.armed = true;
+    timer.at = now;
+    waitUntil = timer.at + state->period;
+    recommendedDelay = state->period;
+}
+
+void StepFunction::clearRuntime() {
+    for (size_t slot = 0; windows && slot < slotCapacity; slot++) {
+        delete windows[slot];
+    }
+    delete[] windows;
+    windows = nullptr;
+    delete[] timers;
+    timers = nullptr;
+    slotCapacity = 0;
+    delete[] profiles;
+    profiles = nullptr;
+    debounceSample.clear();
 }
 
 /**
@@ -66,6 +523,15 @@ void StepFunction::setup(const char *jsonConfig) {
  * - Task: Executes a function defined by the user.
  * - Choice: Branches to different states based on conditions.
  * - Wait: Delays the execution for a defined period before transitioning.
+ * - Pass: Applies its Assign block and transitions.
+ * - DecisionTable: Transitions to the first rule matching the inputs.
+ * - Aggregate: Adds the Variable to a sliding window and writes its statistics to ResultPath.
+ * - Debounce: Waits until the Variable has kept the same value for Millis.
+ * - Throttle: Passes at most once per Millis; otherwise waits, or takes Default if present.
+ *
+ * Assign blocks compiled by setup() are applied after the state's own work:
+ * after the callback for Task states, from the matched rule (or the state
+ * itself when falling through to Default) for Choice states.
  *
  * @return An integer status:
  * - WAIT_DELAY: Indicates the function is in a "Wait" state.
@@ -73,10 +539,12 @@ void StepFunction::setup(const char *jsonConfig) {
  * - END_OF_PROCESS: Indicates the end of the state machine process.
  * - INVALID_STATE: Indicates an invalid or unrecognized state.
  */
-int StepFunction::run() {
+int StepFunction::step(unsigned long now) {
+    processed = nullptr;
+
     // Check if still in wait state
-    if (millis() < waitUntil) {
-        recommendedDelay = waitUntil - millis();
+    if (now < waitUntil) {
+        recommendedDelay = waitUntil - now;
         if (recommendedDelay < 0) {
             recommendedDelay = 0;
         }
@@ -87,22 +555,31 @@ int StepFunction::run() {
         return WAIT_DELAY; // Wait state delay
     }
 
-    // Access "States" object from the parsed JSON document
-    JsonObject states = doc["States"];
-    JsonObject state = states[currentState];
+    // A lazily restored execution decodes its variables once it actually runs; one whose
+    // snapshot is unreadable must not carry on with an empty variable store
+    if (!hydrate()) {
+        Serial.println("Saved state could not be decoded");
+        return INVALID_STATE;
+    }
+
+    // Resolve the compiled entry for the current state; only re-scan after a transition, or
+    // every time when the definition may have evicted it since
+    if (!current || currentState != current->name || definition->isPaged()) {
+        current = findState(currentState);
+    }
 
-    if (!state.isNull()) {
-        // Get the type of the current state
-        String type = state["Type"].as<String>();
+    if (current) {
+        processed = current;
+        JsonObject state = current->definition;
 #ifdef LOG
         Serial.print("Processing state: ");
         Serial.println(currentState);
         Serial.print("State type: ");
-        Serial.println(type);
+        Serial.println(state["Type"].as<const char *>());
 #endif
 
-        if (type == "Task") {
-            waitUntil = millis();
+        if (current->type == STATE_TASK) {
+            waitUntil = now;
             // Handle "Task" state
             String resource = state["Resource"].as<String>();
 #ifdef LOG
@@ -110,7 +587,35 @@ int StepFunction::run() {
             Serial.println(resource);
 #endif
             // Execute user-defined callback function
-            functionCallback(resource, globalState);
+            if (replay) {
+                // A replay takes the variables the device's Task produced instead of running it
+                JsonVariantConst outcome = replay->taskOutcome(resource);
+                if (!outcome.isNull()) {
+                    variables.clear();
+                    globalState.set(outcome);
+                    variables.invalidate();
+                }
+            } else if (taskHandler) {
+                // Handlers may write the document directly, so the changedBytes count compares before and after
+                variables.watchWrites();
+                unsigned long called = profiles ? micros() : 0;
+                taskHandler(resource, variables);
+                handlerMicros = profiles ? micros() - called : 0;
+                variables.noteWatchedWrites();
+            } else {
+                // The document-based callback needs every variable in one document
+                variables.flatten();
+                variables.watchWrites();
+                unsigned long called = profiles ? micros() : 0;
+                functionCallback(resource, globalState);
+                handlerMicros = profiles ? micros() - called : 0;
+                variables.noteWatchedWrites();
+            }
+            if (journal) {
+                variables.flatten();
+                journal->recordTask(now, resource, globalState.as<JsonVariantConst>());
+            }
+            applyAssign(current->assign);
 
             // Transition to the next state or end the process
             if (state["Next"].is<String>()) {
@@ -124,54 +629,227 @@ int StepFunction::run() {
                 Serial.println("End of process.");
                 return END_OF_PROCESS;
             }
-        } else if (type == "Choice") {
-            waitUntil = millis();
+        } else if (current->type == STATE_PASS) {
+            waitUntil = now;
+            // Handle "Pass" state: only its Assign block does any work
+            applyAssign(current->assign);
+
+            if (state["Next"].is<String>()) {
+                currentState = state["Next"].as<String>();
+#ifdef LOG
+                Serial.print("Transitioning to next state: ");
+                Serial.println(currentState);
+#endif
+            } else {
+                Serial.println("End of process.");
+                return END_OF_PROCESS;
+            }
+        } else if (current->type == STATE_CHOICE) {
+            waitUntil = now;
 
             // Handle "Choice" state for conditional branching
             JsonArray choices = state["Choices"];
-            String variable = state["Variable"].as<String>();
 
 #ifdef LOG
             Serial.print("Evaluating choices for variable: ");
-            Serial.println(variable);
+            Serial.println(state["Variable"].as<const char *>());
 #endif
 
-            // Fetch value of the variable from global state
-            String value = globalState[variable].as<String>();
+            // Fetch value of the variable through its compiled path
+            char valueBuffer[24];
+            String valueSpill;
+            const char *value = nullptr;
+            if (current->variable) {
+                value = choiceText(variables.resolve(*current->variable), valueBuffer, valueSpill);
+            }
             Serial.print("Variable value: ");
-            Serial.println(value);
+            Serial.println(value ? value : "null");
 
             bool matched = false;
+            size_t index = 0;
+
+            // One pass of the automaton decides every StringMatches rule on the state's Variable
+            if (current->matcher && value) {
+                current->matcher->match(value);
+            }
 
             // Iterate through all choices to find a match
             for (JsonObject choice: choices) {
-                auto expect = choice["StringEquals"].as<String>();
-                Serial.print("Choice: ");
-                Serial.println(expect);
+                const CompiledChoice &compiled = current->choices[index++];
+
+                // Rules may name their own Variable
+                char subjectBuffer[24];
+                String subjectSpill;
+                const char *subject = value;
+                if (compiled.variable) {
+                    subject = choiceText(variables.resolve(*compiled.variable), subjectBuffer, subjectSpill);
+                }
 
-                if (expect == value) {
+                if (compiled.condition) {
+                    // "Condition" rules evaluate their compiled expression
+                    ExpressionValue outcome;
+                    matched = compiled.condition->evaluate(variables, outcome) && outcome.truthy();
+                } else if (compiled.pattern >= 0) {
+                    if (!subject) {
+                        matched = false;
+                    } else if (compiled.matcher) {
+                        compiled.matcher->match(subject);
+                        matched = compiled.matcher->matched(compiled.pattern);
+                    } else {
+                        matched = current->matcher->matched(compiled.pattern);
+                    }
+                } else {
+                    const char *expect = choice["StringEquals"].as<const char *>();
+                    Serial.print("Choice: ");
+                    Serial.println(expect ? expect : "null");
+                    matched = subject && expect && strcmp(expect, subject) == 0;
+                }
+
+                if (matched) {
 #ifdef LOG
                     Serial.print("Match found. Transitioning to: ");
                     Serial.println(choice["Next"].as<String>());
 #endif
+                    applyAssign(compiled.assign);
                     currentState = choice["Next"].as<String>();
-                    matched = true;
                     break;
                 }
             }
 
             // Default state if no choices matched
             if (!matched) {
+                applyAssign(current->assign);
                 currentState = state["Default"].as<String>();
 #ifdef LOG
                 Serial.print("No match found. Transitioning to default state: ");
                 Serial.println(currentState);
 #endif
             }
-        } else if (type == "Wait") {
+        } else if (current->type == STATE_DECISION_TABLE) {
+            waitUntil = now;
+
+            // Handle "DecisionTable" state: one bitset lookup per input
+            int rule = current->table->evaluate(variables);
+            if (rule >= 0) {
+                applyAssign(current->choices[rule].assign);
+                currentState = current->table->next(rule);
+#ifdef LOG
+                Serial.print("Rule ");
+                Serial.print(rule);
+                Serial.print(" matched. Transitioning to: ");
+                Serial.println(currentState);
+#endif
+            } else {
+                applyAssign(current->assign);
+                currentState = state["Default"].as<String>();
+#ifdef LOG
+                Serial.print("No rule matched. Transitioning to default state: ");
+                Serial.println(currentState);
+#endif
+            }
+        } else if (current->type == STATE_AGGREGATE) {
+            waitUntil = now;
+
+            // Handle "Aggregate" state: fold the sample into this execution's window
+            AggregateWindow &window = windowFor(current);
+            JsonVariantConst sample = variables.resolve(*current->variable);
+            if (!sample.is<bool>() && (sample.is<long>() || sample.is<unsigned long>() || sample.is<double>())) {
+                window.add(sample.as<float>(), now);
+            } else {
+#ifdef LOG
+                Serial.println("Aggregate variable is not a number; sample skipped.");
+#endif
+            }
+            window.expire(now);
+            publishAggregate(current, window);
+            applyAssign(current->assign);
+
+            if (state["Next"].is<String>()) {
+                currentState = state["Next"].as<String>();
+#ifdef LOG
+                Serial.print("Transitioning to next state: ");
+                Serial.println(currentState);
+#endif
+            } else {
+                Serial.println("End of process.");
+                return END_OF_PROCESS;
+            }
+        } else if (current->type == STATE_DEBOUNCE) {
+            // Handle "Debounce" state: the wait timer doubles as the stability window
+            size_t slot = slotFor(current);
+            StateTimer &timer = timers[slot];
+            JsonVariantConst value = variables.resolve(*current->variable);
+            if (!timer.armed || !(value == debounceSample.as<JsonVariantConst>())) {
+                // First visit, or the value moved while nobody called setVariable(): start over
+                armDebounce(current, value, now);
+#ifdef LOG
+                Serial.print("Debouncing for ");
+                Serial.print(current->period);
+                Serial.println(" millis.");
+#endif
+                return WAIT_DELAY;
+            }
+
+            timer.armed = false;
+            debounceSample.clear();
+            waitUntil = now;
+            applyAssign(current->assign);
+
+            if (state["Next"].is<String>()) {
+                currentState = state["Next"].as<String>();
+#ifdef LOG
+                Serial.print("Value stable. Transitioning to next state: ");
+                Serial.println(currentState);
+#endif
+            } else {
+                Serial.println("End of process.");
+                return END_OF_PROCESS;
+            }
+        } else if (current->type == STATE_THROTTLE) {
+            // Handle "Throttle" state: pass at most once per period
+            size_t slot = slotFor(current);
+            StateTimer &timer = timers[slot];
+            if (timer.armed && now - timer.at < current->period) {
+                if (state["Default"].is<String>()) {
+                    // Throttled executions are diverted instead of delayed
+                    waitUntil = now;
+                    currentState = state["Default"].as<String>();
+#ifdef LOG
+                    Serial.print("Throttled. Transitioning to default state: ");
+                    Serial.println(currentState);
+#endif
+                    return NEXT_STEP;
+                }
+
+                waitUntil = timer.at + current->period;
+                recommendedDelay = waitUntil - now;
+#ifdef LOG
+                Serial.print("Throttled. recommendedDelay set.");
+                Serial.println(recommendedDelay);
+#endif
+                return WAIT_DELAY;
+            }
+
+            timer.armed = true;
+            timer.at = now;
+            waitUntil = now;
+            applyAssign(current->assign);
+
+            if (state["Next"].is<String>()) {
+                currentState = state["Next"].as<String>();
+#ifdef LOG
+                Serial.print("Transitioning to next state: ");
+                Serial.println(currentState);
+#endif
+            } else {
+                Serial.println("End of process.");
+                return END_OF_PROCESS;
+            }
+        } else if (current->type == STATE_WAIT) {
             // Handle "Wait" state with timed delay
             int waitMillis = state["Millis"].as<int>();
-            waitUntil = millis() + waitMillis; // Set delay time
+            waitUntil = now + waitMillis; // Set delay time
+            applyAssign(current->assign);
             currentState = state["Next"].as<String>(); // Transition to the next state
 #ifdef LOG
             Serial.print("Wait state detected. Delaying for ");
@@ -192,10 +870,186 @@ int StepFunction::run() {
     return INVALID_STATE;
 }
 
+/**
+ * @brief Executes the current state, then takes a checkpoint if the policy asks for one.
+ *
+ * @return An integer representing the current execution status.
+ */
+int StepFunction::run() {
+    unsigned long now = clockMillis();
+    if (!checkpointStore && !profiles) {
+        int result = step(now);
+        if (journal) {
+            journal->recordRun(now, result, currentState);
+        }
+        return result;
+    }
+
+    unsigned long started = micros();
+    handlerMicros = 0;
+    int result = step(now);
+    if (profiles && processed) {
+        StateProfile &profile = profiles[processed - states];
+        unsigned long took = micros() - started;
+        profile.runs++;
+        profile.totalMicros += took;
+        if (took > profile.maxMicros) {
+            profile.maxMicros = took;
+        }
+        if (handlerMicros > profile.handlerMaxMicros) {
+            profile.handlerMaxMicros = handlerMicros;
+        }
+    }
+    if (journal) {
+        journal->recordRun(now, result, currentState);
+    }
+    if (!checkpointStore) {
+        return result;
+    }
+
+    // A Wait state moves on when it is entered; Debounce and Throttle report WAIT_DELAY while they hold
+    bool transitioned = processed &&
+                        (result == NEXT_STEP || result == END_OF_PROCESS || processed->type == STATE_WAIT);
+    if (transitioned) {
+        transitionsSinceCheckpoint++;
+        bool due = (policy.everyTransitions > 0 && transitionsSinceCheckpoint >= policy.everyTransitions) ||
+                   (policy.onWait && processed->type == STATE_WAIT) ||
+                   (policy.afterSideEffects && processed->sideEffects) ||
+                   (policy.changedBytes > 0 && variables.changedBytes() >= policy.changedBytes);
+        if (due) {
+            checkpoint();
+        }
+    }
+
+    checkpointStats.runMicros += micros() - started;
+    return result;
+}
+
+/**
+ * @brief Sets a store and a policy under which run() checkpoints the execution by itself.
+ *
+ * @code
+ * CheckpointPolicy policy;
+ * policy.everyTransitions = 20;
+ * policy.onWait = true;
+ * policy.afterSideEffects = true;
+ * stepFunction.setCheckpointing(store, policy);
+ * @endcode
+ *
+ * @param store Receives the checkpoints; it must outlive the execution.
+ * @param checkpointPolicy When to checkpoint.
+ */
+void StepFunction::setCheckpointing(SnapshotStore &store, const CheckpointPolicy &checkpointPolicy) {
+    checkpointStore = &store;
+    policy = checkpointPolicy;
+    transitionsSinceCheckpoint = 0;
+    variables.setChangeTracking(policy.changedBytes > 0);
+}
+
+void StepFunction::disableCheckpointing() {
+    checkpointStore = nullptr;
+    variables.setChangeTracking(false);
+}
+
+bool StepFunction::checkpoint() {
+    // An unreadable snapshot is not replaced by an empty one
+    if (!checkpointStore || !hydrate()) {
+        return false;
+    }
+    unsigned long started = micros();
+
+    CountingPrint out(checkpointStore->open());
+    if (policy.compress) {
+        LzEncoder encoder(out);
+        saveStateBinary(encoder);
+        encoder.finish();
+    } else {
+        saveStateBinary(out);
+    }
+    bool committed = checkpointStore->commit();
+
+    if (committed) {
+        checkpointStats.checkpoints++;
+        checkpointStats.bytes += out.count;
+        transitionsSinceCheckpoint = 0;
+        variables.resetChangedBytes();
+    } else {
+        checkpointStats.failures++;
+#ifdef LOG
+        Serial.println("Checkpoint failed.");
+#endif
+    }
+    checkpointStats.persistMicros += micros() - started;
+    return committed;
+}
+
+const CheckpointStats &StepFunction::getCheckpointStats() const {
+    return checkpointStats;
+}
+
 unsigned long StepFunction::getRecommendedDelay() {
     return recommendedDelay;
 }
 
+/**
+ * @brief Declares whether the global state keeps a fixed layout.
+ *
+ * With a fixed layout, Task callbacks promise to only overwrite scalar values
+ * in globalState: no member is removed, and no object or array is replaced.
+ * Compiled paths (Choice variables, expression references, decision table
+ * inputs) then cache the slot they resolved and skip the key scans on later
+ * runs. restoreState() discards the cached slots.
+ *
+ * @param fixed True to enable slot caching.
+ */
+void StepFunction::setFixedLayout(bool fixed) {
+    variables.setFixedLayout(fixed);
+}
+
+void StepFunction::setSharedScope(JsonVariantConst scope) {
+    variables.setSharedScope(scope);
+}
+
+void StepFunction::setBlobPool(BlobPool &pool) {
+    variables.setBlobPool(&pool);
+}
+
+/**
+ * @brief Writes a top-level variable from outside a Task callback.
+ *
+ * A write that changes the value watched by the armed Debounce state moves
+ * waitUntil forward instead of waking the execution, so a bouncing input
+ * still produces a single run() once it settles.
+ *
+ * @param name The variable name.
+ * @param value The new value.
+ * @return False if the execution's lazily restored snapshot failed to decode.
+ */
+bool StepFunction::setVariable(const char *name, JsonVariantConst value) {
+    if (!hydrate()) {
+        return false;
+    }
+    // A handle from outside is not a reference this execution holds; setBlob() passes one in
+    variables.set(name, Variables::blobHandle(value) != 0 ? JsonVariantConst() : value);
+    unsigned long now = clockMillis();
+    if (journal) {
+        journal->recordSet(now, name, value);
+    }
+
+    if (current && current->type == STATE_DEBOUNCE && currentState == current->name) {
+        size_t slot = slotFor(current);
+        StateTimer &timer = timers[slot];
+        JsonVariantConst watched = variables.resolve(*current->variable);
+        if (timer.armed && !(watched == debounceSample.as<JsonVariantConst>())) {
+            armDebounce(current, watched, now);
+            if (waitListener) {
+                waitListener(waitListenerContext, *this);
+            }
+        }
+    }
+    return true;
+}
+
 
 /**
  * @brief Saves the step function's internal state into a JSON object.
@@ -204,25 +1058,92 @@ unsigned long StepFunction::getRecommendedDelay() {
  * and other relevant data into a JSON object. The generated JSON 
  * can be used to persist the state across sessions.
  * 
- * @return A JSON string representing the saved state.
+ * @return A JSON string representing the saved state, or an empty string if the execution's snapshot failed to decode.
  */
 String StepFunction::saveState() {
     JsonDocument saveDoc; // Adjust size based on requirements
+    if (!snapshot(saveDoc, false)) {
+        return String();
+    }
+
+    // Serialize and return the JSON string
+    String savedState;
+    serializeJson(saveDoc, savedState);
+    return savedState;
+}
+
+/**
+ * @brief Saves the internal state as MessagePack, with blob variables as raw binary.
+ *
+ * @code
+ * File file = LittleFS.open("/state.bin", "w");
+ * stepFunction.saveStateBinary(file);
+ * @endcode
+ *
+ * @param destination The Print or Stream receiving the snapshot.
+ * @return The number of bytes written; 0 if the execution's snapshot failed to decode.
+ */
+size_t StepFunction::saveStateBinary(Print &destination) {
+    JsonDocument saveDoc;
+    if (!snapshot(saveDoc, true)) {
+        return 0;
+    }
+    return serializeMsgPack(saveDoc, destination);
+}
+
+bool StepFunction::snapshot(JsonDocument &saveDoc, bool binary) {
+    if (!hydrate()) {
+        return false;
+    }
 
     // Save the global state
-    saveDoc["GlobalState"] = globalState;
+    JsonVariant saved = saveDoc["GlobalState"].to<JsonVariant>();
+    variables.merge(saved);
+
+    // Pool handles mean nothing after a reboot: write the bytes they name, or nothing in JSON
+    for (JsonPair kv: saved.as<JsonObject>()) {
+        Blob blob;
+        if (Variables::blobHandle(kv.value()) == 0) {
+            continue;
+        }
+        if (binary && variables.blobOf(kv.value(), blob)) {
+            kv.value().set(MsgPackBinary(blob.data, blob.length));
+        } else {
+            kv.value().set(nullptr);
+        }
+    }
 
-    // Save the current state
+    // Save the current state, and the definition it is a state of
     saveDoc["CurrentState"] = currentState;
+    if (definition) {
+        saveDoc["Definition"] = definition->hash();
+        if (definition->version()) {
+            saveDoc["Version"] = definition->version();
+        }
+    }
 
     // Save the wait-related information
     saveDoc["WaitUntil"] = waitUntil;
     saveDoc["RecommendedDelay"] = recommendedDelay;
 
-    // Serialize and return the JSON string
-    String savedState;
-    serializeJson(saveDoc, savedState);
-    return savedState;
+    // Save the sample windows of Aggregate states
+    for (size_t slot = 0; slot < slotCapacity; slot++) {
+        if (windows[slot]) {
+            const char *name = states[definition->slotState(slot)].name;
+            windows[slot]->save(saveDoc["Aggregates"][name].to<JsonObject>());
+        }
+    }
+
+    // Save the Debounce and Throttle timers
+    for (size_t slot = 0; slot < slotCapacity; slot++) {
+        if (timers[slot].armed) {
+            saveDoc["Timers"][states[definition->slotState(slot)].name] = timers[slot].at;
+        }
+    }
+    if (!debounceSample.isNull()) {
+        saveDoc["DebounceSample"] = debounceSample;
+    }
+    return true;
 }
 
 /**
@@ -244,8 +1165,205 @@ bool StepFunction::restoreState(const String &savedState) {
         return false;
     }
 
-    // Restore the global state
+    return restore(restoreDoc);
+}
+
+/**
+ * @brief Restores a snapshot written by saveStateBinary(), or an LzEncoder-compressed one.
+ *
+ * Blob variables are copied into the blob pool, if one is set; otherwise
+ * they stay in the global state as MessagePack binary values, which
+ * Variables::getBlob() reads in place.
+ *
+ * @param data The snapshot bytes.
+ * @param length The snapshot size.
+ * @return True if the state was restored successfully; otherwise, false.
+ */
+bool StepFunction::restoreStateBinary(const uint8_t *data, size_t length) {
+    if (length > 0 && data[0] == LZ_MAGIC) {
+        BufferStream compressed(data, length);
+        return restoreState(compressed);
+    }
+    JsonDocument restoreDoc;
+    bool json = length > 0 && isJsonStart(data[0]);
+    DeserializationError error = json ? deserializeJson(restoreDoc, reinterpret_cast<const char *>(data), length)
+                                      : deserializeMsgPack(restoreDoc, data, length);
+    if (error) {
+        Serial.println("Failed to parse saved state");
+        return false;
+    }
+    if (!restore(restoreDoc)) {
+        return false;
+    }
+    if (!json) {
+        adoptBlobs();
+    }
+    return true;
+}
+
+/**
+ * @brief Restores only the cursor of a snapshot; the variables are decoded when first needed.
+ *
+ * The current state, wait timer and recommended delay are read with a
+ * filter that skips everything else, so a scheduler can queue the execution
+ * at once. The rest of the snapshot is decoded by hydrate(), which run()
+ * calls once the execution is due, and which every method touching the
+ * variables (setVariable(), output(), saveState(), fork()) calls first.
+ *
+ * @param data The snapshot, in any format restoreStateBinary() accepts. It
+ * is referenced, not copied, and must stay valid until the execution is
+ * hydrated or restarted.
+ * @param length The snapshot size.
+ * @return False if the cursor could not be decoded, or the definition does not accept the snapshot.
+ */
+bool StepFunction::restoreStateLazy(const uint8_t *data, size_t length) {
+    JsonDocument cursor;
+    if (!peekSnapshot(data, length, cursor) || (definition && !definition->migrate(cursor))) {
+        return false;
+    }
+
+    // Nothing from before the restore may stay visible until the variables arrive
+    variables.clear();
+    resetSlots();
+
+    currentState = cursor["CurrentState"].as<String>();
+    waitUntil = cursor["WaitUntil"].as<unsigned long>();
+    recommendedDelay = cursor["RecommendedDelay"].as<unsigned long>();
+    lazySnapshot = data;
+    lazyLength = length;
+    hydrationFailed = false;
+    return true;
+}
+
+/**
+ * @brief Decodes the cursor of a snapshot: its current state, wait timer and definition.
+ *
+ * Everything else is skipped by a deserialization filter, so this is cheap
+ * enough to run over a whole store of snapshots, e.g. to pick each one's
+ * definition from a DefinitionRegistry before resuming it.
+ *
+ * @param data The snapshot, JSON, MessagePack or compressed.
+ * @param length The snapshot size.
+ * @param cursor Receives CurrentState, WaitUntil, RecommendedDelay, Definition and Version.
+ * @return False if the snapshot could not be decoded.
+ */
+bool StepFunction::peekSnapshot(const uint8_t *data, size_t length, JsonDocument &cursor) {
+    JsonDocument filter;
+    filter["CurrentState"] = true;
+    filter["WaitUntil"] = true;
+    filter["RecommendedDelay"] = true;
+    filter["Definition"] = true;
+    filter["Version"] = true;
+
+    DeserializationError error;
+    if (length > 0 && data[0] == LZ_MAGIC) {
+        BufferStream compressed(data, length);
+        LzDecoder decoder(compressed);
+        error = isJsonStart(decoder.peek())
+                    ? deserializeJson(cursor, decoder, DeserializationOption::Filter(filter))
+                    : deserializeMsgPack(cursor, decoder, DeserializationOption::Filter(filter));
+    } else if (length > 0 && isJsonStart(data[0])) {
+        error = deserializeJson(cursor, reinterpret_cast<const char *>(data), length,
+                                DeserializationOption::Filter(filter));
+    } else {
+        error = deserializeMsgPack(cursor, data, length, DeserializationOption::Filter(filter));
+    }
+    if (error || !cursor["CurrentState"].is<const char *>()) {
+        Serial.println("Failed to parse saved state");
+        return false;
+    }
+    return true;
+}
+
+bool StepFunction::hydrate() {
+    if (!lazySnapshot) {
+        return !hydrationFailed;
+    }
+    const uint8_t *data = lazySnapshot;
+    lazySnapshot = nullptr;
+    hydrationFailed = !restoreStateBinary(data, lazyLength);
+    return !hydrationFailed;
+}
+
+bool StepFunction::isHydrated() const {
+    return lazySnapshot == nullptr;
+}
+
+bool StepFunction::restoreStateBinary(Stream &source) {
+    return restoreState(source);
+}
+
+/**
+ * @brief Restores a snapshot from a stream, whatever its format.
+ *
+ * The first byte tells the formats apart: LZ_MAGIC starts a compressed
+ * snapshot, which is decompressed while it is parsed; `{` (or whitespace)
+ * starts a saveState() JSON snapshot; anything else is read as MessagePack.
+ *
+ * @param source The stream positioned at the snapshot.
+ * @return True if the state was restored successfully; otherwise, false.
+ */
+bool StepFunction::restoreState(Stream &source) {
+    int first = source.peek();
+    if (first == LZ_MAGIC) {
+        LzDecoder decoder(source);
+        if (!decoder.valid()) {
+            Serial.println("Unsupported compressed saved state");
+            return false;
+        }
+        return restoreState(decoder);
+    }
+
+    JsonDocument restoreDoc;
+    bool json = isJsonStart(first);
+    DeserializationError error = json ? deserializeJson(restoreDoc, source) : deserializeMsgPack(restoreDoc, source);
+    if (error) {
+        Serial.println("Failed to parse saved state");
+        return false;
+    }
+    if (!restore(restoreDoc)) {
+        return false;
+    }
+    if (!json) {
+        adoptBlobs();
+    }
+    return true;
+}
+
+void StepFunction::adoptBlobs() {
+    BlobPool *pool = variables.blobPool();
+    if (!pool) {
+        return;
+    }
+    for (JsonPair kv: globalState.as<JsonObject>()) {
+        if (!kv.value().is<MsgPackBinary>()) {
+            continue;
+        }
+        MsgPackBinary binary = kv.value().as<MsgPackBinary>();
+        uint32_t handle = pool->copy(static_cast<const uint8_t *>(binary.data()), binary.size());
+        if (handle == 0) {
+#ifdef LOG
+            Serial.println("Blob pool exhausted; blob kept in the global state.");
+#endif
+            continue;
+        }
+        kv.value().to<JsonObject>()["$blob"] = handle;
+    }
+    variables.invalidate();
+}
+
+bool StepFunction::restore(JsonDocument &restoreDoc) {
+    // Renames of a newer definition apply to the parsed document; nothing is re-serialized
+    if (definition && !definition->migrate(restoreDoc)) {
+        return false;
+    }
+    lazySnapshot = nullptr;
+    hydrationFailed = false;
+
+    // Restore the global state; a snapshot stores blobs as bytes, never as handles
+    variables.clear();
     globalState = restoreDoc["GlobalState"].as<JsonObject>();
+    variables.stripBlobs();
 
     // Restore the current state
     currentState = restoreDoc["CurrentState"].as<String>();
@@ -254,5 +1372,28 @@ bool StepFunction::restoreState(const String &savedState) {
     waitUntil = restoreDoc["WaitUntil"].as<unsigned long>();
     recommendedDelay = restoreDoc["RecommendedDelay"].as<unsigned long>();
 
+    // Restore the sample windows of Aggregate states; find() compiles a state if the definition was only indexed.
+    // An execution restored before setup() has no states to hold windows or timers
+    resetSlots();
+    if (definition) {
+        for (JsonPairConst saved: restoreDoc["Aggregates"].as<JsonObjectConst>()) {
+            const CompiledState *state = definition->find(saved.key().c_str());
+            if (state && state->type == STATE_AGGREGATE) {
+                windowFor(state).restore(saved.value().as<JsonObjectConst>());
+            }
+        }
+
+        // Restore the Debounce and Throttle timers
+        for (JsonPairConst saved: restoreDoc["Timers"].as<JsonObjectConst>()) {
+            const CompiledState *state = definition->find(saved.key().c_str());
+            if (state && (state->type == STATE_DEBOUNCE || state->type == STATE_THROTTLE)) {
+                size_t slot = slotFor(state);
+                StateTimer &timer = timers[slot];
+                timer.armed = true;
+                timer.at = saved.value().as<unsigned long>();
+            }
+        }
+    }
+    debounceSample.set(restoreDoc["DebounceSample"].as<JsonVariantConst>());
     return true;
 }
@@ -0,0 +1,99 @@
+#include "TimerQueue.h"
+
+TimerQueue::TimerQueue(size_t capacity)
+    : entries(new Entry[capacity]), capacity(capacity) {
+}
+
+TimerQueue::~TimerQueue() {
+    delete[] entries;
+}
+
+bool TimerQueue::before(unsigned long a, unsigned long b) {
+    return static_cast<long>(a - b) < 0;
+}
+
+bool TimerQueue::push(unsigned long deadline, uint32_t id) {
+    if (count == capacity) {
+        return false;
+    }
+    size_t index = count++;
+    while (index > 0) {
+        size_t parent = (index - 1) / 2;
+        if (!before(deadline, entries[parent].deadline)) {
+            break;
+        }
+        entries[index] = entries[parent];
+        index = parent;
+    }
+    entries[index] = {deadline, id};
+    return true;
+}
+
+const TimerQueue::Entry &TimerQueue::top() const {
+    return entries[0];
+}
+
+void TimerQueue::pop() {
+    if (count == 0) {
+        return;
+    }
+    Entry last = entries[--count];
+    size_t index = 0;
+    while (true) {
+        size_t child = 2 * index + 1;
+        if (child >= count) {
+            break;
+        }
+        if (child + 1 < count && before(entries[child + 1].deadline, entries[child].deadline)) {
+            child++;
+        }
+        if (!before(entries[child].deadline, last.deadline)) {
+            break;
+        }
+        entries[index] = entries[child];
+        index = child;
+    }
+    entries[index] = last;
+}
+
+bool TimerQueue::reschedule(uint32_t id, unsigned long deadline) {
+    for (size_t i = 0; i < count; i++) {
+        if (entries[i].id == id) {
+            entries[i].deadline = deadline;
+            sift(i);
+            return true;
+        }
+    }
+    return false;
+}
+
+void TimerQueue::sift(size_t index) {
+    Entry moved = entries[index];
+    while (index > 0 && before(moved.deadline, entries[(index - 1) / 2].deadline)) {
+        entries[index] = entries[(index - 1) / 2];
+        index = (index - 1) / 2;
+    }
+    while (true) {
+        size_t child = 2 * index + 1;
+        if (child >= count) {
+            break;
+        }
+        if (child + 1 < count && before(entries[child + 1].deadline, entries[child].deadline)) {
+            child++;
+        }
+        if (!before(entries[child].deadline, moved.deadline)) {
+            break;
+        }
+        entries[index] = entries[child];
+        index = child;
+    }
+    entries[index] = moved;
+}
+
+bool TimerQueue::empty() const {
+    return count == 0;
+}
+
+size_t TimerQueue::size() const {
+    return count;
+}
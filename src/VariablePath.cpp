@@ -0,0 +1,208 @@
+#include "VariablePath.h"
+#include "Variables.h"
+#include <string.h>
+#include <stdlib.h>
+
+static bool isIdentifierChar(char c) {
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_';
+}
+
+VariablePath::VariablePath() = default;
+
+VariablePath::~VariablePath() {
+    clear();
+}
+
+void VariablePath::clear() {
+    delete[] segments;
+    delete[] keys;
+    segments = nullptr;
+    keys = nullptr;
+    segmentCount = 0;
+    cachedEpoch = 0;
+}
+
+bool VariablePath::compile(const char *source) {
+    return compile(source, strlen(source));
+}
+
+void VariablePath::compileKey(const char *key) {
+    clear();
+
+    size_t length = strlen(key);
+    keys = new char[length + 1];
+    memcpy(keys, key, length + 1);
+    segments = new Segment[1];
+    segments[0].key = keys;
+    segments[0].index = 0;
+    segmentCount = 1;
+}
+
+/**
+ * @brief Compiles a reference path into its segment array.
+ *
+ * The text is scanned twice: once to count segments and validate the syntax,
+ * and once to copy keys into a single allocation. Resolution afterwards never
+ * touches the source text again.
+ */
+bool VariablePath::compile(const char *source, size_t length) {
+    clear();
+
+    const char *end = source + length;
+    const char *p = source;
+
+    // Optional "$" or "$." prefix
+    if (p < end && *p == '$') {
+        p++;
+        if (p < end && *p == '.') {
+            p++;
+        }
+    }
+
+    // First pass: validate and measure
+    size_t count = 0;
+    size_t keyBytes = 0;
+    bool expectKey = p < end && *p != '[';
+    const char *scan = p;
+    while (scan < end) {
+        if (expectKey) {
+            const char *start = scan;
+            while (scan < end && isIdentifierChar(*scan)) scan++;
+            if (scan == start) return false;
+            keyBytes += scan - start + 1;
+            count++;
+            expectKey = false;
+        } else if (*scan == '.') {
+            scan++;
+            expectKey = true;
+            if (scan == end) return false;
+        } else if (*scan == '[') {
+            scan++;
+            if (scan < end && (*scan == '\'' || *scan == '"')) {
+                char quote = *scan++;
+                const char *start = scan;
+                while (scan < end && *scan != quote) scan++;
+                if (scan >= end) return false;
+                keyBytes += scan - start + 1;
+                scan++;
+            } else {
+                const char *start = scan;
+                while (scan < end && *scan >= '0' && *scan <= '9') scan++;
+                if (scan == start) return false;
+            }
+            if (scan >= end || *scan != ']') return false;
+            scan++;
+            count++;
+        } else {
+            return false;
+        }
+    }
+
+    if (count == 0) {
+        return true;
+    }
+
+    segments = new Segment[count];
+    keys = new char[keyBytes > 0 ? keyBytes : 1];
+    char *out = keys;
+
+    // Second pass: emit segments
+    expectKey = true;
+    while (p < end) {
+        Segment &segment = segments[segmentCount];
+        if (expectKey && isIdentifierChar(*p)) {
+            const char *start = p;
+            while (p < end && isIdentifierChar(*p)) p++;
+            memcpy(out, start, p - start);
+            out[p - start] = '\0';
+            segment.key = out;
+            segment.index = 0;
+            out += p - start + 1;
+            segmentCount++;
+            expectKey = false;
+        } else if (*p == '.') {
+            p++;
+            expectKey = true;
+        } else {
+            // '[' index or quoted key ']'
+            p++;
+            if (*p == '\'' || *p == '"') {
+                char quote = *p++;
+                const char *start = p;
+                while (*p != quote) p++;
+                memcpy(out, start, p - start);
+                out[p - start] = '\0';
+                segment.key = out;
+                segment.index = 0;
+                out += p - start + 1;
+                p++;
+            } else {
+                size_t index = 0;
+                while (*p >= '0' && *p <= '9') index = index * 10 + (*p++ - '0');
+                segment.key = nullptr;
+                segment.index = index;
+            }
+            p++;
+            segmentCount++;
+            expectKey = false;
+        }
+    }
+    return true;
+}
+
+JsonVariantConst VariablePath::resolve(JsonVariantConst root) const {
+    return walk(root, 0);
+}
+
+JsonVariantConst VariablePath::walk(JsonVariantConst node, size_t first) const {
+    for (size_t i = first; i < segmentCount; i++) {
+        if (segments[i].key) {
+            node = node[segments[i].key];
+        } else {
+            node = node[segments[i].index];
+        }
+        if (node.isNull()) {
+            break;
+        }
+    }
+    return node;
+}
+
+JsonVariantConst VariablePath::resolve(JsonVariantConst root, uint32_t epoch) const {
+    if (epoch != 0 && epoch == cachedEpoch) {
+        return cached;
+    }
+
+    JsonVariantConst node = resolve(root);
+
+    // Only cache slots that exist; a missing member may be added later
+    if (epoch != 0 && !node.isNull()) {
+        cached = node;
+        cachedEpoch = epoch;
+    }
+    return node;
+}
+
+JsonVariantConst VariablePath::resolve(const Variables &variables, uint32_t epoch) const {
+    if (epoch != 0 && epoch == cachedEpoch) {
+        return cached;
+    }
+
+    JsonVariantConst node;
+    if (segmentCount > 0 && segments[0].key) {
+        // The top-level name may live in a layer shared with other executions
+        node = walk(variables.get(segments[0].key), 1);
+    } else {
+        node = walk(variables.root(), 0);
+    }
+
+    if (epoch != 0 && !node.isNull()) {
+        cached = node;
+        cachedEpoch = epoch;
+    }
+    return node;
+}
+
+size_t VariablePath::size() const {
+    return segmentCount;
+}
@@ -0,0 +1,337 @@
+#include "Variables.h"
+#include "VariablePath.h"
+#include "HashPrint.h"
+#include <string.h>
+
+uint32_t Variables::nextEpoch = 0;
+
+Variables::Variables(JsonDocument &document) : doc(document) {
+    currentEpoch = ++nextEpoch;
+}
+
+Variables::~Variables() {
+    releaseBlobs(doc);
+    detach();
+    delete[] fingerprints;
+}
+
+JsonVariantConst Variables::resolve(const VariablePath &path) const {
+    return path.resolve(*this, epoch());
+}
+
+JsonVariantConst Variables::get(const char *name) const {
+    JsonVariantConst value = doc.as<JsonVariantConst>()[name];
+    for (const VariableScope *layer = base; layer && value.isNull(); layer = layer->parent) {
+        value = layer->doc.as<JsonVariantConst>()[name];
+    }
+    if (value.isNull() && !shared.isNull()) {
+        value = shared[name];
+    }
+    return value;
+}
+
+bool Variables::isContainer(JsonVariantConst value) {
+    return value.is<JsonObjectConst>() || value.is<JsonArrayConst>();
+}
+
+void Variables::prepareWrite(const char *name) {
+    if (blobs) {
+        blobs->release(blobHandle(doc.as<JsonVariantConst>()[name]));
+    }
+    // A slot cached from a shared layer would keep returning the hidden value
+    if ((base || !shared.isNull()) && doc.as<JsonVariantConst>()[name].isNull() && !get(name).isNull()) {
+        invalidate();
+    }
+}
+
+JsonVariant Variables::edit(const char *name) {
+    if (doc.as<JsonVariantConst>()[name].isNull()) {
+        // Copy up only this variable; every other one stays shared
+        doc[name] = get(name);
+        retainBlob(doc[name]);
+    }
+    // The caller is about to modify it; count the value as rewritten
+    noteWrite(doc[name]);
+    invalidate();
+    return doc[name].as<JsonVariant>();
+}
+
+void Variables::fork(Variables &child) {
+    // Freeze this execution's writes into a new layer; moving keeps them where they are
+    if (!base || doc.size() > 0) {
+        VariableScope *layer = new VariableScope();
+        layer->doc = static_cast<JsonDocument &&>(doc);
+        layer->parent = base;
+        base = layer;
+    }
+    doc.clear();
+
+    child.clear();
+    child.base = base;
+    base->references++;
+    child.fixedLayout = fixedLayout;
+    child.shared = shared;
+    child.blobs = blobs;
+
+    invalidate();
+    child.invalidate();
+}
+
+/**
+ * @brief Copies a layer and everything below it into target, oldest first.
+ */
+static void mergeLayer(const VariableScope *layer, JsonObject target) {
+    if (!layer) {
+        return;
+    }
+    mergeLayer(layer->parent, target);
+    for (JsonPairConst kv: layer->doc.as<JsonObjectConst>()) {
+        target[kv.key()] = kv.value();
+    }
+}
+
+void Variables::merge(JsonVariant target) const {
+    if (!base) {
+        target.set(doc.as<JsonVariantConst>());
+        return;
+    }
+    JsonObject merged = target.to<JsonObject>();
+    mergeLayer(base, merged);
+    for (JsonPairConst kv: doc.as<JsonObjectConst>()) {
+        merged[kv.key()] = kv.value();
+    }
+}
+
+void Variables::flatten() {
+    if (!base) {
+        return;
+    }
+    JsonDocument merged;
+    merge(merged.to<JsonVariant>());
+    releaseBlobs(doc);
+    doc = merged;
+    retainBlobs();
+    detach();
+    invalidate();
+}
+
+void Variables::detach() {
+    VariableScope *layer = base;
+    base = nullptr;
+    while (layer && --layer->references == 0) {
+        VariableScope *parent = layer->parent;
+        releaseBlobs(layer->doc);
+        delete layer;
+        layer = parent;
+    }
+}
+
+void Variables::setBlobPool(BlobPool *pool) {
+    blobs = pool;
+}
+
+BlobPool *Variables::blobPool() const {
+    return blobs;
+}
+
+uint32_t Variables::blobHandle(JsonVariantConst value) {
+    JsonObjectConst object = value.as<JsonObjectConst>();
+    if (object.isNull() || object.size() != 1) {
+        return 0;
+    }
+    JsonVariantConst handle = object["$blob"];
+    return handle.is<uint32_t>() ? handle.as<uint32_t>() : 0;
+}
+
+bool Variables::setBlob(const char *name, uint32_t handle) {
+    Blob blob;
+    if (!blobs || !blobs->get(handle, blob)) {
+        if (blobs) {
+            blobs->release(handle);
+        }
+        return false;
+    }
+    prepareWrite(name);
+    // The variable takes over the caller's reference, so no retain here
+    doc[name].to<JsonObject>()["$blob"] = handle;
+    if (trackChanges) {
+        changed += blob.length;
+    }
+    invalidate();
+    return true;
+}
+
+bool Variables::getBlob(const char *name, Blob &blob) const {
+    return blobOf(get(name), blob);
+}
+
+bool Variables::blobOf(JsonVariantConst value, Blob &blob) const {
+    if (value.is<MsgPackBinary>()) {
+        MsgPackBinary binary = value.as<MsgPackBinary>();
+        blob.data = static_cast<const uint8_t *>(binary.data());
+        blob.length = binary.size();
+        blob.owned = false;
+        return true;
+    }
+    uint32_t handle = blobHandle(value);
+    return handle != 0 && blobs && blobs->get(handle, blob);
+}
+
+void Variables::retainBlob(JsonVariant value) {
+    uint32_t handle = blobHandle(value);
+    if (blobs && handle != 0 && !blobs->retain(handle)) {
+        // Without a reference of its own, the variable would release someone else's
+        value.set(nullptr);
+    }
+}
+
+void Variables::retainBlobs() {
+    for (JsonPair kv: doc.as<JsonObject>()) {
+        retainBlob(kv.value());
+    }
+}
+
+void Variables::stripBlobs() {
+    for (JsonPair kv: doc.as<JsonObject>()) {
+        if (blobHandle(kv.value()) != 0) {
+            kv.value().set(nullptr);
+        }
+    }
+    invalidate();
+}
+
+void Variables::releaseBlobs(JsonVariantConst variables) {
+    if (!blobs) {
+        return;
+    }
+    for (JsonPairConst kv: variables.as<JsonObjectConst>()) {
+        blobs->release(blobHandle(kv.value()));
+    }
+}
+
+void Variables::setChangeTracking(bool enabled) {
+    trackChanges = enabled;
+    changed = 0;
+}
+
+void Variables::noteWrite(JsonVariantConst value) {
+    if (trackChanges && !watching) {
+        changed += measureJson(value);
+    }
+}
+
+/**
+ * @brief Hashes a member name.
+ */
+static uint32_t keyHash(const char *key) {
+    HashPrint hasher;
+    hasher.write(reinterpret_cast<const uint8_t *>(key), strlen(key));
+    return hasher.hash;
+}
+
+/**
+ * @brief Hashes the serialized form of a value.
+ */
+static uint32_t valueHash(JsonVariantConst value) {
+    HashPrint hasher;
+    serializeJson(value, hasher);
+    return hasher.hash;
+}
+
+void Variables::watchWrites() {
+    if (!trackChanges) {
+        return;
+    }
+    JsonObjectConst members = doc.as<JsonObjectConst>();
+    size_t count = members.size();
+    if (count > fingerprintCapacity) {
+        delete[] fingerprints;
+        fingerprints = new uint32_t[count * 2];
+        fingerprintCapacity = count;
+    }
+    fingerprintCount = 0;
+    for (JsonPairConst kv: members) {
+        fingerprints[fingerprintCount * 2] = keyHash(kv.key().c_str());
+        fingerprints[fingerprintCount * 2 + 1] = valueHash(kv.value());
+        fingerprintCount++;
+    }
+    watching = true;
+}
+
+void Variables::noteWatchedWrites() {
+    if (!watching) {
+        return;
+    }
+    watching = false;
+    size_t next = 0;
+    for (JsonPairConst kv: doc.as<JsonObjectConst>()) {
+        uint32_t key = keyHash(kv.key().c_str());
+        // Members keep their order, so the one fingerprinted next is usually the match
+        size_t found = fingerprintCount;
+        for (size_t i = 0; i < fingerprintCount; i++) {
+            size_t candidate = (next + i) % fingerprintCount;
+            if (fingerprints[candidate * 2] == key) {
+                found = candidate;
+                break;
+            }
+        }
+        if (found == fingerprintCount || fingerprints[found * 2 + 1] != valueHash(kv.value())) {
+            noteWrite(kv.value());
+        } else {
+            next = found + 1;
+        }
+    }
+}
+
+size_t Variables::changedBytes() const {
+    return changed;
+}
+
+void Variables::resetChangedBytes() {
+    changed = 0;
+}
+
+void Variables::clear() {
+    releaseBlobs(doc);
+    detach();
+    doc.clear();
+    invalidate();
+}
+
+void Variables::setSharedScope(JsonVariantConst scope) {
+    shared = scope;
+    invalidate();
+}
+
+bool Variables::isLayered() const {
+    return base != nullptr;
+}
+
+JsonDocument &Variables::document() {
+    return doc;
+}
+
+JsonVariantConst Variables::root() const {
+    return doc;
+}
+
+void Variables::setFixedLayout(bool fixed) {
+    fixedLayout = fixed;
+    invalidate();
+}
+
+bool Variables::isFixedLayout() const {
+    return fixedLayout;
+}
+
+void Variables::invalidate() {
+    // Epochs are unique across stores, so a path cached by another execution never matches
+    currentEpoch = ++nextEpoch;
+    if (currentEpoch == 0) {
+        currentEpoch = ++nextEpoch;
+    }
+}
+
+uint32_t Variables::epoch() const {
+    return fixedLayout ? currentEpoch : 0;
+}